@@ -6,7 +6,7 @@ OC = x86_64-pc-elf-objcopy
 
 # Global flag definitions
 AF_ALL = -felf64 -O0
-CF_ALL = -nostartfiles -nostdlib -nodefaultlibs -fno-builtin
+CF_ALL = -nostartfiles -nostdlib -nodefaultlibs -fno-builtin -mno-red-zone -mno-mmx -mno-sse -mno-sse2
 LF_ALL = -i
 
 # Target object definition
@@ -71,8 +71,8 @@ static uint8 ata_read_reg(uint8 channel, uint8 reg) {
    unsigned char result;
    if (reg > 0x07 && reg < 0x0C){
       ata_write_reg(channel, ATA_REG_CONTROL, 0x80 | (_ide_chan[channel].no_int << 1));
+      ndelay(400);
    }
-   sleep(1);
    if (reg < 0x08){
       result = inb(_ide_chan[channel].base + reg - 0x00);
    } else if (reg < 0x0C){
@@ -91,8 +91,8 @@ static uint8 ata_read_reg(uint8 channel, uint8 reg) {
 static void ata_read_buffer(uint8 channel, uint8 reg, uint32 *buffer, uint64 quads) {
    if (reg > 0x07 && reg < 0x0C){
       ata_write_reg(channel, ATA_REG_CONTROL, 0x80 | (_ide_chan[channel].no_int << 1));
+      ndelay(400);
    }
-   sleep(1);
    //asm("pushw %es; movw %ds, %ax; movw %ax, %es");
    if (reg < 0x08){
       insd(_ide_chan[channel].base  + reg - 0x00, buffer, quads);
@@ -146,11 +146,11 @@ static void ata_init_dev(uint8 i){
  
         // Select the drive on channel
         ata_write_reg(i, ATA_REG_HDDEVSEL, 0xA0 | (j << 4)); // Select Drive.
-        sleep(1);
+        ndelay(400);
 
         // Send ATA IDENTIFY command
         ata_write_reg(i, ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
-        sleep(1);
+        ndelay(400);
 
         // Polling
         if (ata_read_reg(i, ATA_REG_STATUS) == 0) {
@@ -182,7 +182,7 @@ static void ata_init_dev(uint8 i){
             }
  
             ata_write_reg(i, ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
-            sleep(1);
+            ndelay(400);
         }
  
         // Read Identification Space of the device
@@ -239,7 +239,7 @@ static void ata_init_dev(uint8 i){
 static uint64 ata_poll(uint8 channel, uint8 err_check){
     uint64 spins = 0;
     // Wait at least 400ns before reading status
-    sleep(1);
+    ndelay(400);
     // Polling
     while (ata_read_reg(channel, ATA_REG_STATUS) & ATA_SR_BSY){
         spins ++;
@@ -271,7 +271,7 @@ static uint64 ata_poll(uint8 channel, uint8 err_check){
 */
 static void ata_dev_sel(uint8 idx){
     ata_write_reg(_ata_dev[idx].channel, ATA_REG_HDDEVSEL, 0xE0 | (_ata_dev[idx].status.slave << 4));
-    sleep(1);
+    ndelay(400);
 }
 
 bool ata_init(){
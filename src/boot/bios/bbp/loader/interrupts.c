@@ -44,6 +44,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "io.h"
 #include "paging.h"
 #include "cr.h"
+#include "msr.h"
 #if DEBUG == 1
 	#include "debug_print.h"
 #endif
@@ -89,6 +90,18 @@ isr_handler_t isr_handlers[256];
 */
 irq_handler_t irq_handlers[16];
 /**
+* Interrupt statistics
+*/
+static interrupt_stat_t _stats[256];
+/**
+* Start of the open interrupts-off window (0 if interrupts are enabled)
+*/
+static uint64 _off_start = 0;
+/**
+* Longest interrupts-off window
+*/
+static uint64 _off_max = 0;
+/**
 * Current interrupt status
 */
 static bool _int_enabled = false;
@@ -235,10 +248,17 @@ void interrupt_disable(){
     if (_int_enabled){
         asm volatile("cli");
         _int_enabled = false;
+        _off_start = rdtsc();
     }
 }
 void interrupt_enable(){
+    uint64 cycles;
     if (!_int_enabled){
+        cycles = rdtsc() - _off_start;
+        if (_off_start != 0 && cycles > _off_max){
+            _off_max = cycles;
+        }
+        _off_start = 0;
         asm volatile("sti");
         _int_enabled = true;
     }
@@ -261,7 +281,35 @@ static void print_stack(isr_stack_t *stack){
 	debug_print(DC_WRD, "RSP: %x, RIP: %x", stack->rsp, stack->rip);
 }
 
-void isr_wrapper(isr_stack_t *stack){
+/**
+* Account handler time of an interrupt
+* @param int_no - interrupt number
+* @param start - TSC at handler entry
+*/
+static void interrupt_account(uint8 int_no, uint64 start){
+	uint64 cycles = rdtsc() - start;
+	uint64 bucket = 0;
+	uint64 c = cycles >> INTERRUPT_STAT_SHIFT;
+	while (c != 0 && bucket < INTERRUPT_STAT_BUCKETS - 1){
+		c >>= 1;
+		bucket ++;
+	}
+	_stats[int_no].count ++;
+	_stats[int_no].cycles += cycles;
+	_stats[int_no].hist[bucket] ++;
+	if (cycles > _stats[int_no].max){
+		_stats[int_no].max = cycles;
+	}
+	// Gate disables interrupts for the handler - a window of its own unless it interrupted one
+	if (_off_start == 0 && cycles > _off_max){
+		_off_max = cycles;
+	}
+}
+/**
+* Process an exception or software interrupt
+* @param stack - registers pushed on the stack by assembly
+*/
+static void isr_process(isr_stack_t *stack){
 	uint8 int_no = (uint8)stack->int_no;
 	// Try to handle interrupt
 	if (isr_handlers[int_no] != 0){
@@ -319,7 +367,11 @@ void isr_wrapper(isr_stack_t *stack){
 	}
 }
 
-void irq_wrapper(irq_stack_t *stack){
+/**
+* Process a hardware interrupt
+* @param stack - registers pushed on the stack by assembly
+*/
+static void irq_process(irq_stack_t *stack){
     uint8 irq_no = (uint8)stack->irq_no;
     uint16 isr = pic_read_ocw3(PIC_READ_ISR);
 
@@ -349,3 +401,20 @@ void irq_wrapper(irq_stack_t *stack){
         pic_eoi(irq_no);
     }
 }
+
+interrupt_stat_t *interrupt_stats(uint64 int_no){
+	return &_stats[int_no & 0xFF];
+}
+uint64 interrupt_off_max(){
+	return _off_max;
+}
+void isr_wrapper(isr_stack_t *stack){
+	uint64 start = rdtsc();
+	isr_process(stack);
+	interrupt_account((uint8)stack->int_no, start);
+}
+void irq_wrapper(irq_stack_t *stack){
+	uint64 start = rdtsc();
+	irq_process(stack);
+	interrupt_account((uint8)stack->int_no, start);
+}
@@ -42,6 +42,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "common.h"
 
+// Number of histogram buckets (powers of 2 of TSC cycles)
+#define INTERRUPT_STAT_BUCKETS 12
+// First bucket holds durations below 2^INTERRUPT_STAT_SHIFT cycles, last one everything above
+#define INTERRUPT_STAT_SHIFT 9
+
 // Remaped IRQ numbers to interrupt numbers
 #define IRQ0 32
 #define IRQ1 33
@@ -134,6 +139,15 @@ typedef uint64(*isr_handler_t)(isr_stack_t* stack) ;
 */
 typedef uint64(*irq_handler_t)(irq_stack_t* stack) ;
 /**
+* Per-vector interrupt statistics (entry to exit, in TSC cycles)
+*/
+typedef struct {
+	uint64 count;				// Number of interrupts
+	uint64 cycles;				// Total time spent in the handler
+	uint64 max;					// Longest handler run
+	uint32 hist[INTERRUPT_STAT_BUCKETS];	// Duration histogram
+} interrupt_stat_t;
+/**
 * Interrupt Descriptor Table (IDT) pointer structure
 */
 typedef struct packed{
@@ -178,6 +192,17 @@ void interrupt_reg_isr_handler(uint64 int_no, isr_handler_t handler);
 */
 void interrupt_reg_irq_handler(uint64 irq_no, irq_handler_t handler);
 /**
+* Get interrupt statistics
+* @param int_no - interrupt number
+* @return statistics of the vector
+*/
+interrupt_stat_t *interrupt_stats(uint64 int_no);
+/**
+* Get the longest interrupts-off window (handlers and interrupt_disable() sections)
+* @return duration in TSC cycles
+*/
+uint64 interrupt_off_max();
+/**
 * Interrupt Service Routine (ISR) wrapper
 * This will be defined in kernel code
 * @param stack - registers pushed on the stack by assembly
@@ -90,6 +90,8 @@ void main64(){
         pic_enable(0xFFFF);
         // Enable interrupts (Do it after PCI, otherwise it seems to GPF at random)
         interrupt_enable();
+        // Calibrate TSC for short delays
+        sleep_init();
         // Initialize PCI
         if (pci_init()){
 	        // Initialize ATA
@@ -117,6 +119,8 @@ void main64(){
 	    debug_print(DC_WB, "Wrong checksum");
 #endif
     }
-	// Infinite loop
-	while(true){}
+	// Nothing left to do - sleep between interrupts instead of spinning
+	while(true){
+		asm volatile("hlt");
+	}
 }
@@ -124,5 +124,14 @@ static inline void msr_write(uint32 msr, uint64 val){
 	split_uint64_t *v = (split_uint64_t *)&val;
 	asm volatile("wrmsr" : : "a"(v->low), "d"(v->high), "c"(msr));
 }
+/**
+* Read Time Stamp Counter
+* @return TSC value
+*/
+static inline uint64 rdtsc(){
+	split_uint64_t v;
+	asm volatile("rdtsc" : "=a"(v.low), "=d"(v.high));
+	return (((uint64)v.high) << 32) | v.low;
+}
 
 #endif
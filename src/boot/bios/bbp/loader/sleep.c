@@ -37,32 +37,83 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "../config.h"
 #include "sleep.h"
 #include "pit.h"
+#include "io.h"
+#include "msr.h"
 #if DEBUG == 1
 	#include "debug_print.h"
 #endif
 
-void isleep(uint64 iter){
-	uint32 x = 1;
-	while(x < iter){
-		x ++;
-	}
+static uint64 _tsc_khz = 0;
+
+/**
+* Check if we can halt and wait for the PIT interrupt
+* @return true if interrupts are enabled and PIT is running
+*/
+static inline bool sleep_can_halt(){
+    uint64 flags;
+    asm volatile("pushfq; popq %0" : "=r"(flags));
+    return ((flags & 0x200) != 0 && pit_get_counter() > 0);
+}
+
+void sleep_init(){
+    uint64 tick;
+    uint64 tsc_start;
+    if (!sleep_can_halt()){
+        return;
+    }
+    // Start measuring right after a tick
+    tick = pit_get_ticks();
+    while (pit_get_ticks() == tick){
+        asm volatile("hlt");
+    }
+    tick = pit_get_ticks();
+    tsc_start = rdtsc();
+    while (pit_get_ticks() < tick + SLEEP_CALIBRATE_TICKS){
+        asm volatile("hlt");
+    }
+    _tsc_khz = ((rdtsc() - tsc_start) * PIT_FREQ) / (SLEEP_CALIBRATE_TICKS * (uint64)pit_get_counter() * 1000);
 }
 
 void sleep(uint64 time){
-    uint64 counter = (uint64)pit_get_counter();
-    if (counter > 0){
-        uint64 tick_count = (time * PIT_FREQ) / (counter * 1000);
-        if (tick_count == 0){
-            tick_count = 1;
+    if (!sleep_can_halt()){
+        while (time > 0){
+            ndelay(1000000);
+            time --;
         }
-        uint64 tick_start = pit_get_ticks();
-        uint64 tick = tick_start;
-        while (tick < tick_start + tick_count){
-            tick = pit_get_ticks();
-            NOP();
-            NOP();
-            NOP();
-            NOP();
+        return;
+    }
+    uint64 counter = (uint64)pit_get_counter();
+    uint64 tick_count = (time * PIT_FREQ) / (counter * 1000);
+    if (tick_count == 0){
+        tick_count = 1;
+    }
+    // Current tick might be almost over - wait for one more
+    uint64 tick_end = pit_get_ticks() + tick_count + 1;
+    while (pit_get_ticks() < tick_end){
+        asm volatile("hlt");
+    }
+}
+
+void usleep(uint64 time){
+    if (time >= 1000 && sleep_can_halt()){
+        sleep(time / 1000);
+        time %= 1000;
+    }
+    ndelay(time * 1000);
+}
+
+void ndelay(uint64 time){
+    if (_tsc_khz == 0){
+        // Not calibrated yet - a write to POST port takes about a microsecond
+        time = (time + 999) / 1000;
+        while (time > 0){
+            outb(0x80, 0);
+            time --;
         }
+        return;
+    }
+    uint64 tsc_end = rdtsc() + ((time * _tsc_khz) / 1000000) + 1;
+    while (rdtsc() < tsc_end){
+        asm volatile("pause");
     }
 }
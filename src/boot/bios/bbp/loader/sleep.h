@@ -39,15 +39,29 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "common.h"
 
+// Number of PIT ticks used for TSC calibration
+#define SLEEP_CALIBRATE_TICKS 10
+
 /**
-* Iterated sleep (CPU speed dependant)
-* @param iter - how many iterations to wait till exit
+* Calibrate TSC against PIT ticks (call after PIT is running and interrupts are enabled)
 */
-void isleep(uint64 iter);
+void sleep_init();
 /**
 * Sleep for some milliseconds
+* CPU is halted between PIT ticks (or spins if interrupts are disabled)
 * @param time - time in milliseconds
 */
 void sleep(uint64 time);
+/**
+* Sleep for some microseconds
+* Whole milliseconds are slept with sleep(), the rest is a TSC spin
+* @param time - time in microseconds
+*/
+void usleep(uint64 time);
+/**
+* Short hardware delay (TSC calibrated busy-wait)
+* @param time - time in nanoseconds
+*/
+void ndelay(uint64 time);
 
 #endif
@@ -38,6 +38,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "lib.h"
 #include "io.h"
 #include "pci.h"
+#include "paging.h"
+#include "interrupts.h"
+#include "apic.h"
+#include "sync.h"
+#include "rcu.h"
+#include "percpu.h"
 #if DEBUG == 1
 	#include "debug_print.h"
 #endif
@@ -54,7 +60,35 @@ typedef struct {
 	uint8 subclass_id;
 	uint8 prog_if;
 	uint8 type;
+	uint8 irq_type;					// Interrupt delivery type (PCI_IRQ_*)
+	uint8 irq_cap;					// MSI or MSI-X capability offset
+	uint8 irq_vector;				// First allocated interrupt vector
+	uint16 irq_count;				// Number of allocated interrupt vectors
+	uint32 volatile *msix_table;	// MSI-X table (memory mapped)
 } pci_cache_t;
+/**
+* Published copy of the PCI cache
+*/
+typedef struct {
+	uint64 len;
+	pci_cache_t dev[256];
+} pci_table_t;
+
+// MSI message control bits
+#define PCI_MSI_CTRL_ENABLE		0x0001	// MSI enable
+#define PCI_MSI_CTRL_MMC(c)		((c >> 1) & 0x7)	// Multiple message capable (log2)
+#define PCI_MSI_CTRL_MME_SHIFT	4		// Multiple message enable (log2)
+#define PCI_MSI_CTRL_64BIT		0x0080	// 64-bit message address
+#define PCI_MSI_CTRL_PVM		0x0100	// Per-vector masking capable
+// MSI-X message control bits
+#define PCI_MSIX_CTRL_SIZE(c)	((c & 0x7FF) + 1)	// Table size
+#define PCI_MSIX_CTRL_MASK		0x4000	// Function mask
+#define PCI_MSIX_CTRL_ENABLE	0x8000	// MSI-X enable
+// MSI-X table entry (4 dwords)
+#define PCI_MSIX_ENTRY_ADDR_LO	0
+#define PCI_MSIX_ENTRY_ADDR_HI	1
+#define PCI_MSIX_ENTRY_DATA		2
+#define PCI_MSIX_ENTRY_CTRL		3
 
 /*
 static uint32 pci_get_addr(uint16 bus, uint8 device, uint8 function, uint8 reg){
@@ -67,27 +101,32 @@ static uint32 pci_get_addr(uint16 bus, uint8 device, uint8 function, uint8 reg){
 }
 */
 
-// Local PCI device cache
-static pci_cache_t _cache[256];
-static uint8 _cache_len = 0;
+// Local PCI device cache - readers use the published table under rcu_read_lock(),
+// writers update the other one and publish it (no heap, so there are two static copies)
+static pci_table_t _tables[2];
+static pci_table_t *_cache = &_tables[0];
+static mutex_t _cache_lock = MUTEX_INIT;
 
 /**
 * Enumerate a single PCI bus
+* @param table - table to fill
 * @param bus - bus number
 */
-static void pci_enum_bus(uint16 bus);
+static void pci_enum_bus(pci_table_t *table, uint16 bus);
 /**
 * Enumerate a single PCI device on a bus
+* @param table - table to fill
 * @param bus - bus number
 * @param device - device number
 */
-static void pci_enum_device(uint16 bus, uint8 device);
+static void pci_enum_device(pci_table_t *table, uint16 bus, uint8 device);
 /**
 * Enumeration PCI device functions
+* @param table - table to fill
 * @param bus - bus number
 * @param device - device number
 */
-static void pci_enum_function(uint16 bus, uint8 device, uint8 function);
+static void pci_enum_function(pci_table_t *table, uint16 bus, uint8 device, uint8 function);
 /**
 * Get secondary bus number from PCI-to-PCI bridge
 */
@@ -107,10 +146,149 @@ static uint16 pci_get_secondary_bus(uint16 bus, uint8 device, uint8 function){
 	return bus;
 }
 
+/**
+* Find PCI device in the local cache
+* @param table - published table (under rcu_read_lock()) or the one being updated
+* @param addr - PCI address
+* @return cache entry or null if device has not been enumerated
+*/
+static pci_cache_t *pci_cache_find(pci_table_t *table, pci_addr_t addr){
+	uint16 i = 0;
+	for (i = 0; i < table->len; i ++){
+		if (table->dev[i].address.s.bus == addr.s.bus
+			&& table->dev[i].address.s.device == addr.s.device
+			&& table->dev[i].address.s.function == addr.s.function){
+			return &table->dev[i];
+		}
+	}
+	return null;
+}
+/**
+* Start updating the PCI cache
+* @return copy of the published table to modify
+*/
+static pci_table_t *pci_cache_begin(){
+	pci_table_t *next;
+	mutex_lock(&_cache_lock);
+	next = (_cache == &_tables[0] ? &_tables[1] : &_tables[0]);
+	mem_copy((uint8 *)next, sizeof(pci_table_t), (uint8 *)_cache);
+	return next;
+}
+/**
+* Publish the updated copy, the old one is reused only after its readers are gone
+* @param next - table returned by pci_cache_begin()
+*/
+static void pci_cache_commit(pci_table_t *next){
+	rcu_assign_pointer(_cache, next);
+	synchronize_rcu();
+	mutex_unlock(&_cache_lock);
+}
+/**
+* Finish an update without any changes
+*/
+static void pci_cache_abort(){
+	mutex_unlock(&_cache_lock);
+}
+/**
+* Read a configuration space dword at byte offset
+*/
+static uint32 pci_read_conf(pci_addr_t addr, uint8 offset){
+	addr.s.enabled = 1;
+	addr.s.reg = (offset >> 2);
+	return pci_read(addr);
+}
+/**
+* Write a configuration space dword at byte offset
+*/
+static void pci_write_conf(pci_addr_t addr, uint8 offset, uint32 data){
+	addr.s.enabled = 1;
+	addr.s.reg = (offset >> 2);
+	pci_write(addr, data);
+}
+/**
+* Set command register bits (status bits are write-1-to-clear, so they're written as 0)
+*/
+static void pci_set_command(pci_addr_t addr, uint16 set, uint16 clear){
+	uint32 cmd = pci_read_conf(addr, PCI_REG_STATUS_CMD) & 0xFFFF;
+	cmd |= set;
+	cmd &= ~((uint32)clear);
+	pci_write_conf(addr, PCI_REG_STATUS_CMD, cmd);
+}
+/**
+* Read message control word of MSI or MSI-X capability
+*/
+static uint16 pci_msi_ctrl(pci_addr_t addr, uint8 cap){
+	return (uint16)(pci_read_conf(addr, cap) >> 16);
+}
+/**
+* Write message control word of MSI or MSI-X capability (ID and next pointer are read-only)
+*/
+static void pci_msi_set_ctrl(pci_addr_t addr, uint8 cap, uint16 ctrl){
+	pci_write_conf(addr, cap, ((uint32)ctrl) << 16);
+}
+/**
+* Device interrupts are not routed to isolated CPUs
+* @param cpu - requested CPU
+* @return CPU to program
+*/
+static uint64 pci_irq_target(uint64 cpu){
+	if (cpu_isolated_mask() & (1ULL << cpu)){
+		return cpu_housekeeping();
+	}
+	return cpu;
+}
+/**
+* Program MSI message address and data
+*/
+static void pci_msi_write_msg(pci_addr_t addr, uint8 cap, uint64 cpu, uint8 vector){
+	uint16 ctrl = pci_msi_ctrl(addr, cap);
+	pci_write_conf(addr, cap + 4, PCI_MSI_ADDR(apic_cpu_apic_id(cpu)));
+	if (ctrl & PCI_MSI_CTRL_64BIT){
+		pci_write_conf(addr, cap + 8, 0);
+		pci_write_conf(addr, cap + 12, vector);	// Fixed delivery, edge triggered
+	} else {
+		pci_write_conf(addr, cap + 8, vector);	// Fixed delivery, edge triggered
+	}
+}
+/**
+* Map MSI-X table
+* @return virtual address of the table
+*/
+static uint32 volatile *pci_msix_map(pci_addr_t addr, uint8 cap, uint16 size){
+	uint32 table = pci_read_conf(addr, cap + 4);
+	uint8 bir = (uint8)(table & 0x7);
+	uint64 base = pci_read_conf(addr, 0x10 + (bir * 4));
+	uint64 page;
+	if ((base & 0x6) == 0x4){
+		// 64-bit memory BAR
+		base |= ((uint64)pci_read_conf(addr, 0x14 + (bir * 4))) << 32;
+	}
+	base &= ~((uint64)0xF);
+	base += (table & ~((uint32)0x7));
+	// Table entries are 16 bytes each and might span several pages
+	for (page = (base & PAGE_MASK); page < base + (size * 16); page += PAGE_SIZE){
+		page_map_mmio(page);
+	}
+	return (uint32 volatile *)base;
+}
+/**
+* Program MSI-X table entry
+*/
+static void pci_msix_write_msg(uint32 volatile *table, uint16 idx, uint64 cpu, uint8 vector){
+	uint32 volatile *entry = table + (idx * 4);
+	entry[PCI_MSIX_ENTRY_CTRL] |= 1;						// Mask while updating
+	entry[PCI_MSIX_ENTRY_ADDR_LO] = PCI_MSI_ADDR(apic_cpu_apic_id(cpu));
+	entry[PCI_MSIX_ENTRY_ADDR_HI] = 0;
+	entry[PCI_MSIX_ENTRY_DATA] = vector;					// Fixed delivery, edge triggered
+	entry[PCI_MSIX_ENTRY_CTRL] &= ~((uint32)1);			// Unmask
+}
+
 void pci_init(){
 	uint16 bus = 0;
 	pci_header_t header;
 	pci_addr_t addr;
+	pci_table_t *table = pci_cache_begin();
+	table->len = 0;
 	addr.raw = 0x80000000;
 	// Recursive scan - thanks OSDev Wiki
 	pci_get_header(&header, addr);
@@ -121,40 +299,50 @@ void pci_init(){
 			pci_get_header(&header, addr);
 			if (header.vendor_id != 0xFFFF){
 				// Valid PCI host controller
-				pci_enum_bus(bus);
+				pci_enum_bus(table, bus);
 			}
 		}
 	} else {
 		// Single PCI host controller
-		pci_enum_bus(0);
+		pci_enum_bus(table, 0);
 	}
+	pci_cache_commit(table);
 }
 
 uint8 pci_num_device(uint8 class_id, uint8 subclass_id){
+	pci_table_t *table;
 	uint16 i = 0;
 	uint8 x = 0;
-	for (i = 0; i < _cache_len; i ++){
-		if (_cache[i].class_id == class_id && _cache[i].subclass_id == subclass_id){
+	rcu_read_lock();
+	table = rcu_dereference(_cache);
+	for (i = 0; i < table->len; i ++){
+		if (table->dev[i].class_id == class_id && table->dev[i].subclass_id == subclass_id){
 			x ++;
 		}
 	}
+	rcu_read_unlock();
 	return x;
 }
 
 pci_addr_t pci_get_device(uint8 class_id, uint8 subclass_id, uint8 idx){
+	pci_table_t *table;
 	uint16 i = 0;
 	uint8 x = 0;
-	pci_addr_t addr_none;
-	addr_none.raw = 0;
-	for (i = 0; i < _cache_len; i ++){
-		if (_cache[i].class_id == class_id && _cache[i].subclass_id == subclass_id){
+	pci_addr_t addr;
+	addr.raw = 0;
+	rcu_read_lock();
+	table = rcu_dereference(_cache);
+	for (i = 0; i < table->len; i ++){
+		if (table->dev[i].class_id == class_id && table->dev[i].subclass_id == subclass_id){
 			if (x == idx){
-				return _cache[i].address;
+				addr = table->dev[i].address;
+				break;
 			}
 			x ++;
 		}
 	}
-	return addr_none;
+	rcu_read_unlock();
+	return addr;
 }
 
 void pci_get_header(pci_header_t *header,pci_addr_t addr){
@@ -175,6 +363,231 @@ void pci_get_config(pci_device_t *device, pci_addr_t addr){
 	}
 }
 
+uint8 pci_find_cap(pci_addr_t addr, uint8 cap_id){
+	uint8 offset;
+	uint32 data;
+	uint8 guard = 48; // No more than 48 capabilities fit in 192 bytes
+	if (((pci_read_conf(addr, PCI_REG_STATUS_CMD) >> 16) & PCI_STS_CAP_LIST) == 0){
+		return 0;
+	}
+	offset = (uint8)(pci_read_conf(addr, PCI_REG_CAP_PTR) & 0xFC);
+	while (offset != 0 && guard > 0){
+		data = pci_read_conf(addr, offset);
+		if ((data & 0xFF) == cap_id){
+			return offset;
+		}
+		offset = (uint8)((data >> 8) & 0xFC);
+		guard --;
+	}
+	return 0;
+}
+
+uint16 pci_irq_max_vectors(pci_addr_t addr, uint8 type){
+	uint8 cap;
+	if (type == PCI_IRQ_MSIX){
+		cap = pci_find_cap(addr, PCI_CAP_MSIX);
+		if (cap != 0){
+			return PCI_MSIX_CTRL_SIZE(pci_msi_ctrl(addr, cap));
+		}
+	} else if (type == PCI_IRQ_MSI){
+		cap = pci_find_cap(addr, PCI_CAP_MSI);
+		if (cap != 0){
+			return (1 << PCI_MSI_CTRL_MMC(pci_msi_ctrl(addr, cap)));
+		}
+	}
+	return 0;
+}
+
+int16 pci_irq_alloc(pci_addr_t addr, uint64 cpu, uint16 count){
+	pci_table_t *table = pci_cache_begin();
+	pci_cache_t *dev = pci_cache_find(table, addr);
+	uint16 ctrl;
+	uint16 max;
+	uint16 i;
+	uint8 cap;
+	uint8 mme = 0;
+	int16 vector;
+	cpu = pci_irq_target(cpu);
+	if (dev == null || count == 0 || dev->irq_type != PCI_IRQ_LEGACY){
+		pci_cache_abort();
+		return -1;
+	}
+	if ((cap = pci_find_cap(addr, PCI_CAP_MSIX)) != 0){
+		// MSI-X - every vector has its own table entry and target CPU
+		ctrl = pci_msi_ctrl(addr, cap);
+		max = PCI_MSIX_CTRL_SIZE(ctrl);
+		if (count > max){
+			count = max;
+		}
+		vector = interrupt_alloc_vectors(count);
+		if (vector < 0){
+			pci_cache_abort();
+			return -1;
+		}
+		dev->msix_table = pci_msix_map(addr, cap, max);
+		// Keep the whole function masked while programming the table
+		pci_msi_set_ctrl(addr, cap, ctrl | PCI_MSIX_CTRL_ENABLE | PCI_MSIX_CTRL_MASK);
+		for (i = 0; i < max; i ++){
+			dev->msix_table[(i * 4) + PCI_MSIX_ENTRY_CTRL] |= 1;
+		}
+		for (i = 0; i < count; i ++){
+			pci_msix_write_msg(dev->msix_table, i, cpu, (uint8)(vector + i));
+		}
+		pci_msi_set_ctrl(addr, cap, (ctrl | PCI_MSIX_CTRL_ENABLE) & ~PCI_MSIX_CTRL_MASK);
+		dev->irq_type = PCI_IRQ_MSIX;
+	} else if ((cap = pci_find_cap(addr, PCI_CAP_MSI)) != 0){
+		// MSI - power of 2 vectors, device modifies lower data bits to select one
+		ctrl = pci_msi_ctrl(addr, cap);
+		max = (1 << PCI_MSI_CTRL_MMC(ctrl));
+		if (count > max){
+			count = max;
+		}
+		while ((1 << mme) < count){
+			mme ++;
+		}
+		count = (1 << mme);
+		vector = interrupt_alloc_vectors(count);
+		if (vector < 0){
+			pci_cache_abort();
+			return -1;
+		}
+		pci_msi_write_msg(addr, cap, cpu, (uint8)vector);
+		ctrl &= ~(0x7 << PCI_MSI_CTRL_MME_SHIFT);
+		ctrl |= (mme << PCI_MSI_CTRL_MME_SHIFT) | PCI_MSI_CTRL_ENABLE;
+		pci_msi_set_ctrl(addr, cap, ctrl);
+		dev->irq_type = PCI_IRQ_MSI;
+	} else {
+		pci_cache_abort();
+		return -1;
+	}
+	dev->irq_cap = cap;
+	dev->irq_vector = (uint8)vector;
+	dev->irq_count = count;
+	// Messages are memory writes - device has to be a bus master, INTx is no longer needed
+	pci_set_command(addr, PCI_CMD_BUS_MASTER | PCI_CMD_INT_DISABLE, 0);
+	pci_cache_commit(table);
+	return vector;
+}
+
+uint8 pci_irq_type(pci_addr_t addr){
+	pci_cache_t *dev;
+	uint8 type = PCI_IRQ_LEGACY;
+	rcu_read_lock();
+	dev = pci_cache_find(rcu_dereference(_cache), addr);
+	if (dev != null){
+		type = dev->irq_type;
+	}
+	rcu_read_unlock();
+	return type;
+}
+
+bool pci_irq_set_affinity(pci_addr_t addr, uint16 idx, uint64 cpu){
+	pci_cache_t *dev;
+	bool result = false;
+	cpu = pci_irq_target(cpu);
+	rcu_read_lock();
+	dev = pci_cache_find(rcu_dereference(_cache), addr);
+	if (dev != null && idx < dev->irq_count){
+		if (dev->irq_type == PCI_IRQ_MSIX){
+			pci_msix_write_msg(dev->msix_table, idx, cpu, (uint8)(dev->irq_vector + idx));
+			result = true;
+		} else if (dev->irq_type == PCI_IRQ_MSI){
+			pci_msi_write_msg(addr, dev->irq_cap, cpu, dev->irq_vector);
+			result = true;
+		}
+	}
+	rcu_read_unlock();
+	return result;
+}
+
+void pci_irq_evacuate(uint64 mask){
+	pci_table_t *table;
+	pci_cache_t *dev;
+	uint64 cpu;
+	uint64 i;
+	uint32 msg;
+	uint16 count;
+	uint16 idx;
+	rcu_read_lock();
+	table = rcu_dereference(_cache);
+	for (i = 0; i < table->len; i ++){
+		dev = &table->dev[i];
+		// MSI vectors share one message address
+		count = (dev->irq_type == PCI_IRQ_MSIX ? dev->irq_count : (dev->irq_type == PCI_IRQ_MSI ? 1 : 0));
+		for (idx = 0; idx < count; idx ++){
+			if (dev->irq_type == PCI_IRQ_MSIX){
+				msg = dev->msix_table[(idx * 4) + PCI_MSIX_ENTRY_ADDR_LO];
+			} else {
+				msg = pci_read_conf(dev->address, dev->irq_cap + 4);
+			}
+			for (cpu = 0; cpu < CPU_MAX; cpu ++){
+				if ((mask & (1ULL << cpu)) && msg == PCI_MSI_ADDR(apic_cpu_apic_id(cpu))){
+					pci_irq_set_affinity(dev->address, idx, cpu_housekeeping());
+					break;
+				}
+			}
+		}
+	}
+	rcu_read_unlock();
+}
+
+void pci_irq_mask(pci_addr_t addr, uint16 idx, bool mask){
+	pci_cache_t *dev;
+	uint16 ctrl;
+	uint8 offset;
+	uint32 bits;
+	rcu_read_lock();
+	dev = pci_cache_find(rcu_dereference(_cache), addr);
+	if (dev == null || idx >= dev->irq_count){
+		rcu_read_unlock();
+		return;
+	}
+	if (dev->irq_type == PCI_IRQ_MSIX){
+		if (mask){
+			dev->msix_table[(idx * 4) + PCI_MSIX_ENTRY_CTRL] |= 1;
+		} else {
+			dev->msix_table[(idx * 4) + PCI_MSIX_ENTRY_CTRL] &= ~((uint32)1);
+		}
+	} else if (dev->irq_type == PCI_IRQ_MSI){
+		ctrl = pci_msi_ctrl(addr, dev->irq_cap);
+		if (ctrl & PCI_MSI_CTRL_PVM){
+			offset = dev->irq_cap + ((ctrl & PCI_MSI_CTRL_64BIT) ? 0x10 : 0x0C);
+			bits = pci_read_conf(addr, offset);
+			if (mask){
+				bits |= (1 << idx);
+			} else {
+				bits &= ~(1 << idx);
+			}
+			pci_write_conf(addr, offset, bits);
+		}
+	}
+	rcu_read_unlock();
+}
+
+void pci_irq_free(pci_addr_t addr){
+	pci_table_t *table = pci_cache_begin();
+	pci_cache_t *dev = pci_cache_find(table, addr);
+	uint16 ctrl;
+	if (dev == null || dev->irq_type == PCI_IRQ_LEGACY){
+		pci_cache_abort();
+		return;
+	}
+	ctrl = pci_msi_ctrl(addr, dev->irq_cap);
+	if (dev->irq_type == PCI_IRQ_MSIX){
+		pci_msi_set_ctrl(addr, dev->irq_cap, ctrl & ~PCI_MSIX_CTRL_ENABLE);
+	} else {
+		pci_msi_set_ctrl(addr, dev->irq_cap, ctrl & ~PCI_MSI_CTRL_ENABLE);
+	}
+	interrupt_free_vectors(dev->irq_vector, dev->irq_count);
+	pci_set_command(addr, 0, PCI_CMD_INT_DISABLE);
+	dev->irq_type = PCI_IRQ_LEGACY;
+	dev->irq_cap = 0;
+	dev->irq_vector = 0;
+	dev->irq_count = 0;
+	dev->msix_table = null;
+	pci_cache_commit(table);
+}
+
 uint32 pci_read(pci_addr_t addr){
 	uint32 data;
 	outd(PCI_CONFIG_ADDRESS, addr.raw);
@@ -199,14 +612,14 @@ void pci_write(uint32 addr, uint32 data){
 	asm volatile ("outl %%eax, %%dx" : : "d"(PCI_CONFIG_DATA), "a"(data));
 }*/
 
-static void pci_enum_bus(uint16 bus){
+static void pci_enum_bus(pci_table_t *table, uint16 bus){
 	uint8 device = 0;
 	for (; device < 32; device ++){
-		pci_enum_device(bus, device);
+		pci_enum_device(table, bus, device);
 	}
 }
 
-static void pci_enum_device(uint16 bus, uint8 device){
+static void pci_enum_device(pci_table_t *table, uint16 bus, uint8 device){
 	uint8 function = 0;
 	pci_header_t header;
 	pci_addr_t addr;
@@ -219,17 +632,18 @@ static void pci_enum_device(uint16 bus, uint8 device){
 		if ((header.type & 0x80) != 0){ 
 			// Multifunctional device
 			for (function = 1; function < 8; function ++){
-				pci_enum_function(bus, device, function);
+				pci_enum_function(table, bus, device, function);
 			}
 		} else {
 			// Single function device
-			pci_enum_function(bus, device, 0);
+			pci_enum_function(table, bus, device, 0);
 		}
 	}
 }
 
-static void pci_enum_function(uint16 bus, uint8 device, uint8 function){
+static void pci_enum_function(pci_table_t *table, uint16 bus, uint8 device, uint8 function){
 	uint16 secondary_bus = 0;
+	pci_cache_t *dev;
 	pci_header_t header;
 	pci_addr_t addr;
 	addr.raw = 0x80000000;
@@ -237,19 +651,23 @@ static void pci_enum_function(uint16 bus, uint8 device, uint8 function){
 	addr.s.device = device;
 	addr.s.function = function;
 	pci_get_header(&header, addr);
-	if (header.vendor_id != 0xFFFF){
-		_cache[_cache_len].address.raw = addr.raw;
-		_cache[_cache_len].class_id = header.class_id;
-		_cache[_cache_len].subclass_id = header.subclass_id;
-		_cache[_cache_len].prog_if = header.prog_if;
-		_cache[_cache_len].type = header.type;
-		_cache[_cache_len].vendor_id = header.vendor_id;
-		_cache[_cache_len].device_id = header.device_id;
-		_cache_len ++;
+	if (header.vendor_id != 0xFFFF && table->len < 256){
+		dev = &table->dev[table->len];
+		dev->address.raw = addr.raw;
+		dev->class_id = header.class_id;
+		dev->subclass_id = header.subclass_id;
+		dev->prog_if = header.prog_if;
+		dev->type = header.type;
+		dev->vendor_id = header.vendor_id;
+		dev->device_id = header.device_id;
+		dev->irq_type = PCI_IRQ_LEGACY;
+		dev->irq_count = 0;
+		dev->msix_table = null;
+		table->len ++;
 		if (header.class_id == 0x06 && header.subclass_id == 0x04){
 			secondary_bus = pci_get_secondary_bus(bus, device, function);
 			if (secondary_bus != bus){
-				pci_enum_bus(secondary_bus);
+				pci_enum_bus(table, secondary_bus);
 			}
 		}
 	}
@@ -257,9 +675,15 @@ static void pci_enum_function(uint16 bus, uint8 device, uint8 function){
 
 #if DEBUG == 1
 void pci_list(){
+	pci_table_t *table;
+	pci_cache_t *dev;
 	uint16 i = 0;
-	for (; i < _cache_len; i ++){
-		debug_print(DC_BW, "pci:%u:%u:%u, class:0x%x:0x%x, vendor:0x%x:0x%x", (uint64)_cache[i].address.s.bus, (uint64)_cache[i].address.s.device, (uint64)_cache[i].address.s.function, (uint64)_cache[i].class_id, (uint64)_cache[i].subclass_id, (uint64)_cache[i].vendor_id, (uint64)_cache[i].device_id);
+	rcu_read_lock();
+	table = rcu_dereference(_cache);
+	for (; i < table->len; i ++){
+		dev = &table->dev[i];
+		debug_print(DC_BW, "pci:%u:%u:%u, class:0x%x:0x%x, vendor:0x%x:0x%x", (uint64)dev->address.s.bus, (uint64)dev->address.s.device, (uint64)dev->address.s.function, (uint64)dev->class_id, (uint64)dev->subclass_id, (uint64)dev->vendor_id, (uint64)dev->device_id);
 	}
+	rcu_read_unlock();
 }
 #endif
\ No newline at end of file
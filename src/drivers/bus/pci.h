@@ -47,6 +47,27 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define PCI_REG_STATUS_CMD	0x4
 #define PCI_REG_CLS_PRG_REV	0x8
 #define PCI_REG_BIST_TYPE	0xC
+#define PCI_REG_CAP_PTR		0x34
+
+// Command register bits
+#define PCI_CMD_BUS_MASTER	0x0004	// Bus master enable (required for MSI writes and DMA)
+#define PCI_CMD_INT_DISABLE	0x0400	// Legacy INTx disable
+// Status register bits
+#define PCI_STS_CAP_LIST	0x0010	// Capability list present
+
+// Capability IDs
+#define PCI_CAP_MSI			0x05	// Message Signaled Interrupts
+#define PCI_CAP_PCIE		0x10	// PCI Express
+#define PCI_CAP_MSIX		0x11	// MSI-X
+
+// Interrupt delivery types
+#define PCI_IRQ_LEGACY		0		// INTx pin routed through PIC/IOAPIC
+#define PCI_IRQ_MSI			1		// MSI (up to 32 consecutive vectors, single target CPU)
+#define PCI_IRQ_MSIX		2		// MSI-X (up to 2048 vectors, per-vector target CPU)
+
+// MSI message address (Local APIC, physical destination mode)
+#define PCI_MSI_ADDR_BASE	0xFEE00000
+#define PCI_MSI_ADDR(apic_id) (PCI_MSI_ADDR_BASE | (((uint32)(apic_id)) << 12))
 
 /**
 * PCI address structure
@@ -90,7 +111,7 @@ typedef volatile struct {
 	uint16 sub_vendor_id;
 	uint16 subsystem_id;
 	uint32 exp_rom;
-	uint8 compat;
+	uint8 cap_ptr;				// Capability list pointer (valid if PCI_STS_CAP_LIST is set)
 	uint8 reserved[7];
 	uint8 int_line;
 	uint8 int_pin;
@@ -141,6 +162,63 @@ uint32 pci_read(pci_addr_t addr);
 * @param data - data to write
 */
 void pci_write(pci_addr_t addr, uint32 data);
+/**
+* Find a capability in device's capability list
+* @param addr - PCI address
+* @param cap_id - capability ID (PCI_CAP_*)
+* @return offset of the capability in configuration space or 0 if not found
+*/
+uint8 pci_find_cap(pci_addr_t addr, uint8 cap_id);
+/**
+* Get the number of message signaled interrupt vectors a device supports
+* @param addr - PCI address
+* @param type - PCI_IRQ_MSI or PCI_IRQ_MSIX
+* @return maximum number of vectors (0 if not supported)
+*/
+uint16 pci_irq_max_vectors(pci_addr_t addr, uint8 type);
+/**
+* Allocate message signaled interrupt vectors and enable them on the device
+* MSI-X is preferred over MSI as it allows each vector to target a different CPU.
+* Vectors are allocated as a consecutive block (vector i is first vector + i),
+* all of them initially targeted at the given CPU. Legacy INTx is disabled.
+* @param addr - PCI address
+* @param cpu - target CPU index (isolated CPUs are replaced by the housekeeping CPU)
+* @param count - number of vectors (one per queue)
+* @return first interrupt vector or -1 if MSI/MSI-X is not available
+*/
+int16 pci_irq_alloc(pci_addr_t addr, uint64 cpu, uint16 count);
+/**
+* Get the interrupt delivery type currently set up for a device
+* @param addr - PCI address
+* @return PCI_IRQ_LEGACY, PCI_IRQ_MSI or PCI_IRQ_MSIX
+*/
+uint8 pci_irq_type(pci_addr_t addr);
+/**
+* Retarget a message signaled interrupt to another CPU
+* With MSI all vectors share one target, so idx is ignored.
+* @param addr - PCI address
+* @param idx - vector index (0 - count passed to pci_irq_alloc())
+* @param cpu - target CPU index (isolated CPUs are replaced by the housekeeping CPU)
+* @return false if no vectors are allocated or idx is out of bounds
+*/
+bool pci_irq_set_affinity(pci_addr_t addr, uint16 idx, uint64 cpu);
+/**
+* Retarget all allocated message signaled interrupts aimed at given CPUs to the housekeeping CPU
+* @param mask - CPUs to move interrupts away from
+*/
+void pci_irq_evacuate(uint64 mask);
+/**
+* Mask or unmask a single message signaled interrupt
+* @param addr - PCI address
+* @param idx - vector index
+* @param mask - true to mask, false to unmask
+*/
+void pci_irq_mask(pci_addr_t addr, uint16 idx, bool mask);
+/**
+* Disable message signaled interrupts and release the vectors
+* @param addr - PCI address
+*/
+void pci_irq_free(pci_addr_t addr);
 
 
 #if DEBUG == 1
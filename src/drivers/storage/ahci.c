@@ -39,8 +39,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "pci.h"
 #include "paging.h"
 #include "ahci.h"
+#include "rcu.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "interrupts.h"
+#include "softirq.h"
+#include "percpu.h"
+#include "futex.h"
+#include "sched.h"
 #if DEBUG == 1
 	#include "debug_print.h"
+	#include "msr.h"
 #endif
 
 // Device signatures
@@ -49,6 +58,36 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define AHCI_DEV_SEMB	0xC33C0101	// Enclosure management bridge
 #define AHCI_DEV_PM		0x96690101	// Port multiplier
 
+// Address masks
+#define AHCI_HBA_MASK	0xFFFFFFFFFFFFE000
+#define AHCI_HBA_SIZE	0x2000		// Registers of an HBA with 32 ports (bytes)
+// Wait loop limit if there is no clock source
+#define AHCI_SPIN_MAX	1000000
+// Port interrupt status bits that stop the command list (TFES, HBFS, HBDS, IFS, INFS, OFS, UFS)
+#define AHCI_PxIS_ERROR	0x7D000010
+#define AHCI_PxIS_DHRS	0x00000001	// D2H Register FIS (non-queued command done)
+#define AHCI_PxIS_SDBS	0x00000008	// Set Device Bits FIS (NCQ commands done)
+// Port interrupts enabled by the driver
+#define AHCI_PxIE_MASK	(AHCI_PxIS_ERROR | AHCI_PxIS_DHRS | AHCI_PxIS_SDBS)
+// Poll interval of sleeping waiters if the controller has no usable interrupt (ns)
+#define AHCI_POLL_NS	50000
+
+// ATA statuses
+#define ATA_DEV_BUSY	0x80
+#define ATA_DEV_DRQ		0x08
+// ATA commands
+#define ATA_CMD_IDENTIFY	0xEC
+#define ATA_CMD_READ_DMA_EX	0x25
+#define ATA_CMD_READ_FPDMA	0x60	// READ FPDMA QUEUED
+#define ATA_CMD_WRITE_DMA_EX	0x35
+#define ATA_CMD_WRITE_DMA_FUA_EX	0x3D
+#define ATA_CMD_WRITE_FPDMA	0x61	// WRITE FPDMA QUEUED
+#define ATA_CMD_FLUSH		0xE7
+#define ATA_CMD_FLUSH_EX	0xEA
+// FIS types
+#define FIS_TYPE_REG_H2D	0x27
+#define FIS_TYPE_DEV_BITS	0xA1
+
 // AHCI Specification 1.3 data structures
 
 /**
@@ -57,49 +96,55 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 typedef volatile struct {
 	uint64 clb;					// command list base address, 1K-byte aligned
 	uint64 fb;					// FIS base address, 256-byte aligned
-	// Interrupt status
-	struct {
-		uint32 dhrs			:1;	// Device to Host Register FIS Interrupt
-		uint32 pss			:1;	// PIO Setup FIS Interrupt
-		uint32 dss			:1;	// DMA Setup FIS Interrupt
-		uint32 sdbs			:1;	// Set Device Bits Interrupt
-		uint32 ufs			:1;	// Unknown FIS Interrupt
-		uint32 dps			:1;	// Descriptor Processed
-		uint32 pcs			:1;	// Port Connect Change Status
-		uint32 dmps			:1;	// Device Mechanical Presence Status
-		uint32 reserved1	:14;
-		uint32 prcs			:1;	// PhyRdy Change Status
-		uint32 ipms			:1;	// Incorrect Port Multiplier Status
-		uint32 ofs			:1;	// Overflow Status
-		uint32 reserved2	:1;
-		uint32 infs			:1;	// Interface Non-fatal Error Status
-		uint32 ifs			:1;	// Interface Fatal Error Status
-		uint32 hbds			:1;	// Host Bus Data Error Status
-		uint32 hbfs			:1;	// Host Bus Fatal Error Status
-		uint32 tfes			:1;	// Task File Error Status
-		uint32 cpds			:1;	// Cold Port Detect Status
+	// Interrupt status (write 1 to clear)
+	union {
+		uint32 raw;
+		struct {
+			uint32 dhrs			:1;	// Device to Host Register FIS Interrupt
+			uint32 pss			:1;	// PIO Setup FIS Interrupt
+			uint32 dss			:1;	// DMA Setup FIS Interrupt
+			uint32 sdbs			:1;	// Set Device Bits Interrupt
+			uint32 ufs			:1;	// Unknown FIS Interrupt
+			uint32 dps			:1;	// Descriptor Processed
+			uint32 pcs			:1;	// Port Connect Change Status
+			uint32 dmps			:1;	// Device Mechanical Presence Status
+			uint32 reserved1	:14;
+			uint32 prcs			:1;	// PhyRdy Change Status
+			uint32 ipms			:1;	// Incorrect Port Multiplier Status
+			uint32 ofs			:1;	// Overflow Status
+			uint32 reserved2	:1;
+			uint32 infs			:1;	// Interface Non-fatal Error Status
+			uint32 ifs			:1;	// Interface Fatal Error Status
+			uint32 hbds			:1;	// Host Bus Data Error Status
+			uint32 hbfs			:1;	// Host Bus Fatal Error Status
+			uint32 tfes			:1;	// Task File Error Status
+			uint32 cpds			:1;	// Cold Port Detect Status
+		} s;
 	} is;
 	// Interrupt enable
-	struct {
-		uint32 dhre			:1;	// Device to Host Register FIS Interrupt Enable
-		uint32 pse			:1;	// PIO Setup FIS Interrupt Enable
-		uint32 dse			:1;	// DMA Setup FIS Interrupt Enable
-		uint32 sdbe			:1;	// Set Device Bits FIS Interrupt Enable
-		uint32 ufe			:1;	// Unknown FIS Interrupt Enable
-		uint32 dpe			:1;	// Descriptor Processed Interrupt Enable
-		uint32 pce			:1;	// Port Change Interrupt Enable
-		uint32 dmpe			:1;	// Device Mechanical Presence Enable
-		uint32 reserved1	:14;
-		uint32 prce			:1;	// PhyRdy Change Interrupt Enable
-		uint32 ipme			:1;	// Incorrect Port Multiplier Enable
-		uint32 ofe			:1;	// Overflow Enable
-		uint32 reserved2	:1;
-		uint32 infe			:1;	// Interface Non-fatal Error Enable
-		uint32 ife			:1;	// Interface Fatal Error Enable
-		uint32 hbde			:1;	// Host Bus Data Error Enable
-		uint32 hbfe			:1;	// Host Bus Fatal Error Enable
-		uint32 tfee			:1;	// Task File Error Enable
-		uint32 cpde			:1;	// Cold Presence Detect Enable
+	union {
+		uint32 raw;
+		struct {
+			uint32 dhre			:1;	// Device to Host Register FIS Interrupt Enable
+			uint32 pse			:1;	// PIO Setup FIS Interrupt Enable
+			uint32 dse			:1;	// DMA Setup FIS Interrupt Enable
+			uint32 sdbe			:1;	// Set Device Bits FIS Interrupt Enable
+			uint32 ufe			:1;	// Unknown FIS Interrupt Enable
+			uint32 dpe			:1;	// Descriptor Processed Interrupt Enable
+			uint32 pce			:1;	// Port Change Interrupt Enable
+			uint32 dmpe			:1;	// Device Mechanical Presence Enable
+			uint32 reserved1	:14;
+			uint32 prce			:1;	// PhyRdy Change Interrupt Enable
+			uint32 ipme			:1;	// Incorrect Port Multiplier Enable
+			uint32 ofe			:1;	// Overflow Enable
+			uint32 reserved2	:1;
+			uint32 infe			:1;	// Interface Non-fatal Error Enable
+			uint32 ife			:1;	// Interface Fatal Error Enable
+			uint32 hbde			:1;	// Host Bus Data Error Enable
+			uint32 hbfe			:1;	// Host Bus Fatal Error Enable
+			uint32 tfee			:1;	// Task File Error Enable
+			uint32 cpde			:1;	// Cold Presence Detect Enable
+		} s;
 	} ie;
 	// Command and status
 	struct {
@@ -149,34 +194,37 @@ typedef volatile struct {
 		uint32 ipm			:4;	// Interface Power Management Transitions Allowed
 		uint32 reserved		:20;
 	} sctl;
-	// SATA error (SCR1:SError)
-	struct {
-		// Error
-		struct {
-			uint16 i		:1;	// Recovered Data Integrity Error
-			uint16 m		:1;	// Recovered Communications Error
-			uint16 reserved1:6;
-			uint16 t		:1;	// Transient Data Integrity Error
-			uint16 c		:1;	// Persistent Communication or Data Integrity Error
-			uint16 p		:1;	// Protocol Error
-			uint16 e		:1;	// Internal Error
-			uint16 reserved2:4;
-		} err;
-		// Diagnostics
+	// SATA error (SCR1:SError, write 1 to clear)
+	union {
+		uint32 raw;
 		struct {
-			uint16 n		:1;	// PhyRdy Change
-			uint16 i		:1;	// Phy Internal Error
-			uint16 w		:1;	// Comm Wake
-			uint16 b		:1;	// 10B to 8B Decode Error
-			uint16 d		:1;	// Disparity Error
-			uint16 c		:1;	// CRC Error
-			uint16 h		:1;	// Handshake Error
-			uint16 s		:1;	// Link Sequence Error
-			uint16 t		:1;	// Transport state transition error
-			uint16 f		:1;	// Unknown FIS Type
-			uint16 x		:1;	// Exchanged
-			uint16 reserved	:5;
-		} diag;
+			// Error
+			struct {
+				uint16 i		:1;	// Recovered Data Integrity Error
+				uint16 m		:1;	// Recovered Communications Error
+				uint16 reserved1:6;
+				uint16 t		:1;	// Transient Data Integrity Error
+				uint16 c		:1;	// Persistent Communication or Data Integrity Error
+				uint16 p		:1;	// Protocol Error
+				uint16 e		:1;	// Internal Error
+				uint16 reserved2:4;
+			} err;
+			// Diagnostics
+			struct {
+				uint16 n		:1;	// PhyRdy Change
+				uint16 i		:1;	// Phy Internal Error
+				uint16 w		:1;	// Comm Wake
+				uint16 b		:1;	// 10B to 8B Decode Error
+				uint16 d		:1;	// Disparity Error
+				uint16 c		:1;	// CRC Error
+				uint16 h		:1;	// Handshake Error
+				uint16 s		:1;	// Link Sequence Error
+				uint16 t		:1;	// Transport state transition error
+				uint16 f		:1;	// Unknown FIS Type
+				uint16 x		:1;	// Exchanged
+				uint16 reserved	:5;
+			} diag;
+		} s;
 	} serr;
 	uint32 sact;				// SATA active (SCR3:SActive)
 	uint32 ci;					// Command issue
@@ -201,7 +249,7 @@ typedef volatile struct {
 typedef volatile struct {
 	// Host capability
 	struct {
-		uint32 np			:4;	// Number of Ports
+		uint32 np			:5;	// Number of Ports
 		uint32 sxs			:1;	// External SATA (eSATA) supported
 		uint32 ems			:1;	// Enclosure Management supported
 		uint32 cccs			:1; // Command Completion Coalescing supported
@@ -379,7 +427,18 @@ typedef volatile struct {
 	uint32 dma_buff_offset;		//uint8 offset into buffer. First 2 bits must be 0
 	uint32 trans_count;			//Number of uint8s to transfer. Bit 0 must be 0
 	uint32 reserved4;
-} ahci_fis_dma_t; // 28 bytes
+} __PACKED ahci_fis_dma_t; // 28 bytes
+
+typedef volatile struct {
+	uint8 fis_type;				// FIS_TYPE_DEV_BITS
+	uint8 pmport			:4;	// Port multiplier
+	uint8 reserved1			:2;
+	uint8 interrupt			:1;	// Interrupt bit
+	uint8 notification		:1;	// Notification bit
+	uint8 status;				// Status register (bits 6:4 and 2:0)
+	uint8 error;				// Error register
+	uint32 active;				// Completed NCQ tags (bits cleared in PxSACT)
+} ahci_fis_sdb_t; // 8 bytes
 
 typedef volatile struct {
 	ahci_fis_dma_t dsfis;		// DMA Setup FIS
@@ -388,10 +447,10 @@ typedef volatile struct {
 	uint32 pad2[3];
 	ahci_fis_reg_d2h_t rfis;	// Register  Device to Host FIS
 	uint32 pad3;
-	uint8 sdbfis;		// Set Device Bit FIS
+	ahci_fis_sdb_t sdbfis;		// Set Device Bits FIS
  	uint8 ufis[64];
- 	uint32 reserved[96];
-} ahci_fis_t; // 256 bytes
+ 	uint32 reserved[24];
+} __PACKED ahci_fis_t; // 256 bytes
 
 typedef volatile struct {
 	// DW0 - Description Information
@@ -415,13 +474,903 @@ typedef volatile struct {
 	uint32	reserved[4];
 } ahci_hba_cmd_header_t;
 
+typedef volatile struct {
+	uint64 dba;					// Data base address (word aligned)
+	uint32 reserved1;
+	uint32 dbc				:22;// Byte count - 1, 4M max
+	uint32 reserved2		:9;
+	uint32 i				:1;	// Interrupt on completion
+} ahci_prdt_entry_t; // 16 bytes
+
+typedef volatile struct {
+	uint8 cfis[64];				// Command FIS
+	uint8 acmd[16];				// ATAPI command, 12 or 16 bytes
+	uint8 reserved[48];
+	ahci_prdt_entry_t prdt[AHCI_PRDT_MAX];	// Physical region descriptor table
+} ahci_cmd_tbl_t; // 128 byte aligned
+
+/**
+* Command list, received FIS area and command tables of a port
+*/
+typedef struct {
+	ahci_hba_cmd_header_t cmd[AHCI_SLOT_MAX];	// Command list (1K aligned)
+	ahci_fis_t fis;								// Received FIS (256 byte aligned)
+	ahci_cmd_tbl_t tbl[AHCI_SLOT_MAX];			// Command tables (128 byte aligned)
+} __ALIGN(1024) ahci_mem_t;
+
+struct ahci_ctrl_struct;
+/**
+* SATA drive state
+*/
+typedef struct {
+	struct ahci_ctrl_struct *ctrl;
+	ahci_port_t *port;
+	ahci_mem_t *mem;
+	spinlock_t lock;
+	uint32 slots;					// Slots the driver can use (HBA slots, NCQ queue depth)
+	uint32 busy;					// Issued slots
+	uint32 queued;					// Issued slots that carry NCQ commands
+	uint32 barrier;					// Issued slot that has to run alone (cache flush)
+	bool resetting;					// Port reset in progress, no new slots are issued
+	bool ncq;						// Both the HBA and the drive support NCQ
+	bool fua;						// Drive supports WRITE DMA FUA EXT
+	bool flush_ext;					// Drive supports FLUSH CACHE EXT
+	uint64 sectors;					// Capacity
+	ahci_req_t *req[AHCI_SLOT_MAX];	// Request in each issued slot
+	uint64 issued;					// Requests issued
+	uint64 errors;					// Port resets after errors or timeouts
+	uint64 depth_max;				// Most requests in flight at once
+	uint32 seq;						// Incremented by every completion batch (futex word)
+	uint32 waiters;					// Threads sleeping on seq
+	tasklet_t recover;				// Error recovery (wakes the recovery thread of the controller)
+} ahci_drive_t;
+/**
+* AHCI controller state
+*/
+struct ahci_ctrl_struct {
+	ahci_hba_t *hba;
+	pci_addr_t addr;
+	int_action_t action;			// Interrupt handler
+	int16 vector;					// Interrupt vector (-1 if none)
+	bool irq;						// Completions are signalled by interrupts (MSI, MSI-X)
+	ahci_drive_t *drives[32];		// Drive on each port
+	thread_t *thread;				// Error recovery thread (null until ahci_init_threads())
+	uint32 volatile recover;		// Ports waiting for the recovery thread
+};
+typedef struct ahci_ctrl_struct ahci_ctrl_t;
+
 typedef volatile struct {
 	ahci_hba_t *hba;
 	uint8 port;
+	ahci_drive_t *drive;		// Driver state (SATA drives only)
 } ahci_dev_t;
 
-static ahci_dev_t _ahci_dev[256];
-static uint64 _ahci_dev_count = 0;
+typedef struct {
+	uint64 count;
+	ahci_dev_t dev[256];
+} ahci_table_t;
+
+// Device table - read under rcu_read_lock(), ahci_init() fills the other copy and publishes it
+static ahci_table_t _ahci_tables[2];
+static ahci_table_t *_ahci_dev = &_ahci_tables[0];
+// Drive state is never released, so it stays valid after the device table is replaced
+static ahci_mem_t _ahci_mem[AHCI_DRIVE_MAX];
+static ahci_drive_t _ahci_drives[AHCI_DRIVE_MAX];
+static uint64 _ahci_drive_count = 0;
+static ahci_ctrl_t _ahci_ctrls[AHCI_CTRL_MAX];
+static uint64 _ahci_ctrl_count = 0;
+// IDENTIFY DEVICE data (ahci_init() only)
+static uint16 _ahci_id[AHCI_SECTOR_SIZE / sizeof(uint16)];
+#if DEBUG == 1
+// Benchmark read buffer (one worst case request per slot)
+static uint8 _ahci_bench_buff[AHCI_XFER_FIT * AHCI_SLOT_MAX] __ALIGN(PAGE_SIZE);
+#endif
+
+/**
+* Check a wait deadline (counts spins if there is no clock source)
+* @param deadline - absolute monotonic clock time (ns)
+* @param spin - spin counter (start with 0)
+* @return true if the wait should give up
+*/
+static bool ahci_timeout(uint64 deadline, uint64 *spin){
+	if (clock_source() == CLOCK_SOURCE_NONE){
+		return (++(*spin) >= AHCI_SPIN_MAX);
+	}
+	return (clock_monotonic_ns() >= deadline);
+}
+/**
+* Stop command list processing
+* @param port - port
+* @return false if the HBA did not stop in time
+*/
+static bool ahci_port_stop(ahci_port_t *port){
+	uint64 deadline = clock_monotonic_ns() + AHCI_TIMEOUT_NS;
+	uint64 spin = 0;
+	port->cmd.st = 0;
+	while (port->cmd.cr){
+		if (ahci_timeout(deadline, &spin)){
+			return false;
+		}
+	}
+	return true;
+}
+/**
+* Start command list processing once the drive is ready
+* @param port - port
+* @return false if the drive stayed busy
+*/
+static bool ahci_port_start(ahci_port_t *port){
+	uint64 deadline = clock_monotonic_ns() + AHCI_TIMEOUT_NS;
+	uint64 spin = 0;
+	while (port->tfd.status & (ATA_DEV_BUSY | ATA_DEV_DRQ)){
+		if (ahci_timeout(deadline, &spin)){
+			return false;
+		}
+	}
+	port->cmd.st = 1;
+	return true;
+}
+/**
+* Point a port to driver memory and start it
+* @param drive - drive
+* @return false if the port could not be stopped or started
+*/
+static bool ahci_port_init(ahci_drive_t *drive){
+	ahci_port_t *port = drive->port;
+	ahci_mem_t *mem = drive->mem;
+	uint64 deadline;
+	uint64 spin = 0;
+	uint8 i;
+	if (!ahci_port_stop(port)){
+		return false;
+	}
+	port->cmd.fre = 0;
+	deadline = clock_monotonic_ns() + AHCI_TIMEOUT_NS;
+	while (port->cmd.fr){
+		if (ahci_timeout(deadline, &spin)){
+			return false;
+		}
+	}
+	mem_fill((uint8 *)mem, sizeof(ahci_mem_t), 0);
+	port->clb = page_resolve((uint64)mem->cmd);
+	port->fb = page_resolve((uint64)&mem->fis);
+	for (i = 0; i < AHCI_SLOT_MAX; i ++){
+		mem->cmd[i].ctba = page_resolve((uint64)&mem->tbl[i]);
+	}
+	// Write 1 to clear
+	port->serr.raw = 0xFFFFFFFF;
+	port->is.raw = 0xFFFFFFFF;
+	port->cmd.fre = 1;
+	return ahci_port_start(port);
+}
+/**
+* Reset the link after an error (drive lock released, drive marked resetting)
+* COMRESET also takes the drive out of the NCQ error state, and stopping the
+* port clears PxSACT and PxCI
+* @param drive - drive
+*/
+static void ahci_port_reset(ahci_drive_t *drive){
+	ahci_port_t *port = drive->port;
+	uint64 deadline;
+	uint64 spin = 0;
+	ahci_port_stop(port);
+	port->sctl.det = 1;
+	// COMRESET has to be asserted for at least 1ms
+	deadline = clock_monotonic_ns() + 1000000;
+	while (!ahci_timeout(deadline, &spin));
+	port->sctl.det = 0;
+	deadline = clock_monotonic_ns() + AHCI_TIMEOUT_NS;
+	spin = 0;
+	while (port->ssts.det != 3 && !ahci_timeout(deadline, &spin));
+	port->serr.raw = 0xFFFFFFFF;
+	port->is.raw = 0xFFFFFFFF;
+	ahci_port_start(port);
+}
+/**
+* Release finished slots (drive lock held)
+* @param drive - drive
+* @param done - slots to release
+* @param failed - subset of slots that failed
+* @param reqs - released requests
+* @param status - AHCI_REQ_* of each released request
+* @return number of released requests
+*/
+static uint64 ahci_release(ahci_drive_t *drive, uint32 done, uint32 failed, ahci_req_t **reqs, uint64 *status){
+	uint64 count = 0;
+	uint8 slot;
+	drive->busy &= ~done;
+	drive->queued &= ~done;
+	drive->barrier &= ~done;
+	for (slot = 0; done != 0; slot ++, done >>= 1, failed >>= 1){
+		if (done & 1){
+			reqs[count] = drive->req[slot];
+			status[count] = ((failed & 1) ? AHCI_REQ_ERROR : AHCI_REQ_DONE);
+			drive->req[slot] = null;
+			count ++;
+		}
+	}
+	return count;
+}
+/**
+* Collect completed slots (drive lock held)
+* On a port error the caller becomes the owner of the port reset
+* @param drive - drive
+* @param reqs - completed requests
+* @param status - AHCI_REQ_* of each completed request
+* @param irq - called from the interrupt handler (errors are left for the recover tasklet)
+* @param reset - set to true if the caller has to reset the port
+* @return number of completed requests
+*/
+static uint64 ahci_reap(ahci_drive_t *drive, ahci_req_t **reqs, uint64 *status, bool irq, bool *reset){
+	ahci_port_t *port = drive->port;
+	uint32 is = port->is.raw;
+	uint32 done;
+	*reset = false;
+	if (irq && !drive->resetting){
+		// Error stays set and raises the interrupt again, the handler hands it to the recover tasklet
+		is &= ~AHCI_PxIS_ERROR;
+	}
+	// Clear before looking at the slots, so later completions raise the status again
+	port->is.raw = is;
+	if (drive->resetting){
+		// Stopping the port clears PxSACT and PxCI, the slots belong to the reset
+		return 0;
+	}
+	// NCQ commands are done when the Set Device Bits FIS clears their PxSACT bit,
+	// other commands when the HBA clears their PxCI bit
+	done = drive->busy & ~(port->sact | port->ci);
+	if (is & AHCI_PxIS_ERROR){
+		// Drive aborts all outstanding NCQ commands after an error
+		drive->resetting = true;
+		*reset = true;
+	}
+	return ahci_release(drive, done, 0, reqs, status);
+}
+/**
+* Publish request status and call completion callbacks (drive lock released)
+* @param reqs - requests
+* @param status - AHCI_REQ_* of each request
+* @param count - number of requests
+*/
+static void ahci_finish(ahci_req_t **reqs, uint64 *status, uint64 count){
+	ahci_done_t done;
+	uint64 i;
+	for (i = 0; i < count; i ++){
+		// Owner can reuse the request as soon as it sees the status
+		done = reqs[i]->done;
+		__atomic_store_n(&reqs[i]->status, status[i], __ATOMIC_RELEASE);
+		if (done != null){
+			done(reqs[i]);
+		}
+	}
+}
+/**
+* Wake threads waiting for slots or completions of a drive
+* @param drive - drive
+*/
+static void ahci_wake(ahci_drive_t *drive){
+	__atomic_add_fetch(&drive->seq, 1, __ATOMIC_SEQ_CST);
+	// Waiter increments waiters before it checks seq, so one of us sees the other
+	if (__atomic_load_n(&drive->waiters, __ATOMIC_SEQ_CST) > 0){
+		futex_wake(&drive->seq, FUTEX_WAKE_ALL);
+	}
+}
+/**
+* Reset the port and fail the slots that were outstanding (owner of the reset)
+* Runs with interrupts enabled and without the drive lock - COMRESET takes milliseconds
+* @param drive - drive (marked resetting)
+* @param failed - slots outstanding when the reset was claimed
+* @return number of failed requests
+*/
+static uint64 ahci_reset(ahci_drive_t *drive, uint32 failed){
+	ahci_req_t *reqs[AHCI_SLOT_MAX];
+	uint64 status[AHCI_SLOT_MAX];
+	uint64 count;
+	uint64 flags;
+	ahci_port_reset(drive);
+	flags = spinlock_lock_irq(&drive->lock);
+	count = ahci_release(drive, failed, failed, reqs, status);
+	drive->errors ++;
+	drive->resetting = false;
+	spinlock_unlock_irq(&drive->lock, flags);
+	ahci_finish(reqs, status, count);
+	ahci_wake(drive);
+	return count;
+}
+/**
+* Complete finished requests of a drive
+* @param drive - drive
+* @param irq - called from the interrupt handler (port errors are left for the recover tasklet)
+* @return number of requests completed
+*/
+static uint64 ahci_poll_drive(ahci_drive_t *drive, bool irq){
+	ahci_req_t *reqs[AHCI_SLOT_MAX];
+	uint64 status[AHCI_SLOT_MAX];
+	uint64 count;
+	uint64 flags;
+	uint32 failed;
+	bool reset;
+	flags = spinlock_lock_irq(&drive->lock);
+	count = ahci_reap(drive, reqs, status, irq, &reset);
+	failed = drive->busy;
+	spinlock_unlock_irq(&drive->lock, flags);
+	ahci_finish(reqs, status, count);
+	if (count > 0){
+		ahci_wake(drive);
+	}
+	if (reset){
+		count += ahci_reset(drive, failed);
+	}
+	return count;
+}
+/**
+* Fail all outstanding requests and reset the port (request timeout)
+* @param drive - drive
+*/
+static void ahci_abort(ahci_drive_t *drive){
+	uint64 flags;
+	uint32 failed;
+	bool reset;
+	flags = spinlock_lock_irq(&drive->lock);
+	// Nothing to do if another thread is already resetting the port
+	reset = !drive->resetting;
+	drive->resetting = true;
+	failed = drive->busy;
+	spinlock_unlock_irq(&drive->lock, flags);
+	if (reset){
+		ahci_reset(drive, failed);
+	}
+}
+/**
+* Build the physical region descriptor table of a command
+* Buffer is translated page by page, physically contiguous pages share an entry.
+* Stops early once the table is full.
+* @param tbl - command table
+* @param buff - data buffer
+* @param len - number of bytes
+* @param count - number of entries used
+* @return number of bytes covered (whole sectors, 0 if a page is not mapped)
+*/
+static uint64 ahci_prdt(ahci_cmd_tbl_t *tbl, uint8 *buff, uint64 len, uint16 *count){
+	uint64 vaddr = (uint64)buff;
+	uint64 paddr;
+	uint64 start = 0;
+	uint64 run = 0;
+	uint64 total = 0;
+	uint64 excess;
+	uint64 size;
+	int16 i = -1;
+	*count = 0;
+	while (total < len){
+		// Up to the end of the page
+		size = PAGE_SIZE - (vaddr & PAGE_IMASK);
+		if (size > len - total){
+			size = len - total;
+		}
+		paddr = page_resolve(vaddr);
+		if (paddr == 0){
+			return 0;
+		}
+		if (i >= 0 && start + run == paddr && run + size <= AHCI_PRDT_BYTES_MAX){
+			// Extend the current entry
+			run += size;
+		} else {
+			if (i + 1 >= AHCI_PRDT_MAX){
+				// Rest of the buffer goes to the next request
+				break;
+			}
+			i ++;
+			start = paddr;
+			run = size;
+			tbl->prdt[i].dba = start;
+			tbl->prdt[i].i = 0;
+		}
+		tbl->prdt[i].dbc = run - 1;
+		vaddr += size;
+		total += size;
+	}
+	// Cut a partly covered buffer back to whole sectors
+	excess = total & (AHCI_SECTOR_SIZE - 1);
+	total -= excess;
+	while (excess > 0){
+		size = tbl->prdt[i].dbc + 1;
+		if (size > excess){
+			tbl->prdt[i].dbc = size - excess - 1;
+			excess = 0;
+		} else {
+			excess -= size;
+			i --;
+		}
+	}
+	*count = (uint16)(i + 1);
+	return total;
+}
+/**
+* Fill in the command header, command FIS and PRDT of a slot
+* @param drive - drive
+* @param slot - command slot (NCQ tag)
+* @param req - request
+* @param ncq - issue as an NCQ command
+* @return false if a page of the buffer is not mapped
+*/
+static bool ahci_setup(ahci_drive_t *drive, uint8 slot, ahci_req_t *req, bool ncq){
+	ahci_hba_cmd_header_t *cmd = &drive->mem->cmd[slot];
+	ahci_cmd_tbl_t *tbl = &drive->mem->tbl[slot];
+	ahci_fis_reg_h2d_t *fis = (ahci_fis_reg_h2d_t *)tbl->cfis;
+	uint64 sectors;
+	uint16 count;
+	uint64 len = ahci_prdt(tbl, req->buff, req->len, &count);
+	if (len == 0 && req->len > 0){
+		return false;
+	}
+	// Request shrinks to what the PRDT describes
+	req->len = len;
+	sectors = len / AHCI_SECTOR_SIZE;
+	mem_fill((uint8 *)fis, sizeof(ahci_fis_reg_h2d_t), 0);
+	fis->fis_type = FIS_TYPE_REG_H2D;
+	fis->cmd = 1;
+	fis->lba0 = (uint8)req->lba;
+	fis->lba1 = (uint8)(req->lba >> 8);
+	fis->lba2 = (uint8)(req->lba >> 16);
+	fis->lba3 = (uint8)(req->lba >> 24);
+	fis->lba4 = (uint8)(req->lba >> 32);
+	fis->lba5 = (uint8)(req->lba >> 40);
+	fis->device = (1 << 6);					// LBA mode
+	if (req->op == AHCI_OP_IDENTIFY){
+		fis->command = ATA_CMD_IDENTIFY;
+		fis->device = 0;
+	} else if (req->op == AHCI_OP_FLUSH){
+		fis->command = (drive->flush_ext ? ATA_CMD_FLUSH_EX : ATA_CMD_FLUSH);
+		fis->device = 0;
+	} else if (ncq){
+		fis->command = (req->op == AHCI_OP_WRITE ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA);
+		// Sector count goes to the feature register, the tag to count bits 7:3
+		fis->featurel = (uint8)sectors;
+		fis->featureh = (uint8)(sectors >> 8);
+		fis->countl = (uint8)(slot << 3);
+		if (req->flags & AHCI_FLAG_FUA){
+			// Force Unit Access - data is on the media when the command completes
+			fis->device |= (1 << 7);
+		}
+	} else {
+		if (req->op == AHCI_OP_WRITE){
+			fis->command = ((req->flags & AHCI_FLAG_FUA) ? ATA_CMD_WRITE_DMA_FUA_EX : ATA_CMD_WRITE_DMA_EX);
+		} else {
+			fis->command = ATA_CMD_READ_DMA_EX;
+		}
+		fis->countl = (uint8)sectors;
+		fis->counth = (uint8)(sectors >> 8);
+	}
+	cmd->desc.cfl = sizeof(ahci_fis_reg_h2d_t) / sizeof(uint32);
+	cmd->desc.a = 0;
+	cmd->desc.w = (req->op == AHCI_OP_WRITE ? 1 : 0);	// Host to device
+	cmd->desc.c = 0;
+	cmd->desc.prdtl = count;
+	cmd->prdbc = 0;
+	return true;
+}
+/**
+* Check transfer parameters
+* @param drive - drive
+* @param op - AHCI_OP_*
+* @param lba - start sector
+* @param buff - data buffer
+* @param len - number of bytes
+* @param flags - AHCI_FLAG_*
+* @return false if the drive would reject the transfer
+*/
+static bool ahci_valid(ahci_drive_t *drive, uint8 op, uint64 lba, uint8 *buff, uint64 len, uint8 flags){
+	switch (op){
+		case AHCI_OP_IDENTIFY:
+			return (len == AHCI_SECTOR_SIZE && ((uint64)buff & 1) == 0);
+		case AHCI_OP_FLUSH:
+			return (len == 0);
+		case AHCI_OP_READ:
+		case AHCI_OP_WRITE:
+			if (len == 0 || (len % AHCI_SECTOR_SIZE) != 0 || ((uint64)buff & 1) != 0){
+				return false;
+			}
+			if (lba + (len / AHCI_SECTOR_SIZE) > drive->sectors){
+				return false;
+			}
+			// FUA is a bit of every NCQ command, without NCQ it needs WRITE DMA FUA EXT
+			if ((flags & AHCI_FLAG_FUA) && (op != AHCI_OP_WRITE || (!drive->ncq && !drive->fua))){
+				return false;
+			}
+			return true;
+	}
+	return false;
+}
+/**
+* Issue a request in a free command slot
+* @param drive - drive
+* @param req - request (len is cut to what the slot's PRDT can describe)
+* @return false if no slot is free, or if the request is invalid (status set to AHCI_REQ_ERROR)
+*/
+static bool ahci_submit_drive(ahci_drive_t *drive, ahci_req_t *req){
+	bool ncq = (drive->ncq && (req->op == AHCI_OP_READ || req->op == AHCI_OP_WRITE));
+	uint64 depth;
+	uint64 flags;
+	uint32 free;
+	uint32 bit;
+	uint8 slot;
+	if (req->len > AHCI_XFER_MAX || !ahci_valid(drive, req->op, req->lba, req->buff, req->len, req->flags)){
+		req->status = AHCI_REQ_ERROR;
+		return false;
+	}
+	flags = spinlock_lock_irq(&drive->lock);
+	if (drive->resetting){
+		free = 0;
+	} else if (drive->barrier != 0 || (req->op == AHCI_OP_FLUSH && drive->busy != 0)){
+		// Flush runs alone, so it covers every write completed before it was issued
+		free = 0;
+	} else if (ncq ? (drive->busy != drive->queued) : (drive->queued != 0)){
+		// Queued and non-queued commands can't be outstanding at the same time
+		free = 0;
+	} else {
+		free = drive->slots & ~drive->busy;
+	}
+	if (free == 0){
+		spinlock_unlock_irq(&drive->lock, flags);
+		return false;
+	}
+	slot = (uint8)__builtin_ctz(free);
+	bit = (1U << slot);
+	// Command table of a free slot is not read by the HBA
+	if (!ahci_setup(drive, slot, req, ncq)){
+		spinlock_unlock_irq(&drive->lock, flags);
+		req->status = AHCI_REQ_ERROR;
+		return false;
+	}
+	drive->req[slot] = req;
+	drive->busy |= bit;
+	if (ncq){
+		drive->queued |= bit;
+	}
+	if (req->op == AHCI_OP_FLUSH){
+		drive->barrier = bit;
+	}
+	req->status = AHCI_REQ_PENDING;
+	// Plain stores - writing back bits that read as 1 could re-issue a slot that has just completed
+	if (ncq){
+		drive->port->sact = bit;
+	}
+	drive->port->ci = bit;
+	drive->issued ++;
+	depth = (uint64)__builtin_popcount(drive->busy);
+	if (depth > drive->depth_max){
+		drive->depth_max = depth;
+	}
+	spinlock_unlock_irq(&drive->lock, flags);
+	return true;
+}
+/**
+* Check if the caller can sleep until a completion wakes it up
+* @return false at boot (no scheduler, interrupts disabled) and in atomic context
+*/
+static bool ahci_can_sleep(){
+	uint64 flags;
+	if (clock_source() == CLOCK_SOURCE_NONE || thread_current() == null || !preemptible()){
+		return false;
+	}
+	asm volatile("pushfq; popq %0" : "=r"(flags));
+	return ((flags & 0x200) != 0);
+}
+/**
+* Transfer a buffer with up to depth requests in flight and wait for them
+* @param drive - drive
+* @param op - AHCI_OP_*
+* @param lba - start sector
+* @param buff - data buffer
+* @param len - number of bytes
+* @param depth - requests in flight (up to AHCI_SLOT_MAX)
+* @param xfer - largest request (up to AHCI_XFER_MAX bytes)
+* @param flags - AHCI_FLAG_*
+* @return false if any of the requests failed
+*/
+static bool ahci_transfer(ahci_drive_t *drive, uint8 op, uint64 lba, uint8 *buff, uint64 len, uint64 depth, uint64 xfer, uint8 flags){
+	ahci_req_t req[AHCI_SLOT_MAX];
+	uint64 timeout = (op == AHCI_OP_FLUSH ? AHCI_FLUSH_TIMEOUT_NS : AHCI_TIMEOUT_NS);
+	uint64 deadline = clock_monotonic_ns() + timeout;
+	uint64 spin = 0;
+	uint64 pending;
+	uint64 size;
+	uint64 wait;
+	uint64 i;
+	uint32 seq;
+	uint32 last = __atomic_load_n(&drive->seq, __ATOMIC_ACQUIRE);
+	bool sleep = ahci_can_sleep();
+	bool todo = true;
+	bool ok = true;
+	// Invalid requests would never be issued
+	if (!ahci_valid(drive, op, lba, buff, len, flags)){
+		return false;
+	}
+	if (depth > AHCI_SLOT_MAX){
+		depth = AHCI_SLOT_MAX;
+	}
+	mem_fill((uint8 *)req, sizeof(req), 0);
+	while (true){
+		// Read before the slots are checked, so a completion after the check is not missed
+		seq = __atomic_load_n(&drive->seq, __ATOMIC_ACQUIRE);
+		pending = 0;
+		for (i = 0; i < depth; i ++){
+			if (req[i].status == AHCI_REQ_PENDING){
+				pending ++;
+				continue;
+			}
+			if (req[i].status == AHCI_REQ_ERROR){
+				ok = false;
+			}
+			req[i].status = AHCI_REQ_IDLE;
+			// Keep the queue full
+			if (ok && todo){
+				req[i].op = op;
+				req[i].flags = flags;
+				req[i].lba = lba;
+				req[i].buff = buff;
+				req[i].len = (len > xfer ? xfer : len);
+				if (ahci_submit_drive(drive, &req[i])){
+					// Request covers less if the buffer needs more PRDT entries than a table has
+					size = req[i].len;
+					lba += size / AHCI_SECTOR_SIZE;
+					buff += size;
+					len -= size;
+					todo = (len > 0);
+					pending ++;
+				} else if (req[i].status == AHCI_REQ_ERROR){
+					ok = false;
+				}
+			}
+		}
+		if (pending == 0 && (!todo || !ok)){
+			break;
+		}
+		if (seq != last || pending == 0){
+			// Drive made progress (or the slots are taken by other callers)
+			last = seq;
+			deadline = clock_monotonic_ns() + timeout;
+			spin = 0;
+		} else if (ahci_timeout(deadline, &spin)){
+			// Last chance for a lost interrupt
+			if (ahci_poll_drive(drive, false) == 0){
+#if DEBUG == 1
+				debug_print(DC_WB, "AHCI timeout");
+#endif
+				ahci_abort(drive);
+			}
+			continue;
+		}
+		if (sleep){
+			// Without interrupts the drive is polled in short intervals, the CPU is free meanwhile
+			wait = deadline;
+			if (!drive->ctrl->irq && clock_monotonic_ns() + AHCI_POLL_NS < wait){
+				wait = clock_monotonic_ns() + AHCI_POLL_NS;
+			}
+			__atomic_add_fetch(&drive->waiters, 1, __ATOMIC_SEQ_CST);
+			futex_wait(&drive->seq, seq, wait);
+			__atomic_sub_fetch(&drive->waiters, 1, __ATOMIC_RELAXED);
+		}
+		if (!sleep || !drive->ctrl->irq){
+			ahci_poll_drive(drive, false);
+		}
+	}
+	return ok;
+}
+/**
+* Finish requests of a port that has raised an error and re-enable its interrupts
+* @param drive - drive
+*/
+static void ahci_recover_port(ahci_drive_t *drive){
+	ahci_poll_drive(drive, false);
+	drive->port->ie.raw = AHCI_PxIE_MASK;
+}
+/**
+* Error recovery thread of a controller
+* Port reset busy-waits for milliseconds, here it can be preempted
+* @param arg - controller
+*/
+static void ahci_recover_thread(void *arg){
+	ahci_ctrl_t *ctrl = (ahci_ctrl_t *)arg;
+	uint32 ports;
+	uint8 i;
+	while (true){
+		thread_block_prepare();
+		if (ctrl->recover == 0){
+			thread_block();
+			continue;
+		}
+		thread_wake(thread_current());
+		ports = __atomic_exchange_n(&ctrl->recover, 0, __ATOMIC_ACQ_REL);
+		for (i = 0; ports != 0; i ++, ports >>= 1){
+			if ((ports & 1) && ctrl->drives[i] != null){
+				ahci_recover_port(ctrl->drives[i]);
+			}
+		}
+	}
+}
+/**
+* Hand a port that has raised an error to the recovery thread (tasklet)
+* @param data - drive
+*/
+static void ahci_recover(uint64 data){
+	ahci_drive_t *drive = (ahci_drive_t *)data;
+	ahci_ctrl_t *ctrl = drive->ctrl;
+	thread_t *thread = __atomic_load_n(&ctrl->thread, __ATOMIC_ACQUIRE);
+	if (thread == null){
+		// Scheduler is not up yet
+		ahci_recover_port(drive);
+		return;
+	}
+	__atomic_or_fetch(&ctrl->recover, 1U << (drive->port - ctrl->hba->ports), __ATOMIC_RELEASE);
+	thread_wake(thread);
+}
+/**
+* AHCI controller interrupt handler
+* @param stack - registers pushed on the stack by assembly
+* @param data - controller
+* @return 1 if the interrupt was not raised by this controller
+*/
+static uint64 ahci_irq(int_stack_t *stack, void *data){
+	ahci_ctrl_t *ctrl = (ahci_ctrl_t *)data;
+	ahci_drive_t *drive;
+	uint32 is = ctrl->hba->is;
+	uint32 ports = is;
+	uint8 i;
+	if (is == 0){
+		// Shared INTx line raised by another device
+		return 1;
+	}
+	for (i = 0; ports != 0; i ++, ports >>= 1){
+		if ((ports & 1) == 0){
+			continue;
+		}
+		drive = ctrl->drives[i];
+		if (drive == null){
+			ctrl->hba->ports[i].is.raw = ctrl->hba->ports[i].is.raw;
+		} else if (drive->port->is.raw & AHCI_PxIS_ERROR){
+			// Port reset takes milliseconds, keep it out of the interrupt handler and softirqs
+			drive->port->ie.raw = 0;
+			tasklet_schedule(&drive->recover);
+		} else {
+			ahci_poll_drive(drive, true);
+		}
+	}
+	// Controller status is cleared after the port status
+	ctrl->hba->is = is;
+	return 0;
+}
+/**
+* Find or set up controller state
+* @param hba - HBA
+* @param addr - PCI address
+* @return controller or null if there are too many controllers
+*/
+static ahci_ctrl_t *ahci_ctrl_init(ahci_hba_t *hba, pci_addr_t addr){
+	ahci_ctrl_t *ctrl;
+	uint64 i;
+	for (i = 0; i < _ahci_ctrl_count; i ++){
+		if (_ahci_ctrls[i].hba == hba){
+			return &_ahci_ctrls[i];
+		}
+	}
+	if (_ahci_ctrl_count >= AHCI_CTRL_MAX){
+		return null;
+	}
+	ctrl = &_ahci_ctrls[_ahci_ctrl_count ++];
+	ctrl->hba = hba;
+	ctrl->addr = addr;
+	ctrl->vector = -1;
+	return ctrl;
+}
+/**
+* Route controller interrupts and enable them on all the drives
+* Interrupts target the housekeeping CPU, so isolated CPUs never see disk completions
+* @param ctrl - controller
+* @param dev - PCI configuration
+*/
+static void ahci_irq_init(ahci_ctrl_t *ctrl, pci_device_t *dev){
+	int16 vector;
+	uint8 i;
+	if (ctrl->action.func == null){
+		ctrl->action.func = ahci_irq;
+		ctrl->action.data = ctrl;
+		ctrl->action.name = "ahci";
+		// HBA signals all the ports with one message
+		vector = pci_irq_alloc(ctrl->addr, cpu_housekeeping(), 1);
+		if (vector >= 0){
+			ctrl->action.flags = 0;
+			if (interrupt_request((uint8)vector, &ctrl->action)){
+				ctrl->vector = vector;
+				ctrl->irq = true;
+			} else {
+				pci_irq_free(ctrl->addr);
+			}
+		} else if (dev->int_line < 16){
+			// INTx only arrives while the PIC is unmasked, so waiters keep polling too
+			ctrl->action.flags = INT_ACTION_SHARED;
+			if (interrupt_request(IRQ0 + dev->int_line, &ctrl->action)){
+				ctrl->vector = IRQ0 + dev->int_line;
+			}
+		}
+		if (ctrl->vector == -1){
+			ctrl->action.func = null;
+			return;
+		}
+	}
+	for (i = 0; i < 32; i ++){
+		if (ctrl->drives[i] != null){
+			ctrl->drives[i]->port->is.raw = 0xFFFFFFFF;
+			ctrl->drives[i]->port->ie.raw = AHCI_PxIE_MASK;
+		}
+	}
+	ctrl->hba->is = 0xFFFFFFFF;
+	ctrl->hba->ghc.ie = 1;
+}
+/**
+* Set up driver state for a SATA drive and read its capabilities
+* @param ctrl - controller
+* @param idx - port index
+* @return drive or null if the port could not be started
+*/
+static ahci_drive_t *ahci_drive_init(ahci_ctrl_t *ctrl, uint8 idx){
+	ahci_hba_t *hba = ctrl->hba;
+	ahci_drive_t *drive;
+	uint64 depth;
+	uint64 i;
+	// Drive state survives ahci_init() being called again
+	for (i = 0; i < _ahci_drive_count; i ++){
+		if (_ahci_drives[i].port == &hba->ports[idx]){
+			return &_ahci_drives[i];
+		}
+	}
+	if (_ahci_drive_count >= AHCI_DRIVE_MAX){
+		return null;
+	}
+	drive = &_ahci_drives[_ahci_drive_count];
+	drive->ctrl = ctrl;
+	drive->port = &hba->ports[idx];
+	tasklet_init(&drive->recover, ahci_recover, (uint64)drive);
+	drive->mem = &_ahci_mem[_ahci_drive_count];
+	drive->slots = (hba->cap.ncs == 31 ? 0xFFFFFFFF : (1U << (hba->cap.ncs + 1)) - 1);
+	if (!ahci_port_init(drive)){
+		return null;
+	}
+	_ahci_drive_count ++;
+	ctrl->drives[idx] = drive;
+	if (ahci_transfer(drive, AHCI_OP_IDENTIFY, 0, (uint8 *)_ahci_id, AHCI_SECTOR_SIZE, 1, AHCI_XFER_MAX, 0)){
+		// Words 100-103 - LBA48 sector count
+		drive->sectors = *((uint64 *)&_ahci_id[100]);
+		// Word 76 bit 8 - NCQ supported, word 75 - queue depth - 1
+		if (hba->cap.sncq && (_ahci_id[76] & (1 << 8))){
+			depth = (_ahci_id[75] & 0x1F) + 1;
+			if (depth < AHCI_SLOT_MAX){
+				drive->slots &= (1U << depth) - 1;
+			}
+			drive->ncq = true;
+		}
+		// Word 83 bit 13 - FLUSH CACHE EXT, word 84 bit 6 - WRITE DMA FUA EXT
+		drive->flush_ext = ((_ahci_id[83] & (1 << 13)) != 0);
+		drive->fua = ((_ahci_id[84] & (1 << 6)) != 0);
+	}
+	return drive;
+}
+/**
+* Find driver state of a device
+* @param idx - device index in the device list
+* @return drive or null
+*/
+static ahci_drive_t *ahci_get_drive(uint64 idx){
+	ahci_table_t *table;
+	ahci_drive_t *drive = null;
+	rcu_read_lock();
+	table = rcu_dereference(_ahci_dev);
+	if (idx < table->count){
+		drive = table->dev[idx].drive;
+	}
+	rcu_read_unlock();
+	return drive;
+}
 
 // Check device type
 static uint32 ahci_get_type(ahci_port_t *port){
@@ -440,7 +1389,8 @@ static uint32 ahci_get_type(ahci_port_t *port){
 			return AHCI_DEV_SATA;
 	}
 }
-static void ahci_init_port(ahci_hba_t *hba){
+static void ahci_init_port(ahci_table_t *table, ahci_ctrl_t *ctrl){
+	ahci_hba_t *hba = ctrl->hba;
 	uint32 dev_type = 0;
 	uint32 ports = hba->pi;
 	uint8 i = 0;
@@ -450,7 +1400,7 @@ static void ahci_init_port(ahci_hba_t *hba){
 #if DEBUG == 1
 			switch (dev_type){
 				case AHCI_DEV_SATA:
-					debug_print(DC_WGR, "SATAPI drive found at port %d\n", i);
+					debug_print(DC_WGR, "SATA drive found at port %d\n", i);
 					break;
 				case AHCI_DEV_SATAPI:
 					debug_print(DC_WGR, "SATAPI drive found at port %d\n", i);
@@ -471,25 +1421,31 @@ static void ahci_init_port(ahci_hba_t *hba){
 				case AHCI_DEV_SATAPI:
 				case AHCI_DEV_SEMB:
 				case AHCI_DEV_PM:
-					_ahci_dev[_ahci_dev_count].hba = hba;
-					_ahci_dev[_ahci_dev_count].port = i;
-					_ahci_dev_count ++;
+					if (table->count < 256){
+						table->dev[table->count].hba = hba;
+						table->dev[table->count].port = i;
+						table->dev[table->count].drive = (dev_type == AHCI_DEV_SATA ? ahci_drive_init(ctrl, i) : null);
+						table->count ++;
+					}
 					break;
 			}
 		}
 		ports >>= 1;
-		i ++;
 	}
 }
 
 bool ahci_init(){
 	uint64 abar = 0;
+	uint64 offset = 0;
 	uint8 i = 0;
 	uint8 dev_count = 0;
 	ahci_hba_t *hba;
+	ahci_ctrl_t *ctrl;
 	pci_device_t dev;
+	ahci_table_t *table = (_ahci_dev == &_ahci_tables[0] ? &_ahci_tables[1] : &_ahci_tables[0]);
 
 	dev_count = pci_num_device(0x1, 0x6);
+	table->count = 0;
 	if (dev_count > 0){
 #if DEBUG == 1
 		debug_print(DC_WB, "SATA Controller count: %d", dev_count);
@@ -500,21 +1456,33 @@ bool ahci_init(){
 				// Get AHCI controller configuration
 				pci_get_config(&dev, addr);
 				// Get ABAR (AHCI Base Address)
-				abar = (uint64)dev.bar[5];
-				// Map the page
-				page_map_mmio(abar);
+				abar = (uint64)dev.bar[5] & AHCI_HBA_MASK;
+				// Map the registers of all 32 ports
+				for (offset = 0; offset < AHCI_HBA_SIZE; offset += PAGE_SIZE){
+					page_map_mmio(abar + offset);
+				}
 				hba = (ahci_hba_t *)abar;
+				// Switch to AHCI mode
+				hba->ghc.ae = 1;
 #if DEBUG == 1
 				debug_print(DC_WB, "SATA controller at %u:%u", addr.s.bus, addr.s.device);
 				debug_print(DC_WB, "     BAR:0x%x", abar);
-				debug_print(DC_WB, "     Num Ports:%d", hba->cap.np);
-				debug_print(DC_WB, "     Num Commands:%d", hba->cap.ncs);
+				debug_print(DC_WB, "     Num Ports:%d", hba->cap.np + 1);
+				debug_print(DC_WB, "     Num Commands:%d", hba->cap.ncs + 1);
+				debug_print(DC_WB, "     NCQ:%d", hba->cap.sncq);
 				debug_print(DC_WB, "     64-bit addresing:%d", hba->cap.s64a);
 				debug_print(DC_WB, "     Version:%x", hba->vs);
 #endif
-				ahci_init_port(hba);
+				ctrl = ahci_ctrl_init(hba, addr);
+				if (ctrl != null){
+					ahci_init_port(table, ctrl);
+					ahci_irq_init(ctrl, &dev);
+				}
 			}
 		}
+		rcu_assign_pointer(_ahci_dev, table);
+		// Spare copy can be refilled only after readers of the old one are gone
+		synchronize_rcu();
 		return true;
 #if DEBUG == 1
 	} else {
@@ -524,19 +1492,113 @@ bool ahci_init(){
 	return false;
 }
 
-bool ahci_read(uint64 idx, uint8 *buff, uint64 len){
-	if (idx < _ahci_dev_count){
-		ahci_hba_t *hba = _ahci_dev[idx].hba;
-		ahci_port_t *port = &hba->ports[_ahci_dev[idx].port];
-
+void ahci_init_threads(){
+	thread_t *thread;
+	uint64 i;
+	for (i = 0; i < _ahci_ctrl_count; i ++){
+		if (_ahci_ctrls[i].irq && _ahci_ctrls[i].thread == null){
+			thread = thread_create("ahci", ahci_recover_thread, &_ahci_ctrls[i], SCHED_FAIR, 0);
+			__atomic_store_n(&_ahci_ctrls[i].thread, thread, __ATOMIC_RELEASE);
+		}
 	}
-	return false;
 }
-bool ahci_write(uint64 idx, uint8 *buff, uint64 len){
-	if (idx < _ahci_dev_count){
-		ahci_hba_t *hba = _ahci_dev[idx].hba;
-		ahci_port_t *port = &hba->ports[_ahci_dev[idx].port];
+uint64 ahci_num_dev(){
+	uint64 count;
+	rcu_read_lock();
+	count = rcu_dereference(_ahci_dev)->count;
+	rcu_read_unlock();
+	return count;
+}
+uint64 ahci_sectors(uint64 idx){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	return (drive != null ? drive->sectors : 0);
+}
+bool ahci_submit(uint64 idx, ahci_req_t *req){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	if (drive == null || req->op == AHCI_OP_IDENTIFY){
+		return false;
+	}
+	return ahci_submit_drive(drive, req);
+}
+uint64 ahci_poll(uint64 idx){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	if (drive == null){
+		return 0;
+	}
+	return ahci_poll_drive(drive, false);
+}
+bool ahci_read(uint64 idx, uint64 lba, uint8 *buff, uint64 len){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	if (drive == null){
+		return false;
+	}
+	return ahci_transfer(drive, AHCI_OP_READ, lba, buff, len, AHCI_SLOT_MAX, AHCI_XFER_MAX, 0);
+}
+bool ahci_write(uint64 idx, uint64 lba, uint8 *buff, uint64 len, uint8 flags){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	if (drive == null){
+		return false;
+	}
+	return ahci_transfer(drive, AHCI_OP_WRITE, lba, buff, len, AHCI_SLOT_MAX, AHCI_XFER_MAX, flags);
+}
+bool ahci_flush(uint64 idx){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	if (drive == null){
+		return false;
+	}
+	return ahci_transfer(drive, AHCI_OP_FLUSH, 0, null, 0, 1, AHCI_XFER_MAX, 0);
+}
 
+#if DEBUG == 1
+void ahci_list(){
+	ahci_table_t *table;
+	ahci_drive_t *drive;
+	uint64 i;
+	rcu_read_lock();
+	table = rcu_dereference(_ahci_dev);
+	for (i = 0; i < table->count; i ++){
+		debug_print(DC_WGR, "%d: port %d, type %x", i, table->dev[i].port, (uint64)table->dev[i].hba->ports[table->dev[i].port].sig);
+		drive = table->dev[i].drive;
+		if (drive != null){
+			debug_print(DC_WGR, "     Sectors: %d, NCQ: %d, slots: %d", drive->sectors, drive->ncq, (uint64)__builtin_popcount(drive->slots));
+			debug_print(DC_WGR, "     FUA: %d, FLUSH CACHE EXT: %d", (drive->ncq || drive->fua), drive->flush_ext);
+			debug_print(DC_WGR, "     Issued: %d, max depth: %d, errors: %d", drive->issued, drive->depth_max, drive->errors);
+			debug_print(DC_WGR, "     IRQ vector: %d (%s)", (int64)drive->ctrl->vector, (drive->ctrl->irq ? "MSI/MSI-X" : "polled"));
+		}
 	}
-	return false;
-}
\ No newline at end of file
+	rcu_read_unlock();
+}
+void ahci_bench(uint64 idx, uint64 len, uint64 depth){
+	ahci_drive_t *drive = ahci_get_drive(idx);
+	uint64 start;
+	uint64 t;
+	uint64 d;
+	uint64 pass;
+	uint64 offset;
+	uint64 size;
+	bool ok;
+	if (drive == null || depth == 0){
+		return;
+	}
+	if (len > drive->sectors * AHCI_SECTOR_SIZE){
+		len = drive->sectors * AHCI_SECTOR_SIZE;
+	}
+	len -= len % AHCI_XFER_FIT;
+	if (len == 0){
+		return;
+	}
+	for (pass = 0; pass < 2; pass ++){
+		d = (pass == 0 ? 1 : depth);
+		ok = true;
+		start = rdtsc();
+		// Buffer gets overwritten, only the throughput counts
+		for (offset = 0; offset < len && ok; offset += size){
+			size = (len - offset > sizeof(_ahci_bench_buff) ? sizeof(_ahci_bench_buff) : len - offset);
+			ok = ahci_transfer(drive, AHCI_OP_READ, offset / AHCI_SECTOR_SIZE, _ahci_bench_buff, size, d, AHCI_XFER_FIT, 0);
+		}
+		t = clock_tsc_to_ns(rdtsc() - start);
+		debug_print(DC_WB, "AHCI read %dKB, depth %d: %dMB/s%s", len / 1024, d, (t > 0 ? len * 1000 / t : 0), (ok ? "" : " (failed)"));
+	}
+	debug_print(DC_WB, "AHCI max depth reached: %d", drive->depth_max);
+}
+#endif
@@ -40,33 +40,139 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "common.h"
 #include "../config.h"
 
+#define AHCI_SECTOR_SIZE	512		// Logical sector size (bytes)
+#define AHCI_SLOT_MAX		32		// Command slots per port (NCQ tags)
+#define AHCI_CTRL_MAX		4		// Controllers with interrupt handlers
+#define AHCI_DRIVE_MAX		8		// Drives with driver state (command lists, tables)
+#define AHCI_PRDT_MAX		16		// PRDT entries per command table (keep a multiple of 8)
+#define AHCI_PRDT_BYTES_MAX	0x400000	// Bytes per PRDT entry (4MB)
+#define AHCI_XFER_MAX		(0x10000 * AHCI_SECTOR_SIZE)	// Largest request (ATA sector count limit, 32MB)
+#define AHCI_XFER_FIT		(PAGE_SIZE * AHCI_PRDT_MAX)	// Largest request that always fits the PRDT (buff offset in its page included)
+#define AHCI_TIMEOUT_NS		1000000000ULL	// Request timeout (1s)
+#define AHCI_FLUSH_TIMEOUT_NS	30000000000ULL	// Cache flush timeout (30s)
+
+// Request operations
+#define AHCI_OP_READ		0		// READ FPDMA QUEUED (READ DMA EXT without NCQ)
+#define AHCI_OP_IDENTIFY	1		// IDENTIFY DEVICE (not queued, 512 bytes)
+#define AHCI_OP_WRITE		2		// WRITE FPDMA QUEUED (WRITE DMA EXT without NCQ)
+#define AHCI_OP_FLUSH		3		// FLUSH CACHE EXT (not queued, no data, runs alone)
+
+// Request flags
+#define AHCI_FLAG_FUA		0x1		// Force Unit Access - write completes once it's on the media
+
+// Request states
+#define AHCI_REQ_IDLE		0		// Not submitted
+#define AHCI_REQ_PENDING	1		// Issued to the drive
+#define AHCI_REQ_DONE		2		// Completed
+#define AHCI_REQ_ERROR		3		// Failed (task file error, port error or timeout)
+
+struct ahci_req_struct;
+/**
+* Request completion callback
+* Called from the interrupt handler if the controller has MSI or MSI-X, otherwise
+* from ahci_poll() or a thread waiting in ahci_read()
+* @param req - completed request (can be reused or submitted again)
+*/
+typedef void (*ahci_done_t)(struct ahci_req_struct *req);
+/**
+* Request - owned by the caller and must stay valid until it completes
+*/
+struct ahci_req_struct {
+	uint8 op;					// AHCI_OP_*
+	uint8 flags;				// AHCI_FLAG_*
+	uint64 lba;					// Start sector
+	uint8 *buff;				// Data buffer (word aligned, mapped)
+	uint64 len;					// Number of bytes (multiple of AHCI_SECTOR_SIZE, up to AHCI_XFER_MAX)
+	ahci_done_t done;			// Completion callback (null to check status only)
+	void *data;					// Callback argument
+	uint64 volatile status;		// AHCI_REQ_*
+};
+typedef struct ahci_req_struct ahci_req_t;
+
 /**
 * Initialize AHCI driver
 * @return false if no AHCI controller has been found
 */
 bool ahci_init();
 /**
+* Start error recovery threads of controllers that signal completions by interrupts
+* Until then port resets run in the recovery tasklet
+*/
+void ahci_init_threads();
+/**
 * Get the number of AHCI devices connected
 * @return number of devices available
 */
 uint64 ahci_num_dev();
 /**
+* Get drive capacity
+* @param idx - device index in the device list
+* @return number of sectors (0 if it's not a SATA drive)
+*/
+uint64 ahci_sectors(uint64 idx);
+/**
+* Issue a request in a free command slot
+* Reads and writes use NCQ if both the HBA and the drive support it, so up to 32 requests run at once.
+* Queued requests can complete in any order. A flush is only issued once all the other slots are
+* free and nothing else is issued until it completes.
+* A buffer that spans up to AHCI_XFER_FIT bytes of pages always fits the PRDT, a longer one is
+* cut to whole sectors of what the PRDT can describe (req->len is updated).
+* @param idx - device index in the device list
+* @param req - request (op, flags, lba, buff, len, done and data filled in)
+* @return false if all the slots are busy, or the request is invalid (status set to AHCI_REQ_ERROR)
+*/
+bool ahci_submit(uint64 idx, ahci_req_t *req);
+/**
+* Complete finished requests (sets their status and calls their callbacks)
+* Only needed if the controller has no MSI or MSI-X, interrupts complete requests otherwise
+* @param idx - device index in the device list
+* @return number of requests completed
+*/
+uint64 ahci_poll(uint64 idx);
+/**
 * Read data from AHCI drive
+* Large reads are split into requests of up to AHCI_XFER_MAX (less if the buffer is physically
+* fragmented) that are queued together.
+* The calling thread sleeps until they complete (polls at boot, before interrupts are enabled).
 * @param idx - device index in the device list
+* @param lba - start sector
 * @param buff - byte buffer to write into
-* @param len - number of bytes to read
-* @todo implement
+* @param len - number of bytes to read (multiple of AHCI_SECTOR_SIZE)
 * @return false if read failed
 */
-bool ahci_read(uint64 idx, uint8 *buff, uint64 len);
+bool ahci_read(uint64 idx, uint64 lba, uint8 *buff, uint64 len);
 /**
 * Write data to AHCI drive
+* Large writes are split into requests of up to AHCI_XFER_MAX that are queued together, so a write
+* the drive only holds in its cache is not durable until ahci_flush() or AHCI_FLAG_FUA.
 * @param idx - device index in the device list
+* @param lba - start sector
 * @param buff - byte buffer to read from
-* @param len - number of bytes to write
-* @todo implement
+* @param len - number of bytes to write (multiple of AHCI_SECTOR_SIZE)
+* @param flags - AHCI_FLAG_* (FUA needs NCQ or WRITE DMA FUA EXT support)
 * @return false if write failed
 */
-bool ahci_write(uint64 idx, uint8 *buff, uint64 len);
+bool ahci_write(uint64 idx, uint64 lba, uint8 *buff, uint64 len, uint8 flags);
+/**
+* Flush the drive's write cache
+* Waits for the outstanding requests of other callers first, then commits every completed write
+* @param idx - device index in the device list
+* @return false if flush failed
+*/
+bool ahci_flush(uint64 idx);
+
+#if DEBUG == 1
+/**
+* List AHCI devices and queue statistics
+*/
+void ahci_list();
+/**
+* Measure read throughput at queue depth 1 and at the given depth
+* @param idx - device index in the device list
+* @param len - number of bytes to read from the start of the drive
+* @param depth - requests in flight (up to AHCI_SLOT_MAX)
+*/
+void ahci_bench(uint64 idx, uint64 len, uint64 depth);
+#endif
 
 #endif
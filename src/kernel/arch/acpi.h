@@ -262,6 +262,18 @@ struct LocalNMI_struct {
 	uint8 lint;
 } __PACKED;
 typedef struct LocalNMI_struct LocalNMI_t;
+/**
+* High Precision Event Timer Description Table structure
+*/
+struct HPET_struct {
+	SDTHeader_t h;
+	uint32 block_id;			// Event timer block ID (hardware revision, comparator count, vendor)
+	GAS_t address;				// Base address of event timer block
+	uint8 hpet_number;			// HPET sequence number
+	uint16 min_tick;			// Minimum clock ticks in periodic mode
+	uint8 page_protection;		// Page protection and OEM attributes
+} __PACKED;
+typedef struct HPET_struct HPET_t;
 
 /**
 * Initialize ACPI
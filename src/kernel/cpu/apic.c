@@ -38,6 +38,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "msr.h"
 #include "acpi.h"
 #include "paging.h"
+#include "tlb.h"
+#include "interrupts.h"
+#include "io.h"
 #if DEBUG == 1
 	#include "debug_print.h"
 #endif
@@ -63,17 +66,26 @@ static void lapic_init(){
 	pm_t pe;
 	uint64 i;
 	page_map_mmio(_lapic_addr);
+	tlb_batch_begin();
 	for (i = 0; i < 4; i ++){
 		pe = page_get_pml_entry(_lapic_addr, i);
 		pe.s.cache_disable = 1;
 		page_set_pml_entry(_lapic_addr, i, pe);
 	}
+	tlb_batch_end();
 
 	// Initialize Local APIC
 	uint32 val = apic_read_reg(APIC_LAPIC_VERSION);
 #if DEBUG == 1
 	debug_print(DC_WBL, "Version: %d", val);
 #endif
+	// Software-enable Local APIC (bit 8) and set the spurious interrupt vector,
+	// otherwise MSI and IPI messages are not delivered
+	apic_write_reg(APIC_SIVR, (apic_read_reg(APIC_SIVR) & 0xFFFFFF00) | 0x100 | INT_VECTOR_SPURIOUS);
+
+	// Mask legacy PIC - interrupts are delivered through APIC from now on
+	outb(0x21, 0xFF);
+	outb(0xA1, 0xFF);
 
 	// Initialize Other Local APICs if this is a bootstrap processor
 	if (apic.s.bsp){
@@ -99,11 +111,13 @@ static void ioapic_init(){
 		pm_t pe;
 		uint64 l;
 		page_map_mmio(ioapic_addr);
+		tlb_batch_begin();
 		for (l = 0; l < 4; l ++){
-			pe = page_get_pml_entry(ioapic_addr, i);
+			pe = page_get_pml_entry(ioapic_addr, l);
 			pe.s.cache_disable = 1;
-			page_set_pml_entry(ioapic_addr, i, pe);
+			page_set_pml_entry(ioapic_addr, l, pe);
 		}
+		tlb_batch_end();
 
 		// TODO: setup IRQs
 	}
@@ -168,6 +182,28 @@ void apic_write_reg(uint64 reg, uint32 value){
 	(*apic) = value;
 }
 
+void apic_eoi(){
+	apic_write_reg(APIC_EOIR, 0);
+}
+void apic_send_ipi(uint8 apic_id, uint8 vector){
+	// Wait for previous IPI to leave
+	while (apic_read_reg(APIC_ICR1) & APIC_ICR_PENDING){
+		asm volatile("pause");
+	}
+	apic_write_reg(APIC_ICR2, ((uint32)apic_id) << 24);
+	// Writing the low dword sends the IPI (fixed delivery, physical destination)
+	apic_write_reg(APIC_ICR1, APIC_ICR_ASSERT | vector);
+}
+uint64 apic_cpu_count(){
+	return _lapic_count;
+}
+uint8 apic_cpu_apic_id(uint64 cpu){
+	if (cpu < _lapic_count){
+		return _lapic[cpu]->apic_id;
+	}
+	return (uint8)(apic_read_reg(APIC_LAPIC_ID) >> 24);
+}
+
 uint32 apic_read_ioapic(uint64 addr, uint32 reg){
 	uint32 volatile *ioapic = (uint32 volatile *)(addr);
 	ioapic[0] = (reg & 0xFFFF);
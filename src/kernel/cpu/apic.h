@@ -90,6 +90,22 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define APIC_CURR_COUNT		0x0390 // Current Count Register (for Timer) (Read Only)
 #define APIC_DIV_CONF		0x03E0 // Divide Configuration Register (for Timer) (Read/Write)
 
+//
+// APIC Interrupt Command Register bits
+//
+
+#define APIC_ICR_ASSERT		0x4000 // Level assert (must be set for all but INIT de-assert)
+#define APIC_ICR_PENDING	0x1000 // Delivery status - send pending
+
+//
+// APIC Local Vector Table bits
+//
+
+#define APIC_LVT_MASKED			0x10000 // Interrupt masked
+#define APIC_LVT_PERIODIC		0x20000 // Timer mode - periodic
+#define APIC_LVT_TSC_DEADLINE	0x40000 // Timer mode - TSC deadline
+#define APIC_TIMER_DIV_16		0x3 // Timer divide configuration - divide by 16
+
 //
 // APIC entry types from ACPI MADT table
 //
@@ -150,6 +166,28 @@ uint32 apic_read_reg(uint64 reg);
 */
 void apic_write_reg(uint64 reg, uint32 value);
 
+/**
+* Signal End-Of-Interrupt to the Local APIC
+*/
+void apic_eoi();
+/**
+* Send a fixed Inter-Processor Interrupt
+* @param apic_id - destination Local APIC ID
+* @param vector - interrupt vector to raise on destination CPU
+*/
+void apic_send_ipi(uint8 apic_id, uint8 vector);
+/**
+* Get the number of enabled CPUs (Local APICs listed in MADT)
+* @return CPU count
+*/
+uint64 apic_cpu_count();
+/**
+* Get the Local APIC ID of a CPU
+* @param cpu - CPU index (0 - apic_cpu_count())
+* @return Local APIC ID (bootstrap processor's ID if index is out of bounds)
+*/
+uint8 apic_cpu_apic_id(uint64 cpu);
+
 /**
 * Read IOAPIC value
 * @param addr - APIC base address
@@ -0,0 +1,201 @@
+/*
+
+CPU feature registry
+====================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "cpufeature.h"
+#include "cpuid.h"
+#include "lib.h"
+#include "crc.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+/**
+* Bound routine record
+*/
+struct cpu_binding_struct {
+	char *name;
+	cpu_impl_t *impl;
+};
+typedef struct cpu_binding_struct cpu_binding_t;
+
+uint64 cpu_features = 0;
+
+static cpu_binding_t _bindings[CPU_DISPATCH_MAX];
+static uint64 _binding_count = 0;
+
+/**
+* Memory copy implementations
+*/
+static cpu_impl_t _mem_copy_impls[] = {
+	{(void *)mem_copy_movsb, CPU_FEATURE_FSRM, "movsb-fsrm"},
+	{(void *)mem_copy_movsb, CPU_FEATURE_ERMS, "movsb-erms"},
+	{(void *)mem_copy_movsq, 0, "movsq"}
+};
+/**
+* CRC-32C implementations
+*/
+static cpu_impl_t _crc32c_impls[] = {
+	{(void *)crc32c_sse42, CPU_FEATURE_SSE42, "sse4.2"},
+	{(void *)crc32c_table, 0, "table"}
+};
+
+#if DEBUG == 1
+/**
+* Feature names (bit order)
+*/
+static char *_names[CPU_FEATURE_COUNT] = {
+	"sse2", "sse3", "ssse3", "sse4.1", "sse4.2", "popcnt", "pclmul", "avx",
+	"fma", "avx2", "avx512f", "avx512bw", "avx512vl", "bmi1", "bmi2", "erms",
+	"fsrm", "xsave", "xsaveopt", "xsavec", "xsaves", "invtsc", "tsc-deadline", "rdtscp",
+	"x2apic", "pcid", "invpcid", "monitor", "waitpkg", "clflushopt", "smep", "smap",
+	"nx", "1gb-pages", "rdrand", "rdseed", "hypervisor", "arat"
+};
+#endif
+
+/**
+* Set a feature bit if a CPUID register bit is set
+*/
+static void cpu_feature_set(uint32 reg, uint8 bit, uint64 feature){
+	if (reg & (1U << bit)){
+		cpu_features |= feature;
+	}
+}
+
+void cpu_feature_init(){
+	uint32 eax, ebx, ecx, edx;
+	uint32 max;
+	uint32 max_ext;
+	cpu_features = 0;
+	cpuid(0, &max, &ebx, &ecx, &edx);
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	cpu_feature_set(edx, 26, CPU_FEATURE_SSE2);
+	cpu_feature_set(ecx, 0, CPU_FEATURE_SSE3);
+	cpu_feature_set(ecx, 1, CPU_FEATURE_PCLMUL);
+	cpu_feature_set(ecx, 3, CPU_FEATURE_MONITOR);
+	cpu_feature_set(ecx, 9, CPU_FEATURE_SSSE3);
+	cpu_feature_set(ecx, 12, CPU_FEATURE_FMA);
+	cpu_feature_set(ecx, 17, CPU_FEATURE_PCID);
+	cpu_feature_set(ecx, 19, CPU_FEATURE_SSE41);
+	cpu_feature_set(ecx, 20, CPU_FEATURE_SSE42);
+	cpu_feature_set(ecx, 21, CPU_FEATURE_X2APIC);
+	cpu_feature_set(ecx, 23, CPU_FEATURE_POPCNT);
+	cpu_feature_set(ecx, 24, CPU_FEATURE_TSC_DEADLINE);
+	cpu_feature_set(ecx, 26, CPU_FEATURE_XSAVE);
+	cpu_feature_set(ecx, 28, CPU_FEATURE_AVX);
+	cpu_feature_set(ecx, 30, CPU_FEATURE_RDRAND);
+	cpu_feature_set(ecx, 31, CPU_FEATURE_HYPERVISOR);
+	if (max >= 7){
+		cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+		cpu_feature_set(ebx, 3, CPU_FEATURE_BMI1);
+		cpu_feature_set(ebx, 5, CPU_FEATURE_AVX2);
+		cpu_feature_set(ebx, 7, CPU_FEATURE_SMEP);
+		cpu_feature_set(ebx, 8, CPU_FEATURE_BMI2);
+		cpu_feature_set(ebx, 9, CPU_FEATURE_ERMS);
+		cpu_feature_set(ebx, 10, CPU_FEATURE_INVPCID);
+		cpu_feature_set(ebx, 16, CPU_FEATURE_AVX512F);
+		cpu_feature_set(ebx, 18, CPU_FEATURE_RDSEED);
+		cpu_feature_set(ebx, 20, CPU_FEATURE_SMAP);
+		cpu_feature_set(ebx, 23, CPU_FEATURE_CLFLUSHOPT);
+		cpu_feature_set(ebx, 30, CPU_FEATURE_AVX512BW);
+		cpu_feature_set(ebx, 31, CPU_FEATURE_AVX512VL);
+		cpu_feature_set(ecx, 5, CPU_FEATURE_WAITPKG);
+		cpu_feature_set(edx, 4, CPU_FEATURE_FSRM);
+	}
+	if (max >= 6){
+		cpuid(6, &eax, &ebx, &ecx, &edx);
+		cpu_feature_set(eax, 2, CPU_FEATURE_ARAT);
+	}
+	if (max >= 0xD && cpu_has(CPU_FEATURE_XSAVE)){
+		cpuid_count(0xD, 1, &eax, &ebx, &ecx, &edx);
+		cpu_feature_set(eax, 0, CPU_FEATURE_XSAVEOPT);
+		cpu_feature_set(eax, 1, CPU_FEATURE_XSAVEC);
+		cpu_feature_set(eax, 3, CPU_FEATURE_XSAVES);
+	}
+	cpuid(0x80000000, &max_ext, &ebx, &ecx, &edx);
+	if (max_ext >= 0x80000001){
+		cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+		cpu_feature_set(edx, 20, CPU_FEATURE_NX);
+		cpu_feature_set(edx, 26, CPU_FEATURE_PAGE1GB);
+		cpu_feature_set(edx, 27, CPU_FEATURE_RDTSCP);
+	}
+	if (max_ext >= 0x80000007){
+		cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+		cpu_feature_set(edx, 8, CPU_FEATURE_TSC_INVARIANT);
+	}
+	// Library routines
+	cpu_dispatch("mem_copy", (void **)&mem_copy, _mem_copy_impls, sizeof(_mem_copy_impls) / sizeof(cpu_impl_t));
+	cpu_dispatch("crc32c", (void **)&crc32c, _crc32c_impls, sizeof(_crc32c_impls) / sizeof(cpu_impl_t));
+}
+cpu_impl_t *cpu_dispatch(char *name, void **slot, cpu_impl_t *impls, uint64 count){
+	uint64 i;
+	for (i = 0; i < count; i ++){
+		if (cpu_has(impls[i].requires)){
+			*slot = impls[i].func;
+			if (_binding_count < CPU_DISPATCH_MAX){
+				_bindings[_binding_count].name = name;
+				_bindings[_binding_count].impl = &impls[i];
+				_binding_count ++;
+			}
+			return &impls[i];
+		}
+	}
+	return null;
+}
+
+#if DEBUG == 1
+void cpu_feature_list(){
+	char line[80];
+	uint64 len = 0;
+	uint64 i;
+	for (i = 0; i < CPU_FEATURE_COUNT; i ++){
+		if (cpu_features & (1ULL << i)){
+			if (len + str_length(_names[i]) + 1 >= sizeof(line)){
+				debug_print(DC_WB, line);
+				len = 0;
+			}
+			len += str_copy(line + len, sizeof(line) - len, _names[i]);
+			line[len ++] = ' ';
+			line[len] = 0;
+		}
+	}
+	if (len > 0){
+		debug_print(DC_WB, line);
+	}
+	for (i = 0; i < _binding_count; i ++){
+		debug_print(DC_WB, "%s: %s", _bindings[i].name, _bindings[i].impl->name);
+	}
+}
+#endif
@@ -0,0 +1,132 @@
+/*
+
+CPU feature registry
+====================
+
+Features are read from CPUID once at boot. Routines with CPU specific versions
+(memory copy, checksums, DSP kernels, idle) are called through a pointer that
+is bound to the best version once, so calls don't test features.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __cpufeature_h
+#define __cpufeature_h
+
+#include "common.h"
+#include "../config.h"
+
+// Feature bits (CPU support, SIMD still needs OS state, see fpu.h)
+#define CPU_FEATURE_SSE2			(1ULL << 0)
+#define CPU_FEATURE_SSE3			(1ULL << 1)
+#define CPU_FEATURE_SSSE3			(1ULL << 2)
+#define CPU_FEATURE_SSE41			(1ULL << 3)
+#define CPU_FEATURE_SSE42			(1ULL << 4)
+#define CPU_FEATURE_POPCNT			(1ULL << 5)
+#define CPU_FEATURE_PCLMUL			(1ULL << 6)
+#define CPU_FEATURE_AVX				(1ULL << 7)
+#define CPU_FEATURE_FMA				(1ULL << 8)
+#define CPU_FEATURE_AVX2			(1ULL << 9)
+#define CPU_FEATURE_AVX512F			(1ULL << 10)
+#define CPU_FEATURE_AVX512BW		(1ULL << 11)
+#define CPU_FEATURE_AVX512VL		(1ULL << 12)
+#define CPU_FEATURE_BMI1			(1ULL << 13)
+#define CPU_FEATURE_BMI2			(1ULL << 14)
+#define CPU_FEATURE_ERMS			(1ULL << 15)	// Enhanced REP MOVSB/STOSB
+#define CPU_FEATURE_FSRM			(1ULL << 16)	// Fast short REP MOVSB
+#define CPU_FEATURE_XSAVE			(1ULL << 17)
+#define CPU_FEATURE_XSAVEOPT		(1ULL << 18)
+#define CPU_FEATURE_XSAVEC			(1ULL << 19)
+#define CPU_FEATURE_XSAVES			(1ULL << 20)
+#define CPU_FEATURE_TSC_INVARIANT	(1ULL << 21)
+#define CPU_FEATURE_TSC_DEADLINE	(1ULL << 22)
+#define CPU_FEATURE_RDTSCP			(1ULL << 23)
+#define CPU_FEATURE_X2APIC			(1ULL << 24)
+#define CPU_FEATURE_PCID			(1ULL << 25)
+#define CPU_FEATURE_INVPCID			(1ULL << 26)
+#define CPU_FEATURE_MONITOR			(1ULL << 27)	// MONITOR/MWAIT
+#define CPU_FEATURE_WAITPKG			(1ULL << 28)	// UMONITOR/UMWAIT/TPAUSE
+#define CPU_FEATURE_CLFLUSHOPT		(1ULL << 29)
+#define CPU_FEATURE_SMEP			(1ULL << 30)
+#define CPU_FEATURE_SMAP			(1ULL << 31)
+#define CPU_FEATURE_NX				(1ULL << 32)
+#define CPU_FEATURE_PAGE1GB			(1ULL << 33)
+#define CPU_FEATURE_RDRAND			(1ULL << 34)
+#define CPU_FEATURE_RDSEED			(1ULL << 35)
+#define CPU_FEATURE_HYPERVISOR		(1ULL << 36)
+#define CPU_FEATURE_ARAT			(1ULL << 37)	// APIC timer keeps running in deep C-states
+#define CPU_FEATURE_COUNT			38
+// Maximum number of bound routines (for cpu_feature_list())
+#define CPU_DISPATCH_MAX			16
+
+/**
+* Implementation candidate of a routine
+*/
+struct cpu_impl_struct {
+	void *func;					// Function
+	uint64 requires;			// CPU_FEATURE_* bits it needs (0 - runs anywhere)
+	char *name;					// Implementation name
+};
+typedef struct cpu_impl_struct cpu_impl_t;
+
+/**
+* Features of the bootstrap processor (set by cpu_feature_init())
+*/
+extern uint64 cpu_features;
+
+/**
+* Check CPU features
+* @param features - CPU_FEATURE_* bits
+* @return true if all of them are supported
+*/
+static bool cpu_has(uint64 features){
+	return ((cpu_features & features) == features);
+}
+/**
+* Read CPU features and bind library routines (memory copy, CRC)
+*/
+void cpu_feature_init();
+/**
+* Bind a routine to the first supported implementation
+* @param name - routine name
+* @param [out] slot - function pointer callers call through
+* @param impls - candidates, best first (the last one should require nothing)
+* @param count - number of candidates
+* @return bound implementation or null if none is supported (slot is left as it was)
+*/
+cpu_impl_t *cpu_dispatch(char *name, void **slot, cpu_impl_t *impls, uint64 count);
+#if DEBUG == 1
+/**
+* List CPU features and bound routines on screen
+*/
+void cpu_feature_list();
+#endif
+
+#endif /* __cpufeature_h */
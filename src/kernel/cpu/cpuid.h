@@ -49,7 +49,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 * @return void
 */
 static void cpuid(uint32 type, uint32 *eax, uint32 *ebx, uint32 *ecx, uint32 *edx){
-   asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(type));
+   asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(type), "c"(0));
+}
+/**
+* Read CPUID sub-leaf
+* @param type - initial EAX value (information type to get from CPUID)
+* @param sub - initial ECX value (sub-leaf index)
+* @param [out] eax - EAX value returned by CPUID
+* @param [out] ebx - EBX value returned by CPUID
+* @param [out] ecx - ECX value returned by CPUID
+* @param [out] edx - EDX value returned by CPUID
+* @return void
+*/
+static void cpuid_count(uint32 type, uint32 sub, uint32 *eax, uint32 *ebx, uint32 *ecx, uint32 *edx){
+   asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(type), "c"(sub));
 }
 
 #endif
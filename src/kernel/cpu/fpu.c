@@ -0,0 +1,391 @@
+/*
+
+FPU and SIMD state
+==================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "fpu.h"
+#include "percpu.h"
+#include "preempt.h"
+#include "cpuid.h"
+#include "cpufeature.h"
+#include "irqstat.h"
+#include "sched.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "sync.h"
+	#include "clock.h"
+	#include "msr.h"
+	#include "debug_print.h"
+#endif
+
+// Control register bits
+#define CR0_MP				0x2
+#define CR0_EM				0x4
+#define CR0_TS				0x8
+#define CR4_OSFXSR			0x200
+#define CR4_OSXMMEXCPT		0x400
+#define CR4_OSXSAVE			0x40000
+// XCR0 components
+#define XCR0_X87			0x1
+#define XCR0_SSE			0x2
+#define XCR0_AVX			0x4
+#define XCR0_AVX512			0xE0		// Opmask, upper halves of ZMM0-15, ZMM16-31
+// Legacy region fields of the save area
+#define FPU_FCW_OFFSET		0
+#define FPU_MXCSR_OFFSET	24
+#define FPU_FCW_INIT		0x37F
+#define FPU_MXCSR_INIT		0x1F80
+
+static uint8 _areas[SCHED_THREAD_MAX][FPU_AREA_MAX] __ALIGN(64);
+static uint64 _mode = FPU_MODE_EAGER;
+static uint64 _xcr0 = 0;
+static uint64 _size = 512;
+static bool _xsave = false;
+static bool _xsaveopt = false;
+#if DEBUG == 1
+static uint64 _traps = 0;
+#endif
+
+static void fpu_clts(){
+	asm volatile("clts");
+}
+static void fpu_stts(){
+	uint64 cr0;
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+/**
+* Save FPU registers (TS must be clear)
+* @param area - 64 byte aligned save area
+*/
+static void fpu_save(uint8 *area){
+	if (_xsaveopt){
+		// Skips components that are in init state or unmodified since the last XRSTOR of this area
+		asm volatile("xsaveopt64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	} else if (_xsave){
+		asm volatile("xsave64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	} else {
+		asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+	}
+}
+/**
+* Load FPU registers (TS must be clear)
+* @param area - 64 byte aligned save area
+*/
+static void fpu_restore(uint8 *area){
+	if (_xsave){
+		asm volatile("xrstor64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	} else {
+		asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+	}
+}
+/**
+* Make the registers hold a thread's state (TS must be clear)
+* @param cpu - calling CPU
+* @param thread - new owner
+*/
+static void fpu_take(percpu_t *cpu, thread_t *thread){
+	thread_t *owner = (thread_t *)cpu->fpu_owner;
+	if (owner == thread){
+		return;
+	}
+	if (owner != null){
+		fpu_save(owner->fpu);
+	}
+	fpu_restore(thread->fpu);
+	cpu->fpu_owner = thread;
+}
+
+void fpu_init(uint64 mode){
+	uint32 eax, ebx, ecx, edx;
+	_xsave = cpu_has(CPU_FEATURE_XSAVE);
+	if (_xsave){
+		// Components the CPU supports and the save area can hold
+		cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx);
+		_xcr0 = eax & (XCR0_X87 | XCR0_SSE | XCR0_AVX);
+		if ((eax & XCR0_AVX512) == XCR0_AVX512 && ecx <= FPU_AREA_MAX){
+			_xcr0 |= XCR0_AVX512;
+		}
+		_xsaveopt = cpu_has(CPU_FEATURE_XSAVEOPT);
+	}
+	_mode = mode;
+	fpu_init_cpu();
+	if (_xsave){
+		// Size of the components enabled in XCR0
+		cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx);
+		_size = ebx;
+	}
+}
+void fpu_init_cpu(){
+	uint64 cr0;
+	uint64 cr4;
+	asm volatile("mov %%cr0, %0" : "=r"(cr0));
+	cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP;
+	asm volatile("mov %0, %%cr0" : : "r"(cr0));
+	asm volatile("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+	if (_xsave){
+		cr4 |= CR4_OSXSAVE;
+	}
+	asm volatile("mov %0, %%cr4" : : "r"(cr4));
+	if (_xsave){
+		asm volatile("xsetbv" : : "c"(0), "a"((uint32)_xcr0), "d"((uint32)(_xcr0 >> 32)));
+	}
+	asm volatile("fninit");
+	percpu_this()->fpu_owner = null;
+	if (_mode == FPU_MODE_LAZY){
+		fpu_stts();
+	}
+}
+void fpu_set_mode(uint64 mode){
+	percpu_t *cpu = percpu_this();
+	thread_t *t = thread_current();
+	uint64 flags;
+	asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+	if (flags & 0x200){
+		irqstat_off_begin();
+	}
+	_mode = mode;
+	// Both modes continue from the same state: registers hold the current thread's state
+	fpu_clts();
+	if (t != null && t->fpu != null){
+		fpu_take(cpu, t);
+	}
+	if (flags & 0x200){
+		irqstat_off_end();
+		asm volatile("sti" : : : "memory");
+	}
+}
+uint64 fpu_area_size(){
+	return _size;
+}
+void fpu_thread_init(thread_t *thread){
+	uint8 *area = _areas[thread->id];
+	percpu_t *cpu = percpu_this();
+	if (cpu->fpu_owner == thread){
+		cpu->fpu_owner = null;
+	}
+	// Header with XSTATE_BV = 0 makes XRSTOR load init state of every component
+	mem_fill(area, _size, 0);
+	*(uint16 *)(area + FPU_FCW_OFFSET) = FPU_FCW_INIT;
+	*(uint32 *)(area + FPU_MXCSR_OFFSET) = FPU_MXCSR_INIT;
+	thread->fpu = area;
+}
+void fpu_thread_exit(thread_t *thread){
+	percpu_t *cpu = percpu_this();
+	if (cpu->fpu_owner == thread){
+		cpu->fpu_owner = null;
+	}
+}
+void fpu_thread_save(thread_t *thread){
+	percpu_t *cpu = percpu_this();
+	uint64 flags;
+	asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+	if (flags & 0x200){
+		irqstat_off_begin();
+	}
+	if (cpu->fpu_owner == thread){
+		fpu_clts();
+		fpu_save(thread->fpu);
+		cpu->fpu_owner = null;
+		if (_mode == FPU_MODE_LAZY){
+			// Running thread doesn't own the registers, its next FPU instruction has to trap
+			fpu_stts();
+		}
+	}
+	if (flags & 0x200){
+		irqstat_off_end();
+		asm volatile("sti" : : : "memory");
+	}
+}
+void fpu_switch(thread_t *next){
+	percpu_t *cpu = percpu_this();
+	if (next->fpu == null || cpu->fpu_kernel){
+		// Idle thread never touches the registers, whoever owns them keeps them
+		return;
+	}
+	if (_mode == FPU_MODE_EAGER){
+		fpu_take(cpu, next);
+	} else if (cpu->fpu_owner == next){
+		fpu_clts();
+	} else {
+		fpu_stts();
+	}
+}
+bool fpu_trap(){
+	percpu_t *cpu = percpu_this();
+	thread_t *t = thread_current();
+	fpu_clts();
+#if DEBUG == 1
+	_traps ++;
+#endif
+	if (t != null && t->fpu != null && !cpu->fpu_kernel){
+		fpu_take(cpu, t);
+	}
+	return true;
+}
+void kernel_fpu_begin(){
+	percpu_t *cpu;
+	thread_t *owner;
+	uint64 flags;
+	preempt_disable();
+	cpu = percpu_this();
+#if DEBUG == 1
+	if (cpu->fpu_kernel){
+		debug_print(DC_WRD, "Nested kernel_fpu_begin()");
+	}
+#endif
+	asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+	if (flags & 0x200){
+		irqstat_off_begin();
+	}
+	fpu_clts();
+	owner = (thread_t *)cpu->fpu_owner;
+	if (owner != null){
+		fpu_save(owner->fpu);
+		cpu->fpu_owner = null;
+	}
+	cpu->fpu_kernel = true;
+	if (flags & 0x200){
+		irqstat_off_end();
+		asm volatile("sti" : : : "memory");
+	}
+}
+void kernel_fpu_end(){
+	percpu_t *cpu = percpu_this();
+	thread_t *t = thread_current();
+	uint64 flags;
+	asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+	if (flags & 0x200){
+		irqstat_off_begin();
+	}
+	cpu->fpu_kernel = false;
+	if (_mode == FPU_MODE_EAGER && t != null && t->fpu != null){
+		fpu_take(cpu, t);
+	} else {
+		// Thread gets its state back on its next FPU instruction
+		fpu_stts();
+	}
+	if (flags & 0x200){
+		irqstat_off_end();
+		asm volatile("sti" : : : "memory");
+	}
+	preempt_enable();
+}
+bool kernel_fpu_usable(){
+	return !percpu_this()->fpu_kernel;
+}
+
+#if DEBUG == 1
+/**
+* Benchmark state
+*/
+static struct {
+	sem_t done;
+	uint64 loops;
+	bool simd;
+	uint64 errors;
+} _bench;
+
+/**
+* Ping-pong thread - keeps a value in XMM0 across switches
+*/
+static void fpu_bench_thread(void *arg){
+	uint64 id = (uint64)arg;
+	uint64 v;
+	uint64 i;
+	for (i = 0; i < _bench.loops; i ++){
+		if (_bench.simd){
+			v = (id << 32) | i;
+			asm volatile("movq %0, %%xmm0" : : "r"(v));
+		}
+		thread_yield();
+		if (_bench.simd){
+			asm volatile("movq %%xmm0, %0" : "=r"(v));
+			if (v != ((id << 32) | i)){
+				_bench.errors ++;
+			}
+		}
+	}
+	sem_post(&_bench.done);
+}
+/**
+* Run two threads that switch to each other
+* @return average switch time (ns)
+*/
+static uint64 fpu_bench_run(uint64 mode, bool simd){
+	uint64 start;
+	uint64 t;
+	fpu_set_mode(mode);
+	_bench.simd = simd;
+	start = rdtsc();
+	// Both have to be queued before the first one runs
+	preempt_disable();
+	thread_create("fpu", fpu_bench_thread, (void *)1, SCHED_RT, 60);
+	thread_create("fpu", fpu_bench_thread, (void *)2, SCHED_RT, 60);
+	preempt_enable();
+	sem_wait(&_bench.done);
+	sem_wait(&_bench.done);
+	t = rdtsc() - start;
+	return clock_tsc_to_ns(t) / (_bench.loops * 2);
+}
+void fpu_bench(uint64 loops){
+	uint64 old = _mode;
+	uint64 traps;
+	uint64 start;
+	uint64 t;
+	uint64 i;
+	if (loops == 0){
+		return;
+	}
+	sem_init(&_bench.done, 0);
+	_bench.loops = loops;
+	_bench.errors = 0;
+	debug_print(DC_WB, "FPU: %s, XCR0 %x, save area %d bytes", (_xsaveopt ? "XSAVEOPT" : (_xsave ? "XSAVE" : "FXSAVE")), _xcr0, _size);
+	debug_print(DC_WB, "Eager, SIMD threads: %dns per switch", fpu_bench_run(FPU_MODE_EAGER, true));
+	debug_print(DC_WB, "Eager, integer threads: %dns per switch", fpu_bench_run(FPU_MODE_EAGER, false));
+	traps = _traps;
+	debug_print(DC_WB, "Lazy, SIMD threads: %dns per switch (%d traps)", fpu_bench_run(FPU_MODE_LAZY, true), _traps - traps);
+	debug_print(DC_WB, "Lazy, integer threads: %dns per switch", fpu_bench_run(FPU_MODE_LAZY, false));
+	debug_print(DC_WB, "State corrupted %d times", _bench.errors);
+	start = rdtsc();
+	for (i = 0; i < loops; i ++){
+		kernel_fpu_begin();
+		kernel_fpu_end();
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "kernel_fpu_begin/end: %dns", clock_tsc_to_ns(t) / loops);
+	fpu_set_mode(old);
+}
+#endif
@@ -0,0 +1,120 @@
+/*
+
+FPU and SIMD state
+==================
+
+Saves and restores x87/SSE/AVX state of threads with XSAVE (FXSAVE on older
+CPUs). Eager mode switches the state together with the thread, lazy mode
+sets CR0.TS and switches it on the first FPU instruction (#NM).
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __fpu_h
+#define __fpu_h
+
+#include "common.h"
+#include "../config.h"
+
+// Context switching modes
+#define FPU_MODE_EAGER		0	// Save and restore on every switch between FPU using threads
+#define FPU_MODE_LAZY		1	// Restore on the first FPU instruction after a switch (#NM trap)
+// Save area size reserved per thread (XSAVE components that don't fit are not enabled)
+#define FPU_AREA_MAX		4096
+
+struct thread_struct;
+
+/**
+* Enable FPU, SSE and XSAVE features on the bootstrap processor and size the save area
+* @param mode - FPU_MODE_*
+*/
+void fpu_init(uint64 mode);
+/**
+* Enable the same features on the calling CPU
+*/
+void fpu_init_cpu();
+/**
+* Change context switching mode (only while a single CPU runs threads)
+* @param mode - FPU_MODE_*
+*/
+void fpu_set_mode(uint64 mode);
+/**
+* Get save area size
+* @return size in bytes
+*/
+uint64 fpu_area_size();
+/**
+* Give a thread a clean save area
+* @param thread - new thread
+*/
+void fpu_thread_init(struct thread_struct *thread);
+/**
+* Forget state of an exiting thread
+* @param thread - exiting thread
+*/
+void fpu_thread_exit(struct thread_struct *thread);
+/**
+* Write a thread's state back to its save area if the calling CPU's registers hold it
+* (before the thread is moved to another CPU)
+* @param thread - queued thread (not the running one)
+*/
+void fpu_thread_save(struct thread_struct *thread);
+/**
+* Switch FPU state to the next thread (called by the scheduler with interrupts disabled)
+* @param next - thread being switched in
+*/
+void fpu_switch(struct thread_struct *next);
+/**
+* Device not available (#NM) exception handler
+* @return true if handled
+*/
+bool fpu_trap();
+/**
+* Start using FPU/SIMD registers in kernel code (disables preemption, not nestable)
+*/
+void kernel_fpu_begin();
+/**
+* Stop using FPU/SIMD registers in kernel code
+*/
+void kernel_fpu_end();
+/**
+* Check whether kernel_fpu_begin() can be called (e.g. from an interrupt handler)
+* @return true if no kernel FPU section is active on this CPU
+*/
+bool kernel_fpu_usable();
+#if DEBUG == 1
+/**
+* Measure context switch cost with eager and lazy switching
+* @param loops - number of switches per run
+*/
+void fpu_bench(uint64 loops);
+#endif
+
+#endif /* __fpu_h */
@@ -0,0 +1,82 @@
+/*
+
+Global Descriptor Table
+=======================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "gdt.h"
+#include "percpu.h"
+#include "lib.h"
+
+static uint64 _gdt[CPU_MAX][GDT_ENTRIES] __ALIGN(16);
+static tss_t _tss[CPU_MAX] __ALIGN(16);
+
+void gdt_init_cpu(){
+	percpu_t *cpu = percpu_this();
+	uint64 *gdt = _gdt[cpu->id];
+	tss_t *tss = &_tss[cpu->id];
+	uint64 base = (uint64)tss;
+	uint64 limit = sizeof(tss_t) - 1;
+	gdt_ptr_t ptr;
+	mem_fill((uint8 *)tss, sizeof(tss_t), 0);
+	tss->iomap_base = sizeof(tss_t);
+	gdt[0] = 0;
+	gdt[1] = 0x00AF9A000000FFFFULL;		// Kernel code: 64-bit, DPL 0
+	gdt[2] = 0x00CF92000000FFFFULL;		// Kernel data: DPL 0
+	gdt[3] = 0x00CFF2000000FFFFULL;		// User data: DPL 3
+	gdt[4] = 0x00AFFA000000FFFFULL;		// User code: 64-bit, DPL 3
+	// Available 64-bit TSS
+	gdt[5] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | (0x89ULL << 40) | (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+	gdt[6] = (base >> 32);
+	ptr.limit = sizeof(uint64) * GDT_ENTRIES - 1;
+	ptr.base = (uint64)gdt;
+	// Reload CS with a far return, FS and GS are left alone - loading them would reset GS base
+	asm volatile(
+		"lgdt %0\n\t"
+		"pushq %1\n\t"
+		"leaq 1f(%%rip), %%rax\n\t"
+		"pushq %%rax\n\t"
+		"lretq\n"
+		"1:\n\t"
+		"movw %2, %%ax\n\t"
+		"movw %%ax, %%ds\n\t"
+		"movw %%ax, %%es\n\t"
+		"movw %%ax, %%ss\n\t"
+		"ltr %w3"
+		: : "m"(ptr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA), "r"((uint64)GDT_TSS) : "rax", "memory");
+}
+void gdt_set_kernel_stack(uint64 rsp){
+	percpu_t *cpu = percpu_this();
+	_tss[cpu->id].rsp0 = rsp;
+	cpu->kernel_rsp = rsp;
+}
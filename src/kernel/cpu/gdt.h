@@ -0,0 +1,87 @@
+/*
+
+Global Descriptor Table
+=======================
+
+Per-CPU GDT with kernel and user segments and a Task State Segment. Segment
+order is fixed by SYSCALL/SYSRET (see STAR MSR in syscall.c).
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __gdt_h
+#define __gdt_h
+
+#include "common.h"
+
+// Segment selectors
+#define GDT_KERNEL_CODE		0x08
+#define GDT_KERNEL_DATA		0x10
+#define GDT_USER_DATA		0x1B	// 0x18 | RPL 3
+#define GDT_USER_CODE		0x23	// 0x20 | RPL 3
+#define GDT_TSS				0x28
+// Number of 8 byte entries (TSS descriptor takes two)
+#define GDT_ENTRIES			7
+
+/**
+* Task State Segment (64-bit)
+*/
+struct tss_struct {
+	uint32 reserved0;
+	uint64 rsp0;				// Stack loaded on interrupts from user mode
+	uint64 rsp1;
+	uint64 rsp2;
+	uint64 reserved1;
+	uint64 ist[7];				// Interrupt stack table
+	uint64 reserved2;
+	uint16 reserved3;
+	uint16 iomap_base;			// Offset of the I/O permission bitmap (beyond limit - none)
+} __PACKED;
+typedef struct tss_struct tss_t;
+/**
+* GDT pointer structure
+*/
+struct gdt_ptr_struct {
+	uint16 limit;
+	uint64 base;
+} __PACKED;
+typedef struct gdt_ptr_struct gdt_ptr_t;
+
+/**
+* Load GDT and TSS of the calling CPU (replaces the one set up by the loader)
+*/
+void gdt_init_cpu();
+/**
+* Set the kernel stack used on entry from user mode (TSS RSP0 and SYSCALL stack)
+* @param rsp - top of the stack (16 byte aligned)
+*/
+void gdt_set_kernel_stack(uint64 rsp);
+
+#endif /* __gdt_h */
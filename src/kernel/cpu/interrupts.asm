@@ -39,7 +39,54 @@
 [bits 64]
 [extern isr_handler]							; Import int_handler from C
 [extern irq_handler]							; Import irq_handler from C
+[extern vector_handler]							; Import vector_handler from C
 [global idt_set]								; Export void idt_set(idt_ptr_t *idt) to C
+[global int_vectors]							; Export stub address table of vectors 48-255 to C
+
+; Macro to push all the registers
+%macro PUSH_ALL 0
+	push r15
+	push r14
+	push r13
+	push r12
+	push r11
+	push r10
+	push r9
+	push r8
+	push rsi
+	push rdi
+	push rdx
+	push rcx
+	push rbx
+	push rax
+%endmacro
+
+; Macro to pop all the registers
+%macro POP_ALL 0
+	pop rax
+	pop rbx
+	pop rcx
+	pop rdx
+	pop rdi
+	pop rsi
+	pop r8
+	pop r9
+	pop r10
+	pop r11
+	pop r12
+	pop r13
+	pop r14
+	pop r15
+%endmacro
+
+; Macro to switch to kernel GS base if the interrupt came from user mode (checks CS on the frame)
+; Must be used right after PUSH_ALL and right before POP_ALL
+%macro SWAPGS_IF_USER 0
+	test qword [rsp + 144], 3					; int_stack_t.cs
+	jz %%kernel
+	swapgs
+%%kernel:
+%endmacro
 
 ; Macro to create an intterupt service routine for interrupts that do not pass error codes 
 %macro INT_NO_ERR 1
@@ -48,8 +95,15 @@ isr%1:
 	cli											; disable interrupts
 	push qword 0								; set error code to 0
 	push qword %1								; set interrupt number
-	call isr_handler							; call void isr_handler(int_stack_t args)
-	sti											; enable interrupts
+	push rbp									; push current rbp
+	PUSH_ALL									; push all the registers on the stack
+	SWAPGS_IF_USER
+	mov rbp, rsp								; store current stack frame in rbp
+	mov rdi, rsp								; pass our stack as a pointer to the handler
+	call isr_handler							; call void isr_handler(int_stack_t *stack)
+	SWAPGS_IF_USER
+	POP_ALL										; pop all the registers back from the stack
+	pop rbp										; get our rbp back from the stack
 	add rsp, 16									; cleanup stack
 	iretq										; return from interrupt handler
 %endmacro
@@ -60,8 +114,15 @@ isr%1:
 isr%1:
 	cli											; disable interrupts
 	push qword %1								; set interrupt number
-	call isr_handler							; call void isr_handler(int_stack_t args)
-	sti											; enable interrupts
+	push rbp									; push current rbp
+	PUSH_ALL									; push all the registers on the stack
+	SWAPGS_IF_USER
+	mov rbp, rsp								; store current stack frame in rbp
+	mov rdi, rsp								; pass our stack as a pointer to the handler
+	call isr_handler							; call void isr_handler(int_stack_t *stack)
+	SWAPGS_IF_USER
+	POP_ALL										; pop all the registers back from the stack
+	pop rbp										; get our rbp back from the stack
 	add rsp, 16									; cleanup stack
 	iretq										; return from interrupt handler
 %endmacro
@@ -75,8 +136,36 @@ irq%1:
 	cli											; disable interrupts
 	push qword %1								; set IRQ number in the place of error code (see registers_t in interrupts.h)
 	push qword %2								; set interrupt number
-	call irq_handler							; calls void irq_handler(int_stack_t args)
-	sti											; enable interrupts
+	push rbp									; push current rbp
+	PUSH_ALL									; push all the registers on the stack
+	SWAPGS_IF_USER
+	mov rbp, rsp								; store current stack frame in rbp
+	mov rdi, rsp								; pass our stack as a pointer to the handler
+	call irq_handler							; calls void irq_handler(int_stack_t *stack)
+	SWAPGS_IF_USER
+	POP_ALL										; pop all the registers back from the stack
+	pop rbp										; get our rbp back from the stack
+	add rsp, 16									; cleanup stack
+	iretq										; return from interrupt handler
+%endmacro
+
+; Macro to create a service routine for dynamically allocated vectors (MSI, IPI, local APIC timer)
+; First parameter is the interrupt number
+%macro INT_VEC 1
+[global vec%1]
+vec%1:
+	cli											; disable interrupts
+	push qword 0								; no error code
+	push qword %1								; set interrupt number
+	push rbp									; push current rbp
+	PUSH_ALL									; push all the registers on the stack
+	SWAPGS_IF_USER
+	mov rbp, rsp								; store current stack frame in rbp
+	mov rdi, rsp								; pass our stack as a pointer to the handler
+	call vector_handler						; calls void vector_handler(int_stack_t *stack)
+	SWAPGS_IF_USER
+	POP_ALL										; pop all the registers back from the stack
+	pop rbp										; get our rbp back from the stack
 	add rsp, 16									; cleanup stack
 	iretq										; return from interrupt handler
 %endmacro
@@ -136,3 +225,19 @@ IRQ 12, 44
 IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
+
+; Vectors 48-255 are handed out at run-time (see interrupt_alloc_vectors())
+%assign i 48
+%rep 208
+INT_VEC %[i]
+%assign i i+1
+%endrep
+
+[section .data]
+; Stub address table for vectors 48-255 (used by interrupt_init() to fill the IDT)
+int_vectors:
+%assign i 48
+%rep 208
+	dq vec%[i]
+%assign i i+1
+%endrep
@@ -42,6 +42,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "lib.h"
 #include "io.h"
 #include "paging.h"
+#include "apic.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "sched.h"
+#include "fpu.h"
+#include "softirq.h"
+#include "irqstat.h"
+#include "rcu.h"
 #if DEBUG == 1
 	#include "debug_print.h"
 #endif
@@ -78,6 +86,23 @@ idt_entry_t idt[256];
 * Interrupt Descriptor Table pointer
 */
 idt_ptr_t idt_ptr;
+/**
+* Handler chains (one action for MSI and IPI vectors, more for shared lines)
+* Walked without a lock by interrupt_dispatch() - RCU protected (handlers run with interrupts off)
+*/
+static int_action_t * volatile _actions[256];
+/**
+* Actions of handlers registered with interrupt_reg_handler()
+*/
+static int_action_t _fixed[256];
+/**
+* Serializes changes of handler chains
+*/
+static spinlock_t _actions_lock = SPINLOCK_INIT;
+/**
+* Vector allocation bitmap (bit set = vector in use)
+*/
+static uint64 _vector_used[4];
 
 static void idt_set_entry(uint8 num, uint64 addr, uint16 flags){
 	idt[num].offset_lo = (uint16)(addr & 0xFFFF);
@@ -88,6 +113,29 @@ static void idt_set_entry(uint8 num, uint64 addr, uint16 flags){
 	idt[num].reserved = 0; // Zero out
 }
 
+/**
+* Adapter that calls a handler registered with interrupt_reg_handler()
+*/
+static uint64 interrupt_call_handler(int_stack_t *stack, void *data){
+	return ((int_handler_t)data)(stack);
+}
+/**
+* Run the handler chain of the interrupted vector
+* @param stack - registers pushed on the stack by assembly
+* @return 1 if no action has handled the interrupt
+*/
+static uint64 interrupt_dispatch(int_stack_t *stack){
+	int_action_t *action = rcu_dereference(_actions[(uint8)stack->int_no]);
+	uint64 result = 1;
+	while (action != null){
+		if (action->func(stack, action->data) == 0){
+			result = 0;
+		}
+		action = rcu_dereference(action->next);
+	}
+	return result;
+}
+
 void interrupt_init(){
 	mem_fill((uint8 *)&idt, sizeof(idt_entry_t) * 256, 0);
 
@@ -153,28 +201,174 @@ void interrupt_init(){
 	idt_set_entry(46, (uint64)irq14, 0x8E00);  // IRQ14 - Primary ATA Hard Disk
 	idt_set_entry(47, (uint64)irq15, 0x8E00);  // IRQ15 - Secondary ATA Hard Disk
 
+	// Vectors 48-255 - MSI, IPIs, local APIC timer and spurious interrupts
+	uint64 i;
+	for (i = INT_VECTOR_DYN_FIRST; i < 256; i ++){
+		idt_set_entry((uint8)i, int_vectors[i - INT_VECTOR_DYN_FIRST], 0x8E00);
+	}
+	mem_fill((uint8 *)_actions, sizeof(_actions), 0);
+	mem_fill((uint8 *)_fixed, sizeof(_fixed), 0);
+	mem_fill((uint8 *)_vector_used, sizeof(_vector_used), 0);
+	// Reserve exceptions, legacy IRQs and fixed system vectors
+	for (i = 0; i < 256; i ++){
+		if (i < INT_VECTOR_DYN_FIRST || i > INT_VECTOR_DYN_LAST){
+			_vector_used[i / 64] |= (1ULL << (i % 64));
+		}
+	}
+
 	idt_ptr.limit = (sizeof(idt_entry_t) * 256) - 1;
 	idt_ptr.base = (uint64)&idt;
 	idt_set(&idt_ptr);
 }
 
-void isr_handler(int_stack_t stack){
+int16 interrupt_alloc_vectors(uint64 count){
+	uint64 size = 1;
+	uint64 base;
+	uint64 i;
+	// Round up to the power of 2
+	while (size < count){
+		size <<= 1;
+	}
+	// Blocks are aligned to their size
+	base = (INT_VECTOR_DYN_FIRST + size - 1) & ~(size - 1);
+	for (; base + size - 1 <= INT_VECTOR_DYN_LAST; base += size){
+		for (i = base; i < base + size; i ++){
+			if (_vector_used[i / 64] & (1ULL << (i % 64))){
+				break;
+			}
+		}
+		if (i == base + size){
+			for (i = base; i < base + size; i ++){
+				_vector_used[i / 64] |= (1ULL << (i % 64));
+			}
+			return (int16)base;
+		}
+	}
+	return -1;
+}
+void interrupt_free_vectors(uint8 vector, uint64 count){
+	uint64 size = 1;
+	uint64 i;
+	// Release the whole block interrupt_alloc_vectors() has reserved
+	while (size < count){
+		size <<= 1;
+	}
+	for (i = vector; i < (uint64)vector + size && i <= INT_VECTOR_DYN_LAST; i ++){
+		if (i >= INT_VECTOR_DYN_FIRST){
+			// Drop whatever the owner has left registered
+			rcu_assign_pointer(_actions[i], null);
+		}
+	}
+	// Vectors go back to the allocator only when no CPU is running their old handlers
+	synchronize_rcu();
+	for (i = vector; i < (uint64)vector + size && i <= INT_VECTOR_DYN_LAST; i ++){
+		if (i >= INT_VECTOR_DYN_FIRST){
+			_vector_used[i / 64] &= ~(1ULL << (i % 64));
+		}
+	}
+}
+bool interrupt_reserve_vectors(uint8 vector, uint64 count){
+	uint64 i;
+	if ((uint64)vector + count > 256){
+		return false;
+	}
+	for (i = vector; i < (uint64)vector + count; i ++){
+		if (_vector_used[i / 64] & (1ULL << (i % 64))){
+			return false;
+		}
+	}
+	for (i = vector; i < (uint64)vector + count; i ++){
+		_vector_used[i / 64] |= (1ULL << (i % 64));
+	}
+	return true;
+}
+void interrupt_reg_handler(uint8 vector, int_handler_t handler){
+	int_action_t *action = &_fixed[vector];
+	if (action->func != null){
+		interrupt_release(vector, action);
+	}
+	if (handler != null){
+		action->func = interrupt_call_handler;
+		action->data = (void *)handler;
+		action->name = null;
+		action->flags = 0;
+		if (!interrupt_request(vector, action)){
+			action->func = null;
+		}
+	} else {
+		action->func = null;
+	}
+}
+bool interrupt_request(uint8 vector, int_action_t *action){
+	int_action_t *tail;
+	uint64 flags = spinlock_lock_irq(&_actions_lock);
+	tail = _actions[vector];
+	if (tail != null && !((tail->flags & action->flags) & INT_ACTION_SHARED)){
+		spinlock_unlock_irq(&_actions_lock, flags);
+		return false;
+	}
+	action->next = null;
+	if (tail == null){
+		rcu_assign_pointer(_actions[vector], action);
+	} else {
+		while (tail->next != null){
+			tail = tail->next;
+		}
+		// Dispatch may be walking the chain right now - publish a complete entry
+		rcu_assign_pointer(tail->next, action);
+	}
+	spinlock_unlock_irq(&_actions_lock, flags);
+	return true;
+}
+void interrupt_release(uint8 vector, int_action_t *action){
+	int_action_t * volatile *link;
+	uint64 flags = spinlock_lock_irq(&_actions_lock);
+	link = &_actions[vector];
+	while (*link != null && *link != action){
+		link = &(*link)->next;
+	}
+	if (*link == action){
+		// Handlers in flight keep following action->next
+		rcu_assign_pointer(*link, action->next);
+	}
+	spinlock_unlock_irq(&_actions_lock, flags);
+	synchronize_rcu();
+}
+void interrupt_set_gate(uint8 vector, uint64 addr, uint8 dpl){
+	_vector_used[vector / 64] |= (1ULL << (vector % 64));
+	// Present interrupt gate
+	idt_set_entry(vector, addr, 0x8E00 | ((uint16)(dpl & 3) << 13));
+}
+
+/**
+* Process CPU exceptions
+* @param stack - registers pushed on the stack by assembly
+*/
+static void isr_process(int_stack_t *stack){
+	// Lazy FPU switching - not an error
+	if (stack->int_no == 7 && fpu_trap()){
+		return;
+	}
+	// Registered handlers (e.g. debugger breakpoints) come first
+	if (interrupt_dispatch(stack) == 0){
+		return;
+	}
 #if DEBUG == 1
-	if (stack.int_no < 19){
-		debug_print(DC_WB, ints[stack.int_no]);
+	if (stack->int_no < 19){
+		debug_print(DC_WB, ints[stack->int_no]);
 	} else {
-		debug_print(DC_WB, "Interrupt: %x", stack.int_no);
+		debug_print(DC_WB, "Interrupt: %x", stack->int_no);
 	}
 #endif
 	// Process some exceptions here
 	uint64 cr2 = 0;
-	switch (stack.int_no){
+	switch (stack->int_no){
 		case 0: // Division by zero
-			//stack.rip++; // it's ok to divide by zero - move to next instruction :P
+			//stack->rip++; // it's ok to divide by zero - move to next instruction :P
 			break;
 		case 13: // General protection fault
 #if DEBUG == 1
-			debug_print(DC_WRD, "Error: %x", stack.err_code);
+			debug_print(DC_WRD, "Error: %x", stack->err_code);
 #endif
 			HANG();
 			break;
@@ -185,7 +379,7 @@ void isr_handler(int_stack_t stack){
 				page_map(cr2);
 			} else {
 #if DEBUG == 1
-			debug_print(DC_WRD, "Error: %x", stack.err_code);
+			debug_print(DC_WRD, "Error: %x", stack->err_code);
 			debug_print(DC_WRD, "Addr: @%x", cr2);
 #endif
 				HANG();
@@ -195,8 +389,59 @@ void isr_handler(int_stack_t stack){
 	}
 }
 
-void irq_handler(int_stack_t stack){
+void isr_handler(int_stack_t *stack){
+	// Exceptions raised with interrupts disabled are part of an already open window
+	bool irq_on = ((stack->rflags & 0x200) != 0);
+	uint64 start = (irq_on ? irqstat_enter() : rdtsc());
+	isr_process(stack);
+	irqstat_exit((uint8)stack->int_no, start);
+	if (irq_on){
+		irqstat_off_end();
+	}
+}
+
+void irq_handler(int_stack_t *stack){
+	uint64 start = irqstat_enter();
+	if (interrupt_dispatch(stack)){
 #if DEBUG == 1
-	debug_print(DC_WB, "IRQ %d", stack.err_code);
+		debug_print(DC_WB, "IRQ %d", stack->err_code);
 #endif
-}
\ No newline at end of file
+	}
+	// Legacy IRQs only arrive while the PIC is unmasked (before apic_init())
+	if (stack->err_code >= 8){
+		outb(0xA0, 0x20);
+	}
+	outb(0x20, 0x20);
+	irqstat_exit((uint8)stack->int_no, start);
+	rcu_irq_exit();
+	softirq_irq_exit();
+	// Shared INTx handlers can wake threads too
+	sched_irq_exit();
+	irqstat_off_end();
+}
+
+void vector_handler(int_stack_t *stack){
+	uint8 vector = (uint8)stack->int_no;
+	uint64 start = irqstat_enter();
+	if (vector == INT_VECTOR_SPURIOUS){
+		// Spurious interrupts must not be acknowledged
+		irqstat_exit(vector, start);
+		irqstat_off_end();
+		return;
+	}
+	if (interrupt_dispatch(stack)){
+#if DEBUG == 1
+		debug_print(DC_WRD, "Unhandled vector %d", (uint64)vector);
+#endif
+	}
+	// Vectors above legacy IRQs are delivered by local APIC
+	apic_eoi();
+	irqstat_exit(vector, start);
+	// Quiescent state unless a read-side section was interrupted
+	rcu_irq_exit();
+	// Run deferred work raised by the handler (with interrupts enabled)
+	softirq_irq_exit();
+	// Switch threads if the handler has woken up a more important one
+	sched_irq_exit();
+	irqstat_off_end();
+}
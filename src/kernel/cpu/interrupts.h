@@ -60,10 +60,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define IRQ14 46
 #define IRQ15 47
 
+// Dynamically allocated vectors (MSI, MSI-X)
+#define INT_VECTOR_DYN_FIRST 48		// First vector handed out by interrupt_alloc_vectors()
+#define INT_VECTOR_DYN_LAST 0xEF	// Last vector handed out by interrupt_alloc_vectors()
+// Fixed system vectors (0xF0 - 0xFF)
+#define INT_VECTOR_TLB 0xF0			// TLB shootdown IPI
+#define INT_VECTOR_TIMER 0xF1		// Local APIC timer
+#define INT_VECTOR_RESCHED 0xF2		// Reschedule IPI
+#define INT_VECTOR_SPURIOUS 0xFF	// Local APIC spurious interrupt vector (no EOI)
+
 /**
 * Register stack passed from assembly
 */
 typedef struct {
+	uint64 rax;
+	uint64 rbx;
+	uint64 rcx;
+	uint64 rdx;
+	uint64 rdi;
+	uint64 rsi;
+	uint64 r8;
+	uint64 r9;
+	uint64 r10;
+	uint64 r11;
+	uint64 r12;
+	uint64 r13;
+	uint64 r14;
+	uint64 r15;
+	uint64 rbp;
 	uint64 int_no;				// Interrupt number
 	uint64 err_code;			// Error code (or IRQ number for IRQs)
 	uint64 rip;					// Return instruction pointer
@@ -108,11 +132,90 @@ struct idt_ptr_struct {
 * Interrupt Descriptor Table (IDT) pointer
 */
 typedef struct idt_ptr_struct idt_ptr_t;
+/**
+* Interrupt handler for dynamically allocated vectors
+* @param stack - registers pushed on the stack by assembly
+* @return 1 if this interrupt is left unhandled
+*/
+typedef uint64 (*int_handler_t)(int_stack_t *stack);
+/**
+* Interrupt action handler (one device or subsystem on a vector)
+* @param stack - registers pushed on the stack by assembly
+* @param data - argument given at registration
+* @return 1 if the interrupt was not raised by this device
+*/
+typedef uint64 (*int_action_func_t)(int_stack_t *stack, void *data);
+/**
+* Interrupt action - an entry of a vector's handler chain
+* Owned by the caller and must stay valid until interrupt_release() returns
+*/
+struct int_action_struct {
+	struct int_action_struct *next;
+	int_action_func_t func;		// Handler
+	void *data;					// Handler argument
+	char *name;					// Owner name (for diagnostics)
+	uint64 flags;				// INT_ACTION_* flags
+};
+typedef struct int_action_struct int_action_t;
+
+// Action can share the vector with other actions (legacy INTx lines)
+#define INT_ACTION_SHARED 0x1
+
 /**
 * Initialize interrupt handlers
 */
 void interrupt_init();
 /**
+* Allocate a block of consecutive interrupt vectors
+* Block is aligned to its size, as required by multi-message MSI
+* @param count - number of vectors (rounded up to the power of 2)
+* @return first vector of the block or -1 if there are no free vectors left
+*/
+int16 interrupt_alloc_vectors(uint64 count);
+/**
+* Release a block of vectors allocated by interrupt_alloc_vectors()
+* Waits for an RCU grace period (thread context - blocks)
+* @param vector - first vector of the block
+* @param count - number of vectors (as passed to interrupt_alloc_vectors())
+*/
+void interrupt_free_vectors(uint8 vector, uint64 count);
+/**
+* Reserve specific vectors, so interrupt_alloc_vectors() never hands them out
+* @param vector - first vector
+* @param count - number of vectors
+* @return true if all the vectors were free
+*/
+bool interrupt_reserve_vectors(uint8 vector, uint64 count);
+/**
+* Register a handler for a dynamically allocated vector
+* @param vector - interrupt vector
+* @param handler - callback function (null to remove)
+*/
+void interrupt_reg_handler(uint8 vector, int_handler_t handler);
+/**
+* Add an action to a vector's handler chain
+* Every action of a shared vector is called, so each handler has to check its device
+* @param vector - interrupt vector
+* @param action - action (func, data, name and flags filled in)
+* @return false if the vector has an exclusive action or the action is exclusive and the vector is taken
+*/
+bool interrupt_request(uint8 vector, int_action_t *action);
+/**
+* Remove an action from a vector's handler chain
+* Waits for an RCU grace period, so the action can be reused afterwards
+* (thread context - blocks)
+* @param vector - interrupt vector
+* @param action - action passed to interrupt_request()
+*/
+void interrupt_release(uint8 vector, int_action_t *action);
+/**
+* Point a vector to a custom entry stub (e.g. a system call gate)
+* @param vector - interrupt vector (reserved from the allocator)
+* @param addr - entry stub address
+* @param dpl - lowest privilege level allowed to raise it with the int instruction
+*/
+void interrupt_set_gate(uint8 vector, uint64 addr, uint8 dpl);
+/**
 * Set IDT pointer
 * @see interrupts.asm
 * @param idt_ptr - an address of IDT pointer structure in memory
@@ -122,17 +225,23 @@ extern void idt_set(idt_ptr_t *idt_ptr);
 /**
 * Interrupt Service Routine (ISR) handler
 * This will be defined in kernel code
-* @param regs - registers pushed on the stack by assembly
+* @param stack - registers pushed on the stack by assembly
 * @return void
 */
-void isr_handler(int_stack_t regs);
+void isr_handler(int_stack_t *stack);
 /**
 * Interrupt Request (IRQ) handler
 * This will be defined in kernel code
-* @param regs - registers pushed on the stack by assembly
+* @param stack - registers pushed on the stack by assembly
+* @return void
+*/
+void irq_handler(int_stack_t *stack);
+/**
+* Dynamically allocated vector handler (vectors 48-255)
+* @param stack - registers pushed on the stack by assembly
 * @return void
 */
-void irq_handler(int_stack_t regs);
+void vector_handler(int_stack_t *stack);
 
 // Defined in interrupts.asm (with macros!)
 extern void isr0();
@@ -184,6 +293,8 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+// Defined in interrupts.asm (stub addresses for vectors 48-255)
+extern uint64 int_vectors[];
 
 
 #endif
\ No newline at end of file
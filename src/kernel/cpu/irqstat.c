@@ -0,0 +1,126 @@
+/*
+
+Interrupt statistics
+====================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "irqstat.h"
+#include "clock.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+static irqstat_vector_t _vectors[CPU_MAX][256];
+static irqstat_off_t _off[CPU_MAX];
+
+void irqstat_off_record(uint64 cycles, uint64 rip){
+	percpu_t *cpu = percpu_this();
+	cpu->irq_off_max = cycles;
+	_off[cpu->id].max = cycles;
+	_off[cpu->id].rip = rip;
+}
+void irqstat_exit(uint8 vector, uint64 start){
+	irqstat_vector_t *v = &_vectors[cpu_id()][vector];
+	uint64 cycles = rdtsc() - start;
+	uint64 bucket = 0;
+	uint64 c = cycles >> IRQSTAT_SHIFT;
+	while (c != 0 && bucket < IRQSTAT_BUCKETS - 1){
+		c >>= 1;
+		bucket ++;
+	}
+	v->count ++;
+	v->hist[bucket] ++;
+	if (cycles > v->max){
+		v->max = cycles;
+	}
+}
+irqstat_vector_t *irqstat_vector(uint64 cpu, uint8 vector){
+	return &_vectors[cpu][vector];
+}
+irqstat_off_t *irqstat_off(uint64 cpu){
+	return &_off[cpu];
+}
+void irqstat_reset(){
+	uint64 i;
+	mem_fill((uint8 *)_vectors, sizeof(_vectors), 0);
+	mem_fill((uint8 *)_off, sizeof(_off), 0);
+	for (i = 0; i < CPU_MAX; i ++){
+		if (cpu_online_mask() & (1ULL << i)){
+			percpu_get(i)->irq_off_max = 0;
+		}
+	}
+}
+
+#if DEBUG == 1
+/**
+* Find the upper bound of a percentile in a histogram
+* @param v - vector statistics
+* @param pct - percentile (1-100)
+* @return duration in TSC cycles
+*/
+static uint64 irqstat_percentile(irqstat_vector_t *v, uint64 pct){
+	uint64 want = (v->count * pct + 99) / 100;
+	uint64 sum = 0;
+	uint64 i;
+	for (i = 0; i < IRQSTAT_BUCKETS - 1; i ++){
+		sum += v->hist[i];
+		if (sum >= want){
+			return (1ULL << (IRQSTAT_SHIFT + i));
+		}
+	}
+	return v->max;
+}
+void irqstat_list(){
+	uint64 mask = cpu_online_mask();
+	irqstat_vector_t *v;
+	uint64 cpu;
+	uint64 i;
+	for (cpu = 0; cpu < CPU_MAX; cpu ++){
+		if (!(mask & (1ULL << cpu))){
+			continue;
+		}
+		for (i = 0; i < 256; i ++){
+			v = &_vectors[cpu][i];
+			if (v->count == 0){
+				continue;
+			}
+			debug_print(DC_WB, "CPU%d INT %d: %d, p50 <%dns, p99 <%dns, max %dns", cpu, i, v->count,
+				clock_tsc_to_ns(irqstat_percentile(v, 50)),
+				clock_tsc_to_ns(irqstat_percentile(v, 99)),
+				clock_tsc_to_ns(v->max));
+		}
+		debug_print(DC_WB, "CPU%d interrupts off: max %dns @%x", cpu, clock_tsc_to_ns(_off[cpu].max), _off[cpu].rip);
+	}
+}
+#endif
@@ -0,0 +1,145 @@
+/*
+
+Interrupt statistics
+====================
+
+Per-CPU, per-vector interrupt counters and handler duration histograms, and
+the longest window with interrupts disabled. Recording is a few TSC reads and
+increments on cache lines owned by the CPU, so it stays enabled.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __irqstat_h
+#define __irqstat_h
+
+#include "common.h"
+#include "../config.h"
+#include "percpu.h"
+#include "msr.h"
+
+// Number of histogram buckets (powers of 2 of TSC cycles)
+#define IRQSTAT_BUCKETS		12
+// First bucket holds durations below 2^IRQSTAT_SHIFT cycles, last one everything above
+#define IRQSTAT_SHIFT		9
+
+/**
+* Statistics of one vector on one CPU (one cache line)
+*/
+struct irqstat_vector_struct {
+	uint64 count;					// Number of interrupts
+	uint64 max;						// Longest entry to exit duration (TSC cycles)
+	uint32 hist[IRQSTAT_BUCKETS];	// Duration histogram
+} __ALIGN(64);
+typedef struct irqstat_vector_struct irqstat_vector_t;
+/**
+* Longest interrupts-off window of a CPU
+*/
+struct irqstat_off_struct {
+	uint64 max;						// Duration (TSC cycles)
+	uint64 rip;						// Code that has enabled interrupts at the end of it
+};
+typedef struct irqstat_off_struct irqstat_off_t;
+
+/**
+* Record the end of an interrupts-off window
+* @param cycles - window duration
+* @param rip - where interrupts are being enabled
+*/
+void irqstat_off_record(uint64 cycles, uint64 rip);
+/**
+* Mark the start of an interrupts-off window (call right after CLI)
+*/
+static void irqstat_off_begin(){
+	percpu_this()->irq_off_start = rdtsc();
+}
+/**
+* Address of the code that expands it
+*/
+#define IRQSTAT_HERE() ({ __label__ here; here: (uint64)&&here; })
+/**
+* Mark the end of an interrupts-off window (call right before STI or IRETQ)
+* @param rip - where interrupts are being enabled
+*/
+static void irqstat_off_end_at(uint64 rip){
+	percpu_t *cpu = percpu_this();
+	uint64 cycles;
+	if (cpu->irq_off_start != 0){
+		cycles = rdtsc() - cpu->irq_off_start;
+		cpu->irq_off_start = 0;
+		if (cycles > cpu->irq_off_max){
+			irqstat_off_record(cycles, rip);
+		}
+	}
+}
+/**
+* Mark the end of an interrupts-off window at the calling code
+*/
+#define irqstat_off_end() irqstat_off_end_at(IRQSTAT_HERE())
+/**
+* Interrupt entry (interrupts are disabled by the gate)
+* @return entry timestamp (pass to irqstat_exit())
+*/
+static uint64 irqstat_enter(){
+	uint64 start = rdtsc();
+	percpu_this()->irq_off_start = start;
+	return start;
+}
+/**
+* Record a handled interrupt
+* @param vector - interrupt vector
+* @param start - timestamp returned by irqstat_enter()
+*/
+void irqstat_exit(uint8 vector, uint64 start);
+/**
+* Get statistics of a vector
+* @param cpu - CPU index
+* @param vector - interrupt vector
+* @return statistics
+*/
+irqstat_vector_t *irqstat_vector(uint64 cpu, uint8 vector);
+/**
+* Get the longest interrupts-off window
+* @param cpu - CPU index
+* @return window duration and location
+*/
+irqstat_off_t *irqstat_off(uint64 cpu);
+/**
+* Clear all statistics
+*/
+void irqstat_reset();
+#if DEBUG == 1
+/**
+* List interrupt counts, duration percentiles and interrupts-off windows on screen
+*/
+void irqstat_list();
+#endif
+
+#endif /* __irqstat_h */
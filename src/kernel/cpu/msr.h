@@ -53,6 +53,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MSR_IA32_SYSENTER_ESP 0x175
 #define MSR_IA32_SYSENTER_EIP 0x176
 #define MSR_IA32_MISC_ENABLE 0x1A0
+#define MSR_IA32_TSC_DEADLINE 0x6E0
 #define MSR_IA32_X2APIC_APICID 0x802
 #define MSR_IA32_X2APIC_VERSION 0x803
 #define MSR_IA32_X2APIC_TPR 0x808
@@ -99,10 +100,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MSR_IA32_X2APIC_SELF_IPI 0x83F
 #define MSR_IA32_EFER 0xC0000080
 #define MSR_IA32_STAR 0xC0000081
+#define MSR_IA32_LSTAR 0xC0000082
+#define MSR_IA32_CSTAR 0xC0000083
 #define MSR_IA32_FMASK 0xC0000084
 #define MSR_IA32_FS_BASE 0xC0000100
 #define MSR_IA32_GS_BASE 0xC0000101
 #define MSR_IA32_KERNEL_GS_BASE 0xC0000102
+#define MSR_IA32_TSC_AUX 0xC0000103
 
 /**
 * Read MSR value
@@ -124,5 +128,14 @@ static void msr_write(uint32 msr, uint64 val){
 	split_uint64_t *v = (split_uint64_t *)&val;
 	asm volatile("wrmsr" : : "a"(v->low), "d"(v->high), "c"(msr));
 }
+/**
+* Read Time Stamp Counter
+* @return TSC value
+*/
+static uint64 rdtsc(){
+	split_uint64_t v;
+	asm volatile("rdtsc" : "=a"(v.low), "=d"(v.high));
+	return (((uint64)v.high) << 32) | v.low;
+}
 
 #endif
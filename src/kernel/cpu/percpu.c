@@ -0,0 +1,76 @@
+/*
+
+Per-CPU data
+============
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "percpu.h"
+#include "msr.h"
+#include "cpuid.h"
+#include "lib.h"
+
+static percpu_t _percpu[CPU_MAX];
+static uint64 volatile _online = 0;
+static uint64 volatile _isolated = 0;
+
+void percpu_init(uint64 id){
+	percpu_t *cpu = &_percpu[id];
+	uint32 eax, ebx, ecx, edx;
+	mem_fill((uint8 *)cpu, sizeof(percpu_t), 0);
+	cpu->self = cpu;
+	cpu->id = id;
+	// Initial APIC ID (works before Local APIC registers are mapped)
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	cpu->apic_id = (ebx >> 24);
+	msr_write(MSR_IA32_GS_BASE, (uint64)cpu);
+	__sync_fetch_and_or(&_online, (1ULL << id));
+}
+percpu_t *percpu_get(uint64 id){
+	return &_percpu[id];
+}
+uint64 cpu_online_mask(){
+	return _online;
+}
+uint64 cpu_isolated_mask(){
+	return _isolated;
+}
+void cpu_set_isolated(uint64 mask){
+	_isolated = mask;
+}
+uint64 cpu_housekeeping(){
+	uint64 mask = (_online & ~_isolated);
+	if (mask == 0){
+		return 0;
+	}
+	return (uint64)__builtin_ctzll(mask);
+}
@@ -0,0 +1,117 @@
+/*
+
+Per-CPU data
+============
+
+Every CPU points its GS base to its own percpu_t structure
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __percpu_h
+#define __percpu_h
+
+#include "common.h"
+
+// Maximum number of CPUs supported (size of CPU masks)
+#define CPU_MAX 64
+
+/**
+* Per-CPU data structure
+* First fields are accessed from assembly through GS segment, don't reorder them
+*/
+struct percpu_struct {
+	struct percpu_struct *self;	// Pointer to itself (GS:0)
+	uint64 id;					// CPU index (GS:8)
+	uint64 kernel_rsp;			// Kernel stack loaded by SYSCALL entry (GS:16)
+	uint64 user_rsp;			// User stack pointer scratch of SYSCALL entry (GS:24)
+	uint64 apic_id;				// Local APIC ID
+	int64 tsc_offset;			// Correction added to local TSC to match bootstrap processor's TSC
+	uint64 preempt_count;		// Preemption is disabled while non-zero
+	uint64 volatile need_resched;// Scheduler has to run before returning to the current thread
+	uint64 volatile idle_polling;// Idle loop is waiting in MWAIT on need_resched (no IPI needed)
+	void *fpu_owner;			// Thread whose FPU/SIMD state is in the registers (thread_t)
+	bool fpu_kernel;			// Inside kernel_fpu_begin()/kernel_fpu_end()
+	uint64 irq_off_start;		// TSC when interrupts were disabled (0 - not tracked)
+	uint64 irq_off_max;			// Longest interrupts-off window so far (TSC cycles)
+} __ALIGN(64);
+typedef struct percpu_struct percpu_t;
+
+/**
+* Initialize per-CPU data of the calling CPU and mark it online
+* @param id - CPU index (0 for the bootstrap processor)
+*/
+void percpu_init(uint64 id);
+/**
+* Get per-CPU data of any CPU
+* @param id - CPU index
+* @return per-CPU structure
+*/
+percpu_t *percpu_get(uint64 id);
+/**
+* Get a mask of CPUs that are online
+* @return bit mask (bit N set - CPU N is online)
+*/
+uint64 cpu_online_mask();
+/**
+* Get a mask of isolated CPUs (see sched_isolate())
+* @return bit mask (bit N set - CPU N is isolated)
+*/
+uint64 cpu_isolated_mask();
+/**
+* Set the mask of isolated CPUs (used by sched_isolate())
+* @param mask - bit mask of CPU indexes
+*/
+void cpu_set_isolated(uint64 mask);
+/**
+* Get the CPU that takes over work deferred on isolated CPUs
+* @return first online CPU that is not isolated
+*/
+uint64 cpu_housekeeping();
+/**
+* Get the index of the calling CPU
+* @return CPU index
+*/
+static uint64 cpu_id(){
+	uint64 id;
+	asm volatile("movq %%gs:8, %0" : "=r"(id));
+	return id;
+}
+/**
+* Get per-CPU data of the calling CPU
+* @return per-CPU structure
+*/
+static percpu_t *percpu_this(){
+	percpu_t *self;
+	asm volatile("movq %%gs:0, %0" : "=r"(self));
+	return self;
+}
+
+#endif /* __percpu_h */
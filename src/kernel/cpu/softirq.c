@@ -0,0 +1,352 @@
+/*
+
+Deferred interrupt work
+=======================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "softirq.h"
+#include "percpu.h"
+#include "preempt.h"
+#include "msr.h"
+#include "clock.h"
+#include "irqstat.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+// Tasklet state bits
+#define TASKLET_SCHED		0x1
+#define TASKLET_RUN			0x2
+
+/**
+* Tasklet queue
+*/
+struct tasklet_list_struct {
+	tasklet_t *head;
+	tasklet_t *tail;
+};
+typedef struct tasklet_list_struct tasklet_list_t;
+/**
+* Per-CPU softirq state
+*/
+struct softirq_cpu_struct {
+	uint64 volatile pending;			// Bit mask of pending sources
+	bool running;						// Softirqs are being processed
+	thread_t *thread;					// Overflow thread
+	spinlock_t tasklet_lock;			// Tasklet lists (isolated CPUs queue on the housekeeping one)
+	tasklet_list_t tasklets[2];			// Normal and high priority tasklets
+	softirq_stat_t stats[SOFTIRQ_COUNT];
+} __ALIGN(64);
+typedef struct softirq_cpu_struct softirq_cpu_t;
+
+static softirq_cpu_t _cpu[CPU_MAX];
+static softirq_func_t _handlers[SOFTIRQ_COUNT];
+static char *_names[SOFTIRQ_COUNT];
+static uint64 _mode = SOFTIRQ_MODE_IRQ_EXIT;
+static uint64 _budget = 0;				// SOFTIRQ_BUDGET_NS in TSC cycles
+
+/**
+* Process pending softirqs of the calling CPU
+* Must be called with interrupts disabled, returns with interrupts disabled
+* @param rounds - maximum number of passes over pending sources
+* @return true if work is left
+*/
+static bool softirq_run(uint64 rounds){
+	softirq_cpu_t *c = &_cpu[cpu_id()];
+	uint64 start = rdtsc();
+	uint64 pending;
+	uint64 nr;
+	uint64 t;
+	if (c->running){
+		return (c->pending != 0);
+	}
+	c->running = true;
+	preempt_disable();
+	while (rounds -- > 0 && (pending = c->pending) != 0){
+		c->pending = 0;
+		irqstat_off_end();
+		asm volatile("sti");
+		for (nr = 0; nr < SOFTIRQ_COUNT; nr ++){
+			if ((pending & (1ULL << nr)) && _handlers[nr] != null){
+				t = rdtsc();
+				_handlers[nr]();
+				t = rdtsc() - t;
+				c->stats[nr].count ++;
+				c->stats[nr].cycles += t;
+				if (t > c->stats[nr].max){
+					c->stats[nr].max = t;
+				}
+			}
+		}
+		asm volatile("cli");
+		irqstat_off_begin();
+		if (_budget != 0 && rdtsc() - start > _budget){
+			break;
+		}
+	}
+	c->running = false;
+	// Interrupts are disabled - a reschedule request is picked up on interrupt exit
+	preempt_enable();
+	return (c->pending != 0);
+}
+/**
+* Per-CPU thread - runs softirqs that did not fit into interrupt exit
+*/
+static void softirq_thread(void *arg){
+	softirq_cpu_t *c = &_cpu[cpu_id()];
+	while (true){
+		thread_block_prepare();
+		if (c->pending == 0){
+			thread_block();
+			continue;
+		}
+		thread_wake(thread_current());
+		asm volatile("cli");
+		softirq_run(1);
+		asm volatile("sti");
+		// Let other threads in between rounds
+		thread_yield();
+	}
+}
+/**
+* Wake the per-CPU thread of the calling CPU
+*/
+static void softirq_wake(softirq_cpu_t *c){
+	if (c->thread != null){
+		thread_wake(c->thread);
+	}
+}
+/**
+* Run queued tasklets (bounded batch, the rest is re-raised)
+* @param hi - high priority queue
+*/
+static void tasklet_run(bool hi){
+	softirq_cpu_t *c = &_cpu[cpu_id()];
+	tasklet_list_t *list = &c->tasklets[hi ? 1 : 0];
+	tasklet_t *t;
+	uint64 flags;
+	uint64 n;
+	for (n = 0; n < SOFTIRQ_BATCH; n ++){
+		flags = spinlock_lock_irq(&c->tasklet_lock);
+		t = list->head;
+		if (t != null){
+			list->head = t->next;
+			if (list->head == null){
+				list->tail = null;
+			}
+		}
+		spinlock_unlock_irq(&c->tasklet_lock, flags);
+		if (t == null){
+			return;
+		}
+		if (__atomic_fetch_or(&t->state, TASKLET_RUN, __ATOMIC_ACQUIRE) & TASKLET_RUN){
+			// Running on another CPU - try again later
+			flags = spinlock_lock_irq(&c->tasklet_lock);
+			t->next = null;
+			if (list->tail != null){
+				list->tail->next = t;
+			} else {
+				list->head = t;
+			}
+			list->tail = t;
+			spinlock_unlock_irq(&c->tasklet_lock, flags);
+			break;
+		}
+		// Can be scheduled again while it runs
+		__atomic_and_fetch(&t->state, ~TASKLET_SCHED, __ATOMIC_RELEASE);
+		t->func(t->data);
+		__atomic_and_fetch(&t->state, ~TASKLET_RUN, __ATOMIC_RELEASE);
+	}
+	if (list->head != null){
+		softirq_raise(hi ? SOFTIRQ_HI : SOFTIRQ_TASKLET);
+	}
+}
+static void tasklet_hi_action(){
+	tasklet_run(true);
+}
+static void tasklet_action(){
+	tasklet_run(false);
+}
+/**
+* Queue a tasklet
+*/
+static void tasklet_queue(tasklet_t *tasklet, bool hi){
+	softirq_cpu_t *c;
+	tasklet_list_t *list;
+	uint64 flags;
+	uint64 cpu;
+	if (__atomic_fetch_or(&tasklet->state, TASKLET_SCHED, __ATOMIC_ACQ_REL) & TASKLET_SCHED){
+		return;
+	}
+	preempt_disable();
+	cpu = cpu_id();
+	if (cpu_isolated_mask() & (1ULL << cpu)){
+		cpu = cpu_housekeeping();
+	}
+	c = &_cpu[cpu];
+	list = &c->tasklets[hi ? 1 : 0];
+	flags = spinlock_lock_irq(&c->tasklet_lock);
+	tasklet->next = null;
+	if (list->tail != null){
+		list->tail->next = tasklet;
+	} else {
+		list->head = tasklet;
+	}
+	list->tail = tasklet;
+	spinlock_unlock_irq(&c->tasklet_lock, flags);
+	softirq_raise_on(cpu, hi ? SOFTIRQ_HI : SOFTIRQ_TASKLET);
+	preempt_enable();
+}
+
+void softirq_init(){
+	mem_fill((uint8 *)_cpu, sizeof(_cpu), 0);
+	mem_fill((uint8 *)_handlers, sizeof(_handlers), 0);
+	mem_fill((uint8 *)_names, sizeof(_names), 0);
+	softirq_register(SOFTIRQ_HI, tasklet_hi_action, "tasklet-hi");
+	softirq_register(SOFTIRQ_TASKLET, tasklet_action, "tasklet");
+}
+void softirq_init_threads(){
+	uint64 mask = cpu_online_mask();
+	uint64 i;
+	// Clock sources are up by now
+	_budget = clock_ns_to_tsc(SOFTIRQ_BUDGET_NS);
+	for (i = 0; i < CPU_MAX; i ++){
+		if (mask & (1ULL << i)){
+			_cpu[i].thread = thread_create_on("softirq", softirq_thread, null, SCHED_FAIR, 0, i);
+		}
+	}
+}
+void softirq_register(uint64 nr, softirq_func_t func, char *name){
+	if (nr < SOFTIRQ_COUNT){
+		_names[nr] = name;
+		_handlers[nr] = func;
+	}
+}
+void softirq_raise(uint64 nr){
+	softirq_cpu_t *c = &_cpu[cpu_id()];
+	uint64 flags;
+	if (cpu_isolated_mask() & (1ULL << cpu_id())){
+		// No deferred work on isolated CPUs
+		softirq_raise_on(cpu_housekeeping(), nr);
+		return;
+	}
+	__atomic_or_fetch(&c->pending, (1ULL << nr), __ATOMIC_RELAXED);
+	asm volatile("pushfq; popq %0" : "=r"(flags));
+	// Raised from a thread - there's no interrupt exit to run it
+	if ((flags & 0x200) && !c->running){
+		softirq_wake(c);
+	}
+}
+void softirq_raise_on(uint64 cpu, uint64 nr){
+	if (cpu == cpu_id() && !(cpu_isolated_mask() & (1ULL << cpu))){
+		softirq_raise(nr);
+		return;
+	}
+	__atomic_or_fetch(&_cpu[cpu].pending, (1ULL << nr), __ATOMIC_RELEASE);
+	// Its interrupt exit runs it
+	apic_send_ipi((uint8)percpu_get(cpu)->apic_id, INT_VECTOR_RESCHED);
+}
+void softirq_irq_exit(){
+	softirq_cpu_t *c = &_cpu[cpu_id()];
+	uint64 pending;
+	uint64 nr;
+	if (c->pending == 0){
+		return;
+	}
+	if (cpu_isolated_mask() & (1ULL << cpu_id())){
+		// Raised before the CPU was isolated - hand it over, the overflow thread stays asleep
+		pending = __atomic_exchange_n(&c->pending, 0, __ATOMIC_ACQ_REL);
+		for (nr = 0; nr < SOFTIRQ_COUNT; nr ++){
+			if (pending & (1ULL << nr)){
+				softirq_raise_on(cpu_housekeeping(), nr);
+			}
+		}
+		return;
+	}
+	// Interrupted code may hold a lock the handlers need, or everything runs threaded
+	if (_mode == SOFTIRQ_MODE_THREAD || !preemptible()){
+		softirq_wake(c);
+		return;
+	}
+	if (softirq_run(SOFTIRQ_ROUNDS)){
+		softirq_wake(c);
+	}
+}
+void softirq_set_mode(uint64 mode){
+	_mode = mode;
+}
+thread_t *softirq_thread_on(uint64 cpu){
+	return _cpu[cpu].thread;
+}
+softirq_stat_t *softirq_stat(uint64 cpu, uint64 nr){
+	return &_cpu[cpu].stats[nr];
+}
+void tasklet_init(tasklet_t *tasklet, tasklet_func_t func, uint64 data){
+	tasklet->next = null;
+	tasklet->func = func;
+	tasklet->data = data;
+	tasklet->state = 0;
+}
+void tasklet_schedule(tasklet_t *tasklet){
+	tasklet_queue(tasklet, false);
+}
+void tasklet_hi_schedule(tasklet_t *tasklet){
+	tasklet_queue(tasklet, true);
+}
+
+#if DEBUG == 1
+void softirq_list(){
+	uint64 mask = cpu_online_mask();
+	softirq_stat_t *s;
+	uint64 cpu;
+	uint64 nr;
+	for (cpu = 0; cpu < CPU_MAX; cpu ++){
+		if (!(mask & (1ULL << cpu))){
+			continue;
+		}
+		for (nr = 0; nr < SOFTIRQ_COUNT; nr ++){
+			s = &_cpu[cpu].stats[nr];
+			if (_names[nr] == null || s->count == 0){
+				continue;
+			}
+			debug_print(DC_WB, "CPU%d %s: %d runs, %dus total, max %dns", cpu, _names[nr], s->count,
+				clock_tsc_to_ns(s->cycles) / 1000, clock_tsc_to_ns(s->max));
+		}
+	}
+}
+#endif
@@ -0,0 +1,167 @@
+/*
+
+Deferred interrupt work
+=======================
+
+Per-CPU softirqs and tasklets. Hard interrupt handlers only acknowledge the
+device and raise a softirq, the rest of the work runs with interrupts enabled
+on interrupt exit (in bounded batches) or in a per-CPU thread.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __softirq_h
+#define __softirq_h
+
+#include "common.h"
+#include "../config.h"
+
+struct thread_struct;
+
+// Softirq sources in order of precedence
+#define SOFTIRQ_HI			0	// High priority tasklets
+#define SOFTIRQ_BLOCK		1	// Storage request completion
+#define SOFTIRQ_MIDI		2	// MIDI input parsing
+#define SOFTIRQ_TASKLET		3	// Normal tasklets
+#define SOFTIRQ_RCU			4	// RCU callbacks
+#define SOFTIRQ_COUNT		5
+// Rounds of pending softirqs processed on interrupt exit before the rest goes to the thread
+#define SOFTIRQ_ROUNDS		4
+// Time budget of a single softirq run on interrupt exit (ns)
+#define SOFTIRQ_BUDGET_NS	500000
+// Tasklets run per softirq invocation
+#define SOFTIRQ_BATCH		16
+// Where deferred work runs
+#define SOFTIRQ_MODE_IRQ_EXIT	0	// On interrupt exit, overflow in the per-CPU thread
+#define SOFTIRQ_MODE_THREAD		1	// Always in the per-CPU thread
+
+/**
+* Softirq handler (runs with interrupts enabled and preemption disabled)
+*/
+typedef void (*softirq_func_t)();
+/**
+* Tasklet function
+* @param data - argument passed to tasklet_init()
+*/
+typedef void (*tasklet_func_t)(uint64 data);
+/**
+* Tasklet - deferred function that never runs on two CPUs at once
+*/
+struct tasklet_struct {
+	struct tasklet_struct *next;
+	tasklet_func_t func;
+	uint64 data;
+	uint64 volatile state;		// Scheduled and running bits
+};
+typedef struct tasklet_struct tasklet_t;
+/**
+* Per-source statistics
+*/
+struct softirq_stat_struct {
+	uint64 count;				// Handler invocations
+	uint64 cycles;				// Total time spent (TSC cycles)
+	uint64 max;					// Longest invocation (TSC cycles)
+};
+typedef struct softirq_stat_struct softirq_stat_t;
+
+/**
+* Initialize softirqs and tasklets
+*/
+void softirq_init();
+/**
+* Start per-CPU threads on all online CPUs and enable the time budget (call after sched_init())
+*/
+void softirq_init_threads();
+/**
+* Set a softirq handler
+* @param nr - SOFTIRQ_*
+* @param func - handler
+* @param name - source name (for statistics)
+*/
+void softirq_register(uint64 nr, softirq_func_t func, char *name);
+/**
+* Mark a softirq pending on the calling CPU (can be called from interrupt handlers)
+* Isolated CPUs hand it over to the housekeeping CPU
+* @param nr - SOFTIRQ_*
+*/
+void softirq_raise(uint64 nr);
+/**
+* Mark a softirq pending on another CPU (runs on its next interrupt exit)
+* @param cpu - CPU index
+* @param nr - SOFTIRQ_*
+*/
+void softirq_raise_on(uint64 cpu, uint64 nr);
+/**
+* Run pending softirqs (called on interrupt exit with interrupts disabled)
+*/
+void softirq_irq_exit();
+/**
+* Select where deferred work runs
+* @param mode - SOFTIRQ_MODE_*
+*/
+void softirq_set_mode(uint64 mode);
+/**
+* Get statistics of a source on a CPU
+* @param cpu - CPU index
+* @param nr - SOFTIRQ_*
+* @return statistics
+*/
+softirq_stat_t *softirq_stat(uint64 cpu, uint64 nr);
+/**
+* Get the overflow thread of a CPU
+* @param cpu - CPU index
+* @return thread or null before softirq_init_threads()
+*/
+struct thread_struct *softirq_thread_on(uint64 cpu);
+/**
+* Initialize a tasklet
+* @param tasklet - tasklet
+* @param func - function
+* @param data - function argument
+*/
+void tasklet_init(tasklet_t *tasklet, tasklet_func_t func, uint64 data);
+/**
+* Queue a tasklet on the calling CPU (does nothing if it's already queued)
+* @param tasklet - tasklet
+*/
+void tasklet_schedule(tasklet_t *tasklet);
+/**
+* Queue a high priority tasklet on the calling CPU
+* @param tasklet - tasklet
+*/
+void tasklet_hi_schedule(tasklet_t *tasklet);
+#if DEBUG == 1
+/**
+* List time spent per source and CPU on screen
+*/
+void softirq_list();
+#endif
+
+#endif /* __softirq_h */
@@ -0,0 +1,120 @@
+/*
+
+Spinlocks
+=========
+
+Busy-waiting locks for short critical sections shared between CPUs
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __spinlock_h
+#define __spinlock_h
+
+#include "common.h"
+#include "preempt.h"
+#include "irqstat.h"
+
+/**
+* Spinlock (0 - free, 1 - taken)
+* Holder of a spinlock can't be preempted
+*/
+typedef uint64 volatile spinlock_t;
+
+#define SPINLOCK_INIT 0
+
+/**
+* Acquire a spinlock
+* @param lock - spinlock
+* @return void
+*/
+static void spinlock_lock(spinlock_t *lock){
+	preempt_disable();
+	while (__sync_lock_test_and_set(lock, 1)){
+		// Spin on a plain read, so the cache line is not bounced between CPUs
+		while (*lock){
+			asm volatile("pause");
+		}
+	}
+}
+/**
+* Try to acquire a spinlock without waiting
+* @param lock - spinlock
+* @return true if lock has been acquired
+*/
+static bool spinlock_try(spinlock_t *lock){
+	preempt_disable();
+	if (__sync_lock_test_and_set(lock, 1) == 0){
+		return true;
+	}
+	preempt_enable();
+	return false;
+}
+/**
+* Release a spinlock
+* @param lock - spinlock
+* @return void
+*/
+static void spinlock_unlock(spinlock_t *lock){
+	__sync_lock_release(lock);
+	preempt_enable();
+}
+/**
+* Disable interrupts and acquire a spinlock
+* @param lock - spinlock
+* @return previous RFLAGS value (pass to spinlock_unlock_irq())
+*/
+static uint64 spinlock_lock_irq(spinlock_t *lock){
+	uint64 flags;
+	asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+	if (flags & 0x200){
+		irqstat_off_begin();
+	}
+	spinlock_lock(lock);
+	return flags;
+}
+/**
+* Release a spinlock and restore interrupt flag
+* @param lock - spinlock
+* @param flags - RFLAGS value returned by spinlock_lock_irq()
+* @return void
+*/
+static __NOINLINE void spinlock_unlock_irq(spinlock_t *lock, uint64 flags){
+	__sync_lock_release(lock);
+	if (flags & 0x200){
+		// Window ends in the caller (never inlined, so this is the unlock site)
+		irqstat_off_end_at((uint64)__builtin_return_address(0));
+		asm volatile("sti" : : : "memory");
+	}
+	// Pending reschedule can only be served with interrupts enabled
+	preempt_enable();
+}
+
+#endif /* __spinlock_h */
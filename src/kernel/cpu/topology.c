@@ -0,0 +1,164 @@
+/*
+
+CPU topology
+============
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "topology.h"
+#include "cpuid.h"
+#include "apic.h"
+#include "percpu.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+/**
+* Number of low APIC ID bits that select a unit within each level
+*/
+static uint64 _shift[TOPO_LEVEL_COUNT];
+/**
+* Sharing masks by CPU and level
+*/
+static uint64 _masks[CPU_MAX][TOPO_LEVEL_COUNT];
+
+/**
+* Bits needed to number count units
+*/
+static uint64 topology_bits(uint64 count){
+	uint64 bits = 0;
+	while ((1ULL << bits) < count){
+		bits ++;
+	}
+	return bits;
+}
+/**
+* Read APIC ID layout of cores and packages
+*/
+static void topology_read_levels(){
+	uint32 eax, ebx, ecx, edx;
+	uint32 max;
+	uint32 sub;
+	cpuid(0, &max, &ebx, &ecx, &edx);
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	// Legacy: logical processors per package, no hyper-thread information
+	_shift[TOPO_SMT] = 0;
+	_shift[TOPO_PACKAGE] = topology_bits((ebx >> 16) & 0xFF);
+	if (max >= 0xB){
+		// Extended topology - sub-leaves go from SMT outwards until the type is invalid
+		for (sub = 0; sub < 8; sub ++){
+			cpuid_count(0xB, sub, &eax, &ebx, &ecx, &edx);
+			if (((ecx >> 8) & 0xFF) == 0){
+				break;
+			}
+			if (((ecx >> 8) & 0xFF) == 1){
+				_shift[TOPO_SMT] = (eax & 0x1F);
+			}
+			// Last valid level (core) shifts out the package ID
+			_shift[TOPO_PACKAGE] = (eax & 0x1F);
+		}
+	}
+	// Without cache information assume private L2 per core and L3 per package
+	_shift[TOPO_L2] = _shift[TOPO_SMT];
+	_shift[TOPO_L3] = _shift[TOPO_PACKAGE];
+	if (max >= 4){
+		// Deterministic cache parameters - sub-leaves until the cache type is null
+		for (sub = 0; sub < 16; sub ++){
+			cpuid_count(4, sub, &eax, &ebx, &ecx, &edx);
+			if ((eax & 0x1F) == 0){
+				break;
+			}
+			if (((eax >> 5) & 0x7) == 2){
+				_shift[TOPO_L2] = topology_bits(((eax >> 14) & 0xFFF) + 1);
+			} else if (((eax >> 5) & 0x7) == 3){
+				_shift[TOPO_L3] = topology_bits(((eax >> 14) & 0xFFF) + 1);
+			}
+		}
+	}
+}
+
+void topology_init(){
+	uint64 count = apic_cpu_count();
+	uint64 i, j, l;
+	uint8 a, b;
+	topology_read_levels();
+	mem_fill((uint8 *)_masks, sizeof(_masks), 0);
+	if (count > CPU_MAX){
+		count = CPU_MAX;
+	}
+	for (i = 0; i < CPU_MAX; i ++){
+		for (l = 0; l < TOPO_LEVEL_COUNT; l ++){
+			_masks[i][l] = (1ULL << i);
+		}
+	}
+	for (i = 0; i < count; i ++){
+		a = apic_cpu_apic_id(i);
+		for (j = 0; j < count; j ++){
+			b = apic_cpu_apic_id(j);
+			for (l = 0; l < TOPO_LEVEL_COUNT; l ++){
+				if ((a >> _shift[l]) == (b >> _shift[l])){
+					_masks[i][l] |= (1ULL << j);
+				}
+			}
+		}
+	}
+}
+uint64 topology_mask(uint64 cpu, uint64 level){
+	if (cpu >= CPU_MAX || level >= TOPO_LEVEL_COUNT){
+		return 0;
+	}
+	return _masks[cpu][level];
+}
+uint64 topology_distance(uint64 a, uint64 b){
+	uint64 l;
+	if (a >= CPU_MAX || b >= CPU_MAX){
+		return TOPO_LEVEL_COUNT;
+	}
+	for (l = 0; l < TOPO_LEVEL_COUNT; l ++){
+		if (_masks[a][l] & (1ULL << b)){
+			return l;
+		}
+	}
+	return TOPO_LEVEL_COUNT;
+}
+
+#if DEBUG == 1
+void topology_list(){
+	uint64 count = apic_cpu_count();
+	uint64 i;
+	debug_print(DC_WB, "APIC ID shifts: smt %d, L2 %d, L3 %d, package %d", _shift[TOPO_SMT], _shift[TOPO_L2], _shift[TOPO_L3], _shift[TOPO_PACKAGE]);
+	for (i = 0; i < count && i < CPU_MAX; i ++){
+		debug_print(DC_WB, "cpu %d apic %d: smt %x, L2 %x, L3 %x, pkg %x", i, (uint64)apic_cpu_apic_id(i), _masks[i][TOPO_SMT], _masks[i][TOPO_L2], _masks[i][TOPO_L3], _masks[i][TOPO_PACKAGE]);
+	}
+}
+#endif
@@ -0,0 +1,77 @@
+/*
+
+CPU topology
+============
+
+Cache and core sharing masks of CPUs (CPUID leaf 4 and 0xB, Local APIC IDs from MADT)
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __topology_h
+#define __topology_h
+
+#include "common.h"
+#include "../config.h"
+
+// Topology levels (from the closest to the widest)
+#define TOPO_SMT			0	// Hyper-threads of a core
+#define TOPO_L2				1	// CPUs sharing an L2 cache
+#define TOPO_L3				2	// CPUs sharing an L3 cache
+#define TOPO_PACKAGE		3	// CPUs of a package
+#define TOPO_LEVEL_COUNT	4
+
+/**
+* Detect topology and build sharing masks of all CPUs listed in MADT (after apic_init())
+*/
+void topology_init();
+/**
+* Get CPUs sharing a topology level with a CPU
+* @param cpu - CPU index
+* @param level - TOPO_* level
+* @return bit mask of CPU indexes (the CPU itself included)
+*/
+uint64 topology_mask(uint64 cpu, uint64 level);
+/**
+* Get the closest topology level two CPUs share
+* @param a - CPU index
+* @param b - CPU index
+* @return TOPO_* level or TOPO_LEVEL_COUNT if they share nothing
+*/
+uint64 topology_distance(uint64 a, uint64 b);
+
+#if DEBUG == 1
+/**
+* List APIC ID shifts and sharing masks on screen
+*/
+void topology_list();
+#endif
+
+#endif /* __topology_h */
@@ -41,8 +41,25 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "io.h"
 #include "interrupts.h"
 #include "paging.h"
+#include "tlb.h"
+#include "percpu.h"
+#include "gdt.h"
+#include "fpu.h"
 #include "acpi.h"
 #include "apic.h"
+#include "topology.h"
+#include "clock.h"
+#include "timer.h"
+#include "vdso.h"
+#include "sched.h"
+#include "pool.h"
+#include "sync.h"
+#include "idle.h"
+#include "softirq.h"
+#include "rcu.h"
+#include "cpufeature.h"
+#include "irqstat.h"
+#include "syscall.h"
 #include "pci.h"
 #include "ahci.h"
 #if DEBUG == 1
@@ -61,10 +78,24 @@ void kmain(){
 	debug_print(DC_WB, "Long mode");
 #endif
 
+	// Detect CPU features and bind CPU specific routines
+	cpu_feature_init();
+	// Initialize per-CPU data of the bootstrap processor
+	percpu_init(0);
+	// Replace loader's GDT (adds user segments and TSS)
+	gdt_init_cpu();
+	// Enable SSE/AVX and thread FPU state switching
+	fpu_init(FPU_MODE_EAGER);
 	// Initialize paging (well, actually re-initialize)
 	page_init();
 	// Initialize interrupts
 	interrupt_init();
+	// Initialize TLB shootdown
+	tlb_init();
+	// Initialize system calls
+	syscall_init();
+	// Initialize deferred interrupt work
+	softirq_init();
 	
 #if DEBUG == 1
 	// Show memory ammount
@@ -75,10 +106,25 @@ void kmain(){
 	// Initialize ACPI
 	if (acpi_init()){
 #if DEBUG == 1
+		//cpu_feature_list();
 		//acpi_list();
 #endif
 		// Initialize APIC
 		apic_init();
+		// Cache and core sharing of CPUs (for load balancing)
+		topology_init();
+#if DEBUG == 1
+		//topology_list();
+#endif
+		// Initialize clock sources (HPET is described by ACPI)
+		clock_init();
+#if DEBUG == 1
+		//clock_list();
+#endif
+		// Export clock parameters to user mode
+		vdso_init();
+		// Initialize kernel timers
+		timer_init();
 		// Initialize PCI
 		pci_init();
 #if DEBUG == 1
@@ -100,6 +146,48 @@ void kmain(){
 	//char *xyz = (char *)0xFFFFFFFF;
 	//*xyz = 'A';
 	
-	// Infinite loop
-	while(true){}
+	// Initialize scheduler (this becomes the "kmain" thread)
+	sched_init();
+	// Start per-CPU softirq threads
+	softirq_init_threads();
+	// Start AHCI error recovery threads
+	ahci_init_threads();
+	// Initialize RCU callbacks and grace period timer
+	rcu_init();
+	// Enable interrupts
+	asm volatile("sti");
+
+#if DEBUG == 1
+	// Wake-up latency benchmark: 10000 periods of 1ms with 4 load threads
+	//sched_bench(10000, 1000000, 4);
+	//sched_list();
+	// Fork/join benchmark: reserve all the other CPUs for workers, 16 nodes per period
+	//pool_init(cpu_online_mask());
+	//pool_bench(10000, 16);
+	// Mutex benchmark: 100000 lock/unlock pairs, 4 contending threads
+	//sync_bench(100000, 4);
+	// System call benchmark: 100000 round trips from user mode
+	//syscall_bench(100000);
+	// Time page benchmark: 100000 reads
+	//vdso_bench(100000);
+	// FPU switch benchmark: 100000 switches per mode
+	//fpu_bench(100000);
+	// Time spent in deferred interrupt work per source
+	//softirq_list();
+	// Interrupt counts, handler duration percentiles and longest interrupts-off windows
+	//irqstat_list();
+	// Idle state residency
+	//idle_list();
+	// Load balancing benchmark: 2000 short-lived threads, longest one spins 1000000 times
+	//sched_balance_bench(2000, 1000000);
+	// Isolation jitter benchmark: isolate CPU 1, 10000 periods of 32 samples at 48kHz, 4 load threads
+	//sched_iso_bench(1, 10000, 4);
+	// AHCI devices and queue statistics
+	//ahci_list();
+	// AHCI read throughput: 64MB from device 0 at queue depth 1 and 32
+	//ahci_bench(0, 0x4000000, 32);
+#endif
+
+	// Boot thread is done - idle thread takes over
+	thread_exit();
 }
@@ -35,6 +35,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "../config.h"
 #include "paging.h"
+#include "tlb.h"
 #include "lib.h"
 #if DEBUG == 1
 	#include "debug_print.h"
@@ -341,6 +342,25 @@ uint64 page_map_mmio(uint64 paddr){
 	}	
 	return va.raw;
 }
+void page_set_user(uint64 vaddr, bool user){
+	pm_t pe;
+	uint8 level;
+	tlb_batch_begin();
+	// Upper levels only have to permit the access, the page entry decides
+	if (user){
+		for (level = 3; level > 0; level --){
+			pe = page_get_pml_entry(vaddr, level);
+			if (!pe.s.user){
+				pe.s.user = 1;
+				page_set_pml_entry(vaddr, level, pe);
+			}
+		}
+	}
+	pe = page_get_pml_entry(vaddr, 0);
+	pe.s.user = (user ? 1 : 0);
+	page_set_pml_entry(vaddr, 0, pe);
+	tlb_batch_end();
+}
 uint64 page_resolve(uint64 vaddr){
 	vaddr_t va;
 	uint64 paddr = 0;
@@ -385,17 +405,45 @@ void page_set_pml_entry(uint64 vaddr, uint8 level, pm_t pe){
 	vaddr_t va;
 	va.raw = page_normalize_vaddr(vaddr);
 	pm_t *table = _pml4;
+	pm_t *entry;
+	pm_t old;
+	pm_t grant;
+	uint64 diff;
+	uint64 size;
 	if (level >= 3){
-		table[va.s.drawer_idx].raw = pe.raw;
+		level = 3;
+		entry = &table[va.s.drawer_idx];
+	} else {
+		table = (pm_t *)(table[va.s.drawer_idx].raw & PAGE_MASK);
+		if (level == 2){
+			entry = &table[va.s.directory_idx];
+		} else {
+			table = (pm_t *)(table[va.s.directory_idx].raw & PAGE_MASK);
+			if (level == 1){
+				entry = &table[va.s.table_idx];
+			} else {
+				table = (pm_t *)(table[va.s.table_idx].raw & PAGE_MASK);
+				entry = &table[va.s.page_idx];
+			}
+		}
 	}
-	table = (pm_t *)(table[va.s.drawer_idx].raw & PAGE_MASK);
-	if (level == 2){
-		table[va.s.directory_idx].raw = pe.raw;
+	old = *entry;
+	entry->raw = pe.raw;
+	// Entries that weren't present can't be cached
+	if (!old.s.present || old.raw == pe.raw){
+		return;
 	}
-	table = (pm_t *)(table[va.s.directory_idx].raw & PAGE_MASK);
-	if (level == 1){
-		table[va.s.table_idx].raw = pe.raw;
+	// Entry covers 4KB, 2MB, 1GB or 512GB
+	size = ((uint64)PAGE_SIZE) << (9 * level);
+	grant.raw = 0;
+	grant.s.writable = 1;
+	grant.s.user = 1;
+	diff = pe.raw ^ old.raw;
+	if (level > 0 && (diff & ~grant.raw) == 0 && (diff & old.raw) == 0){
+		// Upper level only grants more rights - pages below keep the rights of their own entries,
+		// and INVLPG of the page drops cached upper levels as well
+		size = PAGE_SIZE;
 	}
-	table = (pm_t *)(table[va.s.table_idx].raw & PAGE_MASK);
-	table[va.s.page_idx].raw = pe.raw;
+	va.raw &= ~(size - 1);
+	tlb_flush_range(TLB_KERNEL, va.raw, va.raw + size);
 }
@@ -104,6 +104,12 @@ uint64 page_map(uint64 paddr);
 */
 uint64 page_map_mmio(uint64 paddr);
 /**
+* Allow or deny user mode access to a page
+* @param vaddr - virtual address within the page
+* @param user - true to allow user mode access
+*/
+void page_set_user(uint64 vaddr, bool user);
+/**
 * Resolve physical address from virtual addres
 * @param vaddr - virtual address to resolve
 * @return physical address
@@ -119,6 +125,8 @@ uint64 page_resolve(uint64 vaddr);
 pm_t page_get_pml_entry(uint64 vaddr, uint8 level);
 /**
 * Set the PML4 entry for virtual address
+* Changing or removing a present entry flushes it from all CPUs, wrap several
+* changes in tlb_batch_begin() and tlb_batch_end() to send one shootdown
 * @param vaddr - virtual address
 * @param level - zero based level (0-3 for PML4 paging)
 * @param pe - PML4 entry
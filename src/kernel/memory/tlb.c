@@ -0,0 +1,346 @@
+/*
+
+TLB shootdown
+=============
+
+Every CPU has an invalidation queue. Initiator merges its ranges into queues of
+target CPUs, sends a single IPI per CPU (unless one is already pending) and waits
+until every target has acknowledged the request generation it was given.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "tlb.h"
+#include "paging.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "apic.h"
+#include "msr.h"
+#include "interrupts.h"
+#include "preempt.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+/**
+* Virtual address range [start, end)
+*/
+typedef struct {
+	uint64 start;
+	uint64 end;
+} tlb_range_t;
+/**
+* Range list (queue of a target CPU or a batch of the initiator)
+*/
+typedef struct {
+	uint64 count;
+	bool full;								// Range list overflowed - flush everything
+	tlb_range_t ranges[TLB_QUEUE_SIZE];
+} tlb_queue_t;
+/**
+* Per-CPU shootdown state
+*/
+struct tlb_cpu_struct {
+	spinlock_t lock;						// Protects queue, req and ipi_pending
+	tlb_queue_t queue;						// Invalidations requested by other CPUs
+	uint64 req;								// Last request generation queued
+	uint64 volatile ack;					// Last request generation processed
+	bool ipi_pending;						// IPI sent, but queue not yet processed
+	uint64 batch_depth;						// Nesting level of tlb_batch_begin()
+	tlb_space_t *batch_space;				// Address space of the pending batch
+	bool batch_used;						// Batch holds something
+	tlb_queue_t batch;						// Outgoing invalidations of this CPU
+	tlb_stats_t stats;
+} __ALIGN(64);
+typedef struct tlb_cpu_struct tlb_cpu_t;
+
+static tlb_cpu_t _tlb[CPU_MAX];
+
+/**
+* Invalidate single page on the calling CPU
+*/
+static void tlb_invalidate(uint64 vaddr){
+	asm volatile("invlpg (%0)" : : "r"(vaddr) : "memory");
+}
+/**
+* Flush all non-global TLB entries on the calling CPU
+*/
+static void tlb_invalidate_all(){
+	uint64 cr3;
+	asm volatile("mov %%cr3, %0" : "=r"(cr3));
+	asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+/**
+* Add range to the list, merging it with the last one if they overlap or touch
+*/
+static void tlb_queue_add(tlb_queue_t *list, uint64 start, uint64 end){
+	tlb_range_t *last;
+	if (list->full){
+		return;
+	}
+	if (((end - start) / PAGE_SIZE) > TLB_FULL_FLUSH_PAGES){
+		list->full = true;
+		list->count = 0;
+		return;
+	}
+	if (list->count > 0){
+		last = &list->ranges[list->count - 1];
+		if (start <= last->end && end >= last->start){
+			if (start < last->start){
+				last->start = start;
+			}
+			if (end > last->end){
+				last->end = end;
+			}
+			if (((last->end - last->start) / PAGE_SIZE) > TLB_FULL_FLUSH_PAGES){
+				list->full = true;
+				list->count = 0;
+			}
+			return;
+		}
+	}
+	if (list->count == TLB_QUEUE_SIZE){
+		list->full = true;
+		list->count = 0;
+		return;
+	}
+	list->ranges[list->count].start = start;
+	list->ranges[list->count].end = end;
+	list->count ++;
+}
+/**
+* Apply range list on the calling CPU
+*/
+static void tlb_queue_apply(tlb_queue_t *list, tlb_stats_t *stats){
+	uint64 i;
+	uint64 vaddr;
+	if (list->full){
+		tlb_invalidate_all();
+		stats->full_flushes ++;
+		return;
+	}
+	for (i = 0; i < list->count; i ++){
+		for (vaddr = list->ranges[i].start; vaddr < list->ranges[i].end; vaddr += PAGE_SIZE){
+			tlb_invalidate(vaddr);
+			stats->pages ++;
+		}
+	}
+}
+/**
+* Process invalidations queued for the calling CPU
+*/
+static void tlb_process(){
+	tlb_cpu_t *cpu = &_tlb[cpu_id()];
+	tlb_queue_t list;
+	uint64 req;
+	uint64 flags = spinlock_lock_irq(&cpu->lock);
+	if (cpu->ack == cpu->req){
+		spinlock_unlock_irq(&cpu->lock, flags);
+		return;
+	}
+	list = cpu->queue;
+	req = cpu->req;
+	cpu->queue.count = 0;
+	cpu->queue.full = false;
+	cpu->ipi_pending = false;
+	spinlock_unlock(&cpu->lock);
+	// Interrupts stay disabled, so acknowledgements can't go backwards
+	tlb_queue_apply(&list, &cpu->stats);
+	cpu->stats.received ++;
+	cpu->ack = req;
+	if (flags & 0x200){
+		irqstat_off_end();
+		asm volatile("sti" : : : "memory");
+	}
+}
+/**
+* TLB shootdown IPI handler
+*/
+static uint64 tlb_ipi_handler(int_stack_t *stack){
+	tlb_process();
+	return 0;
+}
+/**
+* Invalidate range list on the calling CPU and every other CPU using the address space
+* (preemption disabled, so the calling CPU doesn't change)
+*/
+static void tlb_shootdown(tlb_space_t *space, tlb_queue_t *list){
+	uint64 self = cpu_id();
+	tlb_cpu_t *cpu = &_tlb[self];
+	uint64 target[CPU_MAX];
+	uint64 mask;
+	uint64 i;
+	uint64 r;
+	uint64 flags;
+	uint64 start;
+	uint64 cycles;
+	bool send;
+	if (space == TLB_KERNEL){
+		mask = cpu_online_mask();
+	} else {
+		mask = space->cpus;
+	}
+	if (mask & (1ULL << self)){
+		tlb_queue_apply(list, &cpu->stats);
+	}
+	// CPUs that have never loaded this address space can't have it cached
+	mask &= cpu_online_mask() & ~(1ULL << self);
+	if (mask == 0){
+		return;
+	}
+	start = rdtsc();
+	for (i = 0; i < CPU_MAX; i ++){
+		if ((mask & (1ULL << i)) == 0){
+			continue;
+		}
+		flags = spinlock_lock_irq(&_tlb[i].lock);
+		if (list->full){
+			_tlb[i].queue.full = true;
+			_tlb[i].queue.count = 0;
+		} else {
+			for (r = 0; r < list->count; r ++){
+				tlb_queue_add(&_tlb[i].queue, list->ranges[r].start, list->ranges[r].end);
+			}
+		}
+		target[i] = ++ _tlb[i].req;
+		// Target hasn't processed the previous IPI yet - it will pick this request up as well
+		send = !_tlb[i].ipi_pending;
+		_tlb[i].ipi_pending = true;
+		spinlock_unlock_irq(&_tlb[i].lock, flags);
+		if (send){
+			apic_send_ipi((uint8)percpu_get(i)->apic_id, INT_VECTOR_TLB);
+			cpu->stats.ipis ++;
+		}
+	}
+	for (i = 0; i < CPU_MAX; i ++){
+		if ((mask & (1ULL << i)) == 0){
+			continue;
+		}
+		while (_tlb[i].ack < target[i]){
+			// Serve requests aimed at us, in case the target is waiting for us too
+			tlb_process();
+			asm volatile("pause");
+		}
+	}
+	cycles = rdtsc() - start;
+	cpu->stats.shootdowns ++;
+	cpu->stats.cycles_total += cycles;
+	if (cycles > cpu->stats.cycles_max){
+		cpu->stats.cycles_max = cycles;
+	}
+}
+/**
+* Send the pending batch of the calling CPU
+*/
+static void tlb_batch_flush(tlb_cpu_t *cpu){
+	if (cpu->batch_used){
+		tlb_shootdown(cpu->batch_space, &cpu->batch);
+		cpu->batch_used = false;
+		cpu->batch.count = 0;
+		cpu->batch.full = false;
+	}
+}
+
+void tlb_init(){
+	mem_fill((uint8 *)_tlb, sizeof(_tlb), 0);
+	interrupt_reg_handler(INT_VECTOR_TLB, tlb_ipi_handler);
+}
+void tlb_space_enter(tlb_space_t *space){
+	__sync_fetch_and_or(&space->cpus, (1ULL << cpu_id()));
+}
+void tlb_space_leave(tlb_space_t *space){
+	// Loading another CR3 drops all non-global entries of this address space
+	__sync_fetch_and_and(&space->cpus, ~(1ULL << cpu_id()));
+}
+void tlb_flush_range(tlb_space_t *space, uint64 start, uint64 end){
+	tlb_cpu_t *cpu;
+	preempt_disable();
+	cpu = &_tlb[cpu_id()];
+	start &= PAGE_MASK;
+	// Isolated CPUs flush right away - one short shootdown per call instead of a long one at batch end
+	if (cpu->batch_depth > 0 && !(cpu_isolated_mask() & (1ULL << cpu_id()))){
+		if (cpu->batch_used && cpu->batch_space != space){
+			tlb_batch_flush(cpu);
+		}
+		cpu->batch_space = space;
+		cpu->batch_used = true;
+		tlb_queue_add(&cpu->batch, start, end);
+	} else {
+		tlb_queue_t list;
+		list.count = 0;
+		list.full = false;
+		tlb_queue_add(&list, start, end);
+		tlb_shootdown(space, &list);
+	}
+	preempt_enable();
+}
+void tlb_batch_begin(){
+	// Batch belongs to this CPU - stay on it until tlb_batch_end()
+	preempt_disable();
+	_tlb[cpu_id()].batch_depth ++;
+}
+void tlb_batch_end(){
+	tlb_cpu_t *cpu = &_tlb[cpu_id()];
+	if (cpu->batch_depth > 0){
+		cpu->batch_depth --;
+		if (cpu->batch_depth == 0){
+			tlb_batch_flush(cpu);
+		}
+		preempt_enable();
+	}
+}
+void tlb_stats(tlb_stats_t *stats){
+	uint64 i;
+	mem_fill((uint8 *)stats, sizeof(tlb_stats_t), 0);
+	for (i = 0; i < CPU_MAX; i ++){
+		stats->shootdowns += _tlb[i].stats.shootdowns;
+		stats->ipis += _tlb[i].stats.ipis;
+		stats->received += _tlb[i].stats.received;
+		stats->full_flushes += _tlb[i].stats.full_flushes;
+		stats->pages += _tlb[i].stats.pages;
+		stats->cycles_total += _tlb[i].stats.cycles_total;
+		if (_tlb[i].stats.cycles_max > stats->cycles_max){
+			stats->cycles_max = _tlb[i].stats.cycles_max;
+		}
+	}
+}
+#if DEBUG == 1
+void tlb_list(){
+	tlb_stats_t stats;
+	tlb_stats(&stats);
+	debug_print(DC_WB, "TLB shootdowns: %d, IPIs: %d, received: %d", stats.shootdowns, stats.ipis, stats.received);
+	debug_print(DC_WB, "TLB pages: %d, full flushes: %d", stats.pages, stats.full_flushes);
+	if (stats.shootdowns > 0){
+		debug_print(DC_WB, "TLB wait avg: %d, max: %d cycles", stats.cycles_total / stats.shootdowns, stats.cycles_max);
+	}
+}
+#endif
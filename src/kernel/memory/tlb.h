@@ -0,0 +1,116 @@
+/*
+
+TLB shootdown
+=============
+
+Keeps TLBs of all CPUs coherent with page table changes using IPIs
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __tlb_h
+#define __tlb_h
+
+#include "common.h"
+#include "../config.h"
+
+// Number of ranges queued per CPU before falling back to a full flush
+#define TLB_QUEUE_SIZE 16
+// Number of pages above which a full flush is cheaper than INVLPG on every page
+#define TLB_FULL_FLUSH_PAGES 33
+
+/**
+* Address space
+*/
+typedef struct {
+	uint64 cr3;					// Physical address of PML4
+	uint64 volatile cpus;		// Mask of CPUs that have this address space loaded
+} tlb_space_t;
+/**
+* Shared kernel mappings - present in every address space, so all online CPUs are targeted
+*/
+#define TLB_KERNEL null
+/**
+* Shootdown statistics
+*/
+typedef struct {
+	uint64 shootdowns;			// Shootdowns that required remote CPUs
+	uint64 ipis;				// IPIs sent
+	uint64 received;			// Remote requests processed
+	uint64 full_flushes;		// Full TLB flushes
+	uint64 pages;				// Pages invalidated with INVLPG
+	uint64 cycles_total;		// Total time spent waiting for remote CPUs (TSC cycles)
+	uint64 cycles_max;			// Longest wait for remote CPUs (TSC cycles)
+} tlb_stats_t;
+
+/**
+* Initialize TLB shootdown (call after APIC has been initialized)
+*/
+void tlb_init();
+/**
+* Mark address space loaded on the calling CPU (call when loading CR3)
+* @param space - address space
+*/
+void tlb_space_enter(tlb_space_t *space);
+/**
+* Mark address space unloaded on the calling CPU (call before loading another CR3)
+* @param space - address space
+*/
+void tlb_space_leave(tlb_space_t *space);
+/**
+* Invalidate a range of virtual addresses on every CPU that might have cached it
+* Inside a batch the range is only queued and sent by tlb_batch_end()
+* @param space - address space or TLB_KERNEL
+* @param start - first virtual address
+* @param end - virtual address after the range
+*/
+void tlb_flush_range(tlb_space_t *space, uint64 start, uint64 end);
+/**
+* Start collecting invalidations into a single shootdown (batches can be nested)
+* Disables preemption until the matching tlb_batch_end()
+*/
+void tlb_batch_begin();
+/**
+* Send invalidations collected since tlb_batch_begin()
+*/
+void tlb_batch_end();
+/**
+* Get shootdown statistics summed over all CPUs
+* @param [out] stats - statistics
+*/
+void tlb_stats(tlb_stats_t *stats);
+#if DEBUG == 1
+/**
+* List shootdown statistics on screen
+*/
+void tlb_list();
+#endif
+
+#endif /* __tlb_h */
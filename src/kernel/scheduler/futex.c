@@ -0,0 +1,158 @@
+/*
+
+Futex wait queues
+=================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "futex.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "timer.h"
+
+/**
+* Waiting thread (lives on the waiter's stack)
+*/
+struct futex_waiter_struct {
+	struct futex_waiter_struct *next;
+	struct futex_waiter_struct *prev;
+	uint32 *addr;						// Word waited on
+	thread_t *thread;					// Waiting thread
+	bool volatile queued;				// Cleared by futex_wake()
+};
+typedef struct futex_waiter_struct futex_waiter_t;
+/**
+* Hashed wait queue
+*/
+struct futex_bucket_struct {
+	spinlock_t lock;
+	futex_waiter_t *head;
+	futex_waiter_t *tail;
+} __ALIGN(64);
+typedef struct futex_bucket_struct futex_bucket_t;
+
+static futex_bucket_t _buckets[FUTEX_BUCKETS];
+
+/**
+* Get the wait queue of a word
+* @param addr - address of the word
+* @return bucket
+*/
+static futex_bucket_t *futex_bucket(uint32 *addr){
+	// Fibonacci hashing spreads neighbouring words over all buckets
+	uint64 h = ((uint64)addr >> 2) * 0x9E3779B97F4A7C15ULL;
+	return &_buckets[h >> (64 - FUTEX_HASH_BITS)];
+}
+/**
+* Remove a waiter from its queue (bucket lock must be held)
+*/
+static void futex_unlink(futex_bucket_t *b, futex_waiter_t *w){
+	if (w->prev != null){
+		w->prev->next = w->next;
+	} else {
+		b->head = w->next;
+	}
+	if (w->next != null){
+		w->next->prev = w->prev;
+	} else {
+		b->tail = w->prev;
+	}
+}
+
+uint64 futex_wait(uint32 *addr, uint32 val, uint64 deadline){
+	futex_bucket_t *b = futex_bucket(addr);
+	futex_waiter_t w;
+	thread_t *t = thread_current();
+	uint64 ret = FUTEX_OK;
+	uint64 flags;
+	w.addr = addr;
+	w.thread = t;
+	w.queued = true;
+	w.next = null;
+	flags = spinlock_lock_irq(&b->lock);
+	// Waker changes the word before taking the bucket lock, so it can't be missed
+	if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val){
+		spinlock_unlock_irq(&b->lock, flags);
+		return FUTEX_AGAIN;
+	}
+	w.prev = b->tail;
+	if (b->tail != null){
+		b->tail->next = &w;
+	} else {
+		b->head = &w;
+	}
+	b->tail = &w;
+	spinlock_unlock_irq(&b->lock, flags);
+	if (deadline != 0){
+		timer_add(&t->timer, deadline);
+	}
+	while (true){
+		thread_block_prepare();
+		// Wake-ups that happened before prepare were lost - check both conditions again
+		if (!w.queued || (deadline != 0 && clock_monotonic_ns() >= deadline)){
+			thread_wake(t);
+			break;
+		}
+		thread_block();
+	}
+	if (deadline != 0){
+		timer_cancel(&t->timer);
+	}
+	// Also waits for futex_wake() to finish with our waiter before it goes out of scope
+	flags = spinlock_lock_irq(&b->lock);
+	if (w.queued){
+		futex_unlink(b, &w);
+		ret = FUTEX_TIMEOUT;
+	}
+	spinlock_unlock_irq(&b->lock, flags);
+	return ret;
+}
+uint64 futex_wake(uint32 *addr, uint64 count){
+	futex_bucket_t *b = futex_bucket(addr);
+	futex_waiter_t *w;
+	futex_waiter_t *next;
+	uint64 woken = 0;
+	uint64 flags;
+	flags = spinlock_lock_irq(&b->lock);
+	for (w = b->head; w != null && woken < count; w = next){
+		next = w->next;
+		if (w->addr == addr){
+			futex_unlink(b, w);
+			w->queued = false;
+			thread_wake(w->thread);
+			woken ++;
+		}
+	}
+	spinlock_unlock_irq(&b->lock, flags);
+	return woken;
+}
@@ -0,0 +1,72 @@
+/*
+
+Futex wait queues
+=================
+
+Wait on a 32-bit word while it holds an expected value and wake up waiters
+of that word. Waiters are kept in wait queues hashed by the word's address.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __futex_h
+#define __futex_h
+
+#include "common.h"
+
+// Number of hashed wait queues
+#define FUTEX_HASH_BITS		6
+#define FUTEX_BUCKETS		(1 << FUTEX_HASH_BITS)
+// Wake all waiters
+#define FUTEX_WAKE_ALL		((uint64)-1)
+// futex_wait() results
+#define FUTEX_OK			0	// Woken by futex_wake()
+#define FUTEX_AGAIN			1	// Word did not hold the expected value
+#define FUTEX_TIMEOUT		2	// Deadline passed
+
+/**
+* Block the calling thread while the word holds the expected value
+* Check and enqueue are atomic with respect to futex_wake(). Callers must re-check their
+* condition on return, as the word may have changed again since the wake-up.
+* @param addr - address of the word
+* @param val - expected value
+* @param deadline - absolute monotonic clock time (ns) or 0 to wait forever
+* @return FUTEX_OK, FUTEX_AGAIN or FUTEX_TIMEOUT
+*/
+uint64 futex_wait(uint32 *addr, uint32 val, uint64 deadline);
+/**
+* Wake up threads waiting on a word (can be called from interrupt handlers)
+* @param addr - address of the word
+* @param count - maximum number of threads to wake or FUTEX_WAKE_ALL
+* @return number of threads woken
+*/
+uint64 futex_wake(uint32 *addr, uint64 count);
+
+#endif /* __futex_h */
@@ -0,0 +1,231 @@
+/*
+
+CPU idle states
+===============
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "idle.h"
+#include "percpu.h"
+#include "cpufeature.h"
+#include "cpuid.h"
+#include "clock.h"
+#include "timer.h"
+#include "msr.h"
+#include "rcu.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+// CPUID leaf 5 ECX bits
+#define IDLE_MWAIT_EXT		0x1		// MWAIT extensions are enumerated
+#define IDLE_MWAIT_IRQ		0x2		// Interrupts break MWAIT even when masked
+// Deepest C-state usable when the APIC timer stops in deeper ones (no ARAT)
+#define IDLE_NOARAT_MAX		1
+
+/**
+* Per-CPU idle governor state
+*/
+struct idle_cpu_struct {
+	uint64 predicted;					// Average idle period (ns)
+	idle_stat_t stats[IDLE_STATE_MAX];
+} __ALIGN(64);
+typedef struct idle_cpu_struct idle_cpu_t;
+
+/**
+* Wait routine
+* @param state - idle state
+*/
+typedef void (*idle_wait_t)(idle_state_t *state);
+
+/**
+* Idle states without MWAIT
+*/
+static idle_state_t _hlt_state = {"HLT", 0, 2000, 2000};
+/**
+* Wake-up latency and target residency by MWAIT C-state (no ACPI _CST, conservative defaults)
+*/
+static char *_cstate_names[7] = {"C1", "C2", "C3", "C4", "C5", "C6", "C7"};
+static uint64 _cstate_exit[7] = {2000, 10000, 80000, 130000, 150000, 250000, 1000000};
+static uint64 _cstate_residency[7] = {2000, 20000, 200000, 400000, 500000, 800000, 3000000};
+
+static idle_state_t _states[IDLE_STATE_MAX];
+static uint64 _state_count = 0;
+static idle_cpu_t _cpu[CPU_MAX];
+static uint64 _latency = 0;
+
+/**
+* Wait with HLT
+*/
+static void idle_wait_hlt(idle_state_t *state){
+	// STI takes effect after HLT, so a wake-up can't slip in between
+	asm volatile("sti; hlt" : : : "memory");
+}
+/**
+* Wait with MONITOR/MWAIT on the reschedule flag
+*/
+static void idle_wait_mwait(idle_state_t *state){
+	percpu_t *cpu = percpu_this();
+	// Remote wakers skip the IPI while this is set, writing the flag is enough
+	cpu->idle_polling = true;
+	__sync_synchronize();
+	asm volatile("monitor" : : "a"(&cpu->need_resched), "c"(0), "d"(0) : "memory");
+	if (!cpu->need_resched){
+		// STI shadow covers MWAIT, interrupts wake it up too
+		asm volatile("sti; mwait" : : "a"(state->hint), "c"(0) : "memory");
+	} else {
+		asm volatile("sti" : : : "memory");
+	}
+	cpu->idle_polling = false;
+}
+/**
+* Wait implementations
+*/
+static cpu_impl_t _wait_impls[] = {
+	{(void *)idle_wait_mwait, CPU_FEATURE_MONITOR, "mwait"},
+	{(void *)idle_wait_hlt, 0, "hlt"}
+};
+static idle_wait_t _wait = idle_wait_hlt;
+
+/**
+* Pick the deepest state that pays off within the predicted idle time
+* @param c - governor state of the calling CPU
+* @return state index
+*/
+static uint64 idle_select(idle_cpu_t *c){
+	uint64 predicted = c->predicted;
+	uint64 deadline = timer_deadline(cpu_id());
+	uint64 now;
+	uint64 i;
+	if (deadline != 0){
+		now = clock_monotonic_ns();
+		if (deadline <= now){
+			return 0;
+		}
+		if (deadline - now < predicted){
+			predicted = deadline - now;
+		}
+	}
+	for (i = _state_count - 1; i > 0; i --){
+		if (_states[i].residency_ns <= predicted && (_latency == 0 || _states[i].exit_ns <= _latency)){
+			break;
+		}
+	}
+	return i;
+}
+
+void idle_init(){
+	uint32 eax, ebx, ecx, edx;
+	uint32 max;
+	uint64 deepest;
+	uint64 n;
+	mem_fill((uint8 *)_cpu, sizeof(_cpu), 0);
+	_state_count = 0;
+	cpuid(0, &max, &ebx, &ecx, &edx);
+	if (cpu_has(CPU_FEATURE_MONITOR) && max >= 5){
+		cpuid(5, &eax, &ebx, &ecx, &edx);
+		if ((ecx & IDLE_MWAIT_EXT) && (ecx & IDLE_MWAIT_IRQ)){
+			// Without ARAT the timer interrupt would never arrive from C2+ (no broadcast timer here)
+			deepest = (cpu_has(CPU_FEATURE_ARAT) ? 7 : IDLE_NOARAT_MAX);
+			// EDX holds the number of sub-states of C0 - C7, 4 bits each
+			for (n = 1; n <= deepest && _state_count < IDLE_STATE_MAX; n ++){
+				if ((edx >> (n * 4)) & 0xF){
+					_states[_state_count].name = _cstate_names[n - 1];
+					_states[_state_count].hint = (uint32)((n - 1) << 4);
+					_states[_state_count].exit_ns = _cstate_exit[n - 1];
+					_states[_state_count].residency_ns = _cstate_residency[n - 1];
+					_state_count ++;
+				}
+			}
+		}
+	}
+	if (_state_count == 0){
+		// MWAIT C-states are not enumerated - HLT only
+		_states[0] = _hlt_state;
+		_state_count = 1;
+		_wait = idle_wait_hlt;
+	} else {
+		cpu_dispatch("idle", (void **)&_wait, _wait_impls, sizeof(_wait_impls) / sizeof(cpu_impl_t));
+	}
+}
+void idle_enter(){
+	idle_cpu_t *c = &_cpu[cpu_id()];
+	uint64 idx = idle_select(c);
+	idle_state_t *state = &_states[idx];
+	idle_stat_t *stat = &c->stats[idx];
+	uint64 start = rdtsc();
+	uint64 ns;
+	rcu_idle_enter();
+	_wait(state);
+	rcu_idle_exit();
+	start = rdtsc() - start;
+	ns = clock_tsc_to_ns(start);
+	stat->count ++;
+	stat->cycles += start;
+	if (ns < state->residency_ns){
+		stat->early ++;
+	}
+	// Exponentially weighted average of idle periods
+	c->predicted = c->predicted - (c->predicted >> IDLE_EWMA_SHIFT) + (ns >> IDLE_EWMA_SHIFT);
+}
+void idle_set_latency(uint64 ns){
+	_latency = ns;
+}
+uint64 idle_state_count(){
+	return _state_count;
+}
+idle_state_t *idle_state(uint64 idx){
+	return &_states[idx];
+}
+idle_stat_t *idle_stat(uint64 cpu, uint64 idx){
+	return &_cpu[cpu].stats[idx];
+}
+
+#if DEBUG == 1
+void idle_list(){
+	uint64 mask = cpu_online_mask();
+	idle_stat_t *s;
+	uint64 cpu;
+	uint64 i;
+	for (cpu = 0; cpu < CPU_MAX; cpu ++){
+		if (!(mask & (1ULL << cpu))){
+			continue;
+		}
+		for (i = 0; i < _state_count; i ++){
+			s = &_cpu[cpu].stats[i];
+			debug_print(DC_WB, "CPU%d %s: %d entries, %dms, %d early", cpu, _states[i].name, s->count,
+				clock_tsc_to_ns(s->cycles) / 1000000, s->early);
+		}
+	}
+}
+#endif
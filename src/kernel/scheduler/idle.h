@@ -0,0 +1,110 @@
+/*
+
+CPU idle states
+===============
+
+Idle loop of every CPU waits with MONITOR/MWAIT on its reschedule flag (HLT on
+CPUs without it), so posted work wakes it without an IPI. Wait depth is picked
+from the predicted idle time - the nearer of the next timer and the recent
+idle period average - and an exit latency limit.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __idle_h
+#define __idle_h
+
+#include "common.h"
+#include "../config.h"
+
+// Maximum number of idle states
+#define IDLE_STATE_MAX		8
+// Weight of the newest idle period in the prediction (1/2^IDLE_EWMA_SHIFT)
+#define IDLE_EWMA_SHIFT		3
+
+/**
+* Idle state
+*/
+struct idle_state_struct {
+	char *name;
+	uint32 hint;				// MWAIT hint (C-state and sub-state)
+	uint64 exit_ns;				// Wake-up latency
+	uint64 residency_ns;		// Shortest idle period that saves power
+};
+typedef struct idle_state_struct idle_state_t;
+/**
+* Residency statistics of an idle state on one CPU
+*/
+struct idle_stat_struct {
+	uint64 count;				// Times entered
+	uint64 cycles;				// Time spent in it (TSC cycles)
+	uint64 early;				// Wake-ups before target residency (mispredictions)
+};
+typedef struct idle_stat_struct idle_stat_t;
+
+/**
+* Detect idle states and bind the wait routine (MWAIT or HLT)
+*/
+void idle_init();
+/**
+* Wait for work (called by the idle thread with interrupts disabled, returns with them enabled)
+*/
+void idle_enter();
+/**
+* Limit wake-up latency of idle states (e.g. for audio processing)
+* @param ns - maximum exit latency (0 - no limit)
+*/
+void idle_set_latency(uint64 ns);
+/**
+* Get the number of idle states
+* @return state count
+*/
+uint64 idle_state_count();
+/**
+* Get an idle state
+* @param idx - state index (0 - shallowest)
+* @return state description
+*/
+idle_state_t *idle_state(uint64 idx);
+/**
+* Get residency statistics of an idle state
+* @param cpu - CPU index
+* @param idx - state index
+* @return statistics
+*/
+idle_stat_t *idle_stat(uint64 cpu, uint64 idx);
+#if DEBUG == 1
+/**
+* List idle states and their residency on screen
+*/
+void idle_list();
+#endif
+
+#endif /* __idle_h */
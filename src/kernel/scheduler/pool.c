@@ -0,0 +1,365 @@
+/*
+
+Work-stealing task pool
+=======================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "pool.h"
+#include "sched.h"
+#include "preempt.h"
+#include "percpu.h"
+#include "clock.h"
+#include "msr.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+/**
+* Chase-Lev deque (fixed size)
+* Top is written by thieves, bottom only by the owner - keep them on separate cache lines
+*/
+struct pool_deque_struct {
+	int64 top __ALIGN(64);						// Next task to steal
+	int64 bottom __ALIGN(64);					// Next free slot of the owner
+	uint64 seed;								// Victim selection state of the owner
+	pool_task_t *tasks[POOL_DEQUE_SIZE] __ALIGN(64);
+} __ALIGN(64);
+typedef struct pool_deque_struct pool_deque_t;
+
+static pool_deque_t _deques[CPU_MAX];
+static uint64 _workers = 0;
+static uint64 _mask = 0;
+
+/**
+* Push a task at the bottom (owner only, preemption disabled)
+* @return false if deque is full
+*/
+static bool pool_push(pool_deque_t *d, pool_task_t *task){
+	int64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	int64 t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	if (b - t >= POOL_DEQUE_SIZE){
+		return false;
+	}
+	d->tasks[b & (POOL_DEQUE_SIZE - 1)] = task;
+	// Task pointer has to be visible before the new bottom
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+	return true;
+}
+/**
+* Pop a task from the bottom (owner only, preemption disabled)
+* @return task or null if deque is empty
+*/
+static pool_task_t *pool_pop(pool_deque_t *d){
+	int64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	int64 t;
+	pool_task_t *task = null;
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	// Thieves must see the reserved slot before we look at the top
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+	if (t <= b){
+		task = d->tasks[b & (POOL_DEQUE_SIZE - 1)];
+		if (t == b){
+			// Last task - race against thieves for it
+			if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+				task = null;
+			}
+			__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return task;
+}
+/**
+* Steal a task from the top (any CPU)
+* @return task or null if deque is empty or another thief has won
+*/
+static pool_task_t *pool_steal(pool_deque_t *d){
+	int64 t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	int64 b;
+	pool_task_t *task;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b){
+		return null;
+	}
+	task = d->tasks[t & (POOL_DEQUE_SIZE - 1)];
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+		return null;
+	}
+	return task;
+}
+/**
+* Find a task to run - own deque first, then steal from a random victim
+* @return task or null
+*/
+static pool_task_t *pool_find(){
+	pool_deque_t *d;
+	pool_task_t *task;
+	uint64 self;
+	uint64 start;
+	uint64 victims;
+	uint64 i;
+	uint64 v;
+	preempt_disable();
+	self = cpu_id();
+	d = &_deques[self];
+	task = pool_pop(d);
+	if (task == null){
+		// Xorshift
+		d->seed ^= d->seed << 13;
+		d->seed ^= d->seed >> 7;
+		d->seed ^= d->seed << 17;
+		start = d->seed % CPU_MAX;
+		victims = cpu_online_mask() & ~(1ULL << self);
+		for (i = 0; i < CPU_MAX && task == null; i ++){
+			v = (start + i) % CPU_MAX;
+			if (victims & (1ULL << v)){
+				task = pool_steal(&_deques[v]);
+			}
+		}
+	}
+	preempt_enable();
+	return task;
+}
+/**
+* Run a task that became ready, queue it on the calling CPU's deque if possible
+*/
+static void pool_ready(pool_task_t *task);
+/**
+* Execute a task and release its successors
+*/
+static void pool_run(pool_task_t *task){
+	pool_group_t *group = task->group;
+	uint64 count = task->succ_count;
+	uint64 i;
+	task->func(task->arg);
+	for (i = 0; i < count; i ++){
+		if (__atomic_sub_fetch(&task->succ[i]->deps, 1, __ATOMIC_ACQ_REL) == 0){
+			pool_ready(task->succ[i]);
+		}
+	}
+	// Joiner may reuse the task once the group count drops
+	__atomic_sub_fetch(&group->count, 1, __ATOMIC_RELEASE);
+}
+static void pool_ready(pool_task_t *task){
+	bool queued;
+	preempt_disable();
+	queued = pool_push(&_deques[cpu_id()], task);
+	preempt_enable();
+	if (!queued){
+		pool_run(task);
+	}
+}
+/**
+* Worker thread - spins on its deque and steals when it's empty
+*/
+static void pool_worker(void *arg){
+	pool_task_t *task;
+	while (true){
+		task = pool_find();
+		if (task != null){
+			pool_run(task);
+		} else {
+			asm volatile("pause");
+		}
+	}
+}
+
+uint64 pool_init(uint64 mask){
+	uint64 i;
+	for (i = 0; i < CPU_MAX; i ++){
+		_deques[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+	}
+	mask &= cpu_online_mask() & ~(1ULL << cpu_id()) & ~_mask;
+	for (i = 0; i < CPU_MAX; i ++){
+		if ((mask & (1ULL << i)) && thread_create_on("pool", pool_worker, null, SCHED_RT, SCHED_RT_PRIO_MAX - 1, i) != null){
+			_mask |= (1ULL << i);
+			_workers ++;
+		}
+	}
+	return _workers;
+}
+uint64 pool_workers(){
+	return _workers;
+}
+void pool_group_init(pool_group_t *group){
+	group->count = 0;
+}
+void pool_task_init(pool_task_t *task, pool_func_t func, void *arg, pool_group_t *group){
+	task->func = func;
+	task->arg = arg;
+	task->group = group;
+	task->deps = 1;
+	task->succ_count = 0;
+	__atomic_add_fetch(&group->count, 1, __ATOMIC_RELAXED);
+}
+bool pool_task_depend(pool_task_t *task, pool_task_t *before){
+	if (before->succ_count == POOL_SUCC_MAX){
+		return false;
+	}
+	before->succ[before->succ_count ++] = task;
+	// Predecessors that finish concurrently decrement it
+	__atomic_add_fetch(&task->deps, 1, __ATOMIC_RELAXED);
+	return true;
+}
+void pool_submit(pool_task_t *task){
+	// Drop the submission reference - last predecessor to finish makes it ready otherwise
+	if (__atomic_sub_fetch(&task->deps, 1, __ATOMIC_ACQ_REL) == 0){
+		pool_ready(task);
+	}
+}
+void pool_join(pool_group_t *group){
+	pool_task_t *task;
+	while (__atomic_load_n(&group->count, __ATOMIC_ACQUIRE) > 0){
+		task = pool_find();
+		if (task != null){
+			pool_run(task);
+		} else {
+			asm volatile("pause");
+		}
+	}
+}
+
+#if DEBUG == 1
+// Samples per buffer (64 samples at 48kHz is a 1333us period)
+#define POOL_BENCH_SAMPLES 64
+#define POOL_BENCH_NODES_MAX 64
+
+/**
+* Benchmark state
+*/
+static struct {
+	pool_task_t tasks[POOL_BENCH_NODES_MAX + 1];
+	int32 buffers[POOL_BENCH_NODES_MAX][POOL_BENCH_SAMPLES];
+	int32 state[POOL_BENCH_NODES_MAX];
+	int32 out[POOL_BENCH_SAMPLES];
+	uint64 nodes;
+} _bench;
+
+/**
+* Empty node (pure fork/join overhead)
+*/
+static void pool_bench_empty(void *arg){
+}
+/**
+* DSP node - Q15 gain and one-pole low-pass over one buffer
+*/
+static void pool_bench_node(void *arg){
+	uint64 n = (uint64)arg;
+	int32 *buf = _bench.buffers[n];
+	int32 y = _bench.state[n];
+	uint64 i;
+	for (i = 0; i < POOL_BENCH_SAMPLES; i ++){
+		buf[i] = (int32)((((int64)i * 511 + (int64)n * 97) & 0xFFFF) - 0x8000);
+		y += (int32)((((int64)buf[i] * 26214 >> 15) - y) >> 3);
+		buf[i] = y;
+	}
+	_bench.state[n] = y;
+}
+/**
+* Mix node - sums all node buffers (fan-in)
+*/
+static void pool_bench_mix(void *arg){
+	uint64 n;
+	uint64 i;
+	for (i = 0; i < POOL_BENCH_SAMPLES; i ++){
+		_bench.out[i] = 0;
+	}
+	for (n = 0; n < _bench.nodes; n ++){
+		for (i = 0; i < POOL_BENCH_SAMPLES; i ++){
+			_bench.out[i] += _bench.buffers[n][i] >> 6;
+		}
+	}
+}
+/**
+* Run one period
+* @param node - node function
+* @param serial - call node functions directly instead of going through the pool
+* @return period duration (TSC cycles)
+*/
+static uint64 pool_bench_period(pool_func_t node, bool serial){
+	pool_group_t group;
+	pool_task_t *mix = &_bench.tasks[_bench.nodes];
+	uint64 start = rdtsc();
+	uint64 n;
+	if (serial){
+		for (n = 0; n < _bench.nodes; n ++){
+			node((void *)n);
+		}
+		pool_bench_mix(null);
+		return rdtsc() - start;
+	}
+	pool_group_init(&group);
+	pool_task_init(mix, pool_bench_mix, null, &group);
+	// Whole graph is built before the first node can run
+	for (n = 0; n < _bench.nodes; n ++){
+		pool_task_init(&_bench.tasks[n], node, (void *)n, &group);
+		pool_task_depend(mix, &_bench.tasks[n]);
+	}
+	for (n = 0; n < _bench.nodes; n ++){
+		pool_submit(&_bench.tasks[n]);
+	}
+	pool_submit(mix);
+	pool_join(&group);
+	return rdtsc() - start;
+}
+void pool_bench(uint64 periods, uint64 nodes){
+	char *names[] = {"empty fork/join", "DSP fork/join", "DSP serial"};
+	uint64 sum;
+	uint64 max;
+	uint64 t;
+	uint64 p;
+	uint64 i;
+	if (nodes == 0 || nodes > POOL_BENCH_NODES_MAX || periods == 0){
+		return;
+	}
+	mem_fill((uint8 *)&_bench, sizeof(_bench), 0);
+	_bench.nodes = nodes;
+	debug_print(DC_WB, "Pool: %d workers, %d nodes of %d samples, %d periods", _workers, nodes, POOL_BENCH_SAMPLES, periods);
+	for (i = 0; i < 3; i ++){
+		sum = 0;
+		max = 0;
+		for (p = 0; p < periods; p ++){
+			t = pool_bench_period((i == 0 ? pool_bench_empty : pool_bench_node), (i == 2));
+			sum += t;
+			if (t > max){
+				max = t;
+			}
+		}
+		debug_print(DC_WB, "%s: avg %dns, max %dns", names[i], clock_tsc_to_ns(sum / periods), clock_tsc_to_ns(max));
+	}
+}
+#endif
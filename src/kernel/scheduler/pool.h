@@ -0,0 +1,130 @@
+/*
+
+Work-stealing task pool
+=======================
+
+Fork/join execution of task graphs (e.g. DSP node graph of one audio period).
+Every CPU has a Chase-Lev deque - owner pushes and pops at the bottom, others steal
+from the top. Spinning workers are pinned to reserved CPUs, the thread that joins
+a group executes tasks too.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __pool_h
+#define __pool_h
+
+#include "common.h"
+#include "../config.h"
+
+// Deque capacity (power of 2, task runs inline when its deque is full)
+#define POOL_DEQUE_SIZE		256
+// Maximum number of successors of a task
+#define POOL_SUCC_MAX		8
+
+/**
+* Task function
+* @param arg - argument passed to pool_task_init()
+*/
+typedef void (*pool_func_t)(void *arg);
+/**
+* Group of tasks that are joined together
+*/
+struct pool_group_struct {
+	int64 count;					// Unfinished tasks
+};
+typedef struct pool_group_struct pool_group_t;
+/**
+* Task (owned by the caller, can be reused after its group is joined)
+*/
+struct pool_task_struct {
+	pool_func_t func;				// Task function
+	void *arg;						// Task function argument
+	pool_group_t *group;			// Group this task belongs to
+	int64 deps;						// Unfinished predecessors (+1 until it's submitted)
+	uint64 succ_count;				// Number of successors
+	struct pool_task_struct *succ[POOL_SUCC_MAX];	// Tasks that depend on this one
+};
+typedef struct pool_task_struct pool_task_t;
+
+/**
+* Start spinning workers on reserved CPUs
+* @param mask - CPUs to reserve (calling CPU and offline CPUs are skipped)
+* @return number of workers started
+*/
+uint64 pool_init(uint64 mask);
+/**
+* Get the number of workers
+* @return worker count
+*/
+uint64 pool_workers();
+/**
+* Prepare an empty group
+* @param group - group
+*/
+void pool_group_init(pool_group_t *group);
+/**
+* Prepare a task and add it to a group
+* @param task - task
+* @param func - task function
+* @param arg - task function argument
+* @param group - group
+*/
+void pool_task_init(pool_task_t *task, pool_func_t func, void *arg, pool_group_t *group);
+/**
+* Make a task wait for another one
+* Call before any predecessor of the task is submitted - a finished predecessor
+* would never release the new dependency
+* @param task - dependent task
+* @param before - task that has to finish first
+* @return false if before has too many successors
+*/
+bool pool_task_depend(pool_task_t *task, pool_task_t *before);
+/**
+* Submit a task - it runs as soon as all of its predecessors have finished
+* @param task - task
+*/
+void pool_submit(pool_task_t *task);
+/**
+* Execute tasks until all tasks of a group have finished
+* @param group - group
+*/
+void pool_join(pool_group_t *group);
+#if DEBUG == 1
+/**
+* Fan-out/fan-in benchmark: each period forks independent DSP nodes processing
+* one buffer, a mix node that depends on all of them, and joins
+* @param periods - number of periods
+* @param nodes - number of nodes per period (up to POOL_DEQUE_SIZE / 2)
+*/
+void pool_bench(uint64 periods, uint64 nodes);
+#endif
+
+#endif /* __pool_h */
@@ -0,0 +1,75 @@
+/*
+
+Preemption control
+==================
+
+Per-CPU preemption counter used by spinlocks and the scheduler
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __preempt_h
+#define __preempt_h
+
+#include "common.h"
+#include "percpu.h"
+
+/**
+* Run the scheduler if the calling CPU has a pending reschedule request
+* (does nothing in interrupt context, it's handled on interrupt exit)
+* @see sched.c
+*/
+void sched_preempt();
+/**
+* Disable preemption of the current thread (nests)
+*/
+static void preempt_disable(){
+	percpu_this()->preempt_count ++;
+	asm volatile("" : : : "memory");
+}
+/**
+* Enable preemption and reschedule if it was requested meanwhile
+*/
+static void preempt_enable(){
+	percpu_t *cpu = percpu_this();
+	asm volatile("" : : : "memory");
+	if (-- cpu->preempt_count == 0 && cpu->need_resched){
+		sched_preempt();
+	}
+}
+/**
+* Check if the current thread can be preempted
+* @return true if preemption is enabled
+*/
+static bool preemptible(){
+	return (percpu_this()->preempt_count == 0);
+}
+
+#endif /* __preempt_h */
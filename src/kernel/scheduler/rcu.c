@@ -0,0 +1,268 @@
+/*
+
+Read-copy-update
+================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "rcu.h"
+#include "sched.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "softirq.h"
+#include "clock.h"
+#include "timer.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "lib.h"
+
+/**
+* Per-CPU callback queue (callbacks wait for non-decreasing grace periods)
+*/
+struct rcu_cpu_struct {
+	rcu_head_t *head;
+	rcu_head_t *tail;
+} __ALIGN(64);
+typedef struct rcu_cpu_struct rcu_cpu_t;
+/**
+* synchronize_rcu() waiter
+*/
+struct rcu_waiter_struct {
+	rcu_head_t head;
+	thread_t *thread;
+	uint64 volatile done;
+};
+typedef struct rcu_waiter_struct rcu_waiter_t;
+
+static rcu_cpu_t _cpu[CPU_MAX];
+static spinlock_t _lock = SPINLOCK_INIT;
+static uint64 volatile _gp_seq = 0;			// Last started grace period
+static uint64 volatile _gp_done = 0;		// Last completed grace period
+static uint64 _gp_need = 0;					// Last requested grace period
+static uint64 volatile _gp_mask = 0;		// CPUs that still have to pass a quiescent state
+static uint64 volatile _idle_mask = 0;		// CPUs in idle
+static uint64 volatile _cb_mask = 0;		// CPUs with queued callbacks
+static timer_t _kick;
+static bool _timers = false;
+
+/**
+* Complete the grace period if the last CPU has reported, start the next one if requested
+* (_lock held)
+* @return true if a grace period has been started
+*/
+static bool rcu_advance(){
+	uint64 mask;
+	while (_gp_mask == 0){
+		if (_gp_done != _gp_seq){
+			_gp_done = _gp_seq;
+			// Interrupt exit of CPUs with callbacks runs them (this one included, once it enables interrupts)
+			mask = _cb_mask;
+			while (mask != 0){
+				apic_send_ipi((uint8)percpu_get(__builtin_ctzll(mask))->apic_id, INT_VECTOR_RESCHED);
+				mask &= (mask - 1);
+			}
+		}
+		if (_gp_need <= _gp_done){
+			return false;
+		}
+		_gp_seq ++;
+		__atomic_store_n(&_gp_mask, cpu_online_mask(), __ATOMIC_SEQ_CST);
+		// Pairs with rcu_idle_enter() - either it sees its bit or we see it idle
+		__atomic_and_fetch(&_gp_mask, ~__atomic_load_n(&_idle_mask, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+		if (_gp_mask != 0){
+			return true;
+		}
+	}
+	return false;
+}
+/**
+* Arm the holdout timer
+*/
+static void rcu_arm(){
+	if (_timers){
+		// Keep the timer interrupt off isolated CPUs
+		timer_add_on(&_kick, clock_monotonic_ns() + RCU_KICK_NS, cpu_housekeeping());
+	}
+}
+/**
+* Grace period takes too long - force holdouts through interrupt exit
+*/
+static void rcu_kick(void *arg){
+	// Isolated CPUs are left alone, they report on their next context switch
+	uint64 mask = (_gp_mask & ~(1ULL << cpu_id()) & ~cpu_isolated_mask());
+	if (_gp_mask == 0){
+		return;
+	}
+	while (mask != 0){
+		apic_send_ipi((uint8)percpu_get(__builtin_ctzll(mask))->apic_id, INT_VECTOR_RESCHED);
+		mask &= (mask - 1);
+	}
+	rcu_arm();
+}
+/**
+* Run callbacks whose grace period has completed
+*/
+static void rcu_softirq(){
+	rcu_cpu_t *c = &_cpu[cpu_id()];
+	rcu_head_t *head;
+	rcu_head_t *done = null;
+	rcu_head_t *last = null;
+	uint64 flags;
+	// Isolated CPUs queue their callbacks here as well
+	flags = spinlock_lock_irq(&_lock);
+	while (c->head != null && c->head->seq <= _gp_done){
+		head = c->head;
+		c->head = head->next;
+		head->next = null;
+		if (last != null){
+			last->next = head;
+		} else {
+			done = head;
+		}
+		last = head;
+	}
+	if (c->head == null){
+		c->tail = null;
+		__atomic_and_fetch(&_cb_mask, ~(1ULL << cpu_id()), __ATOMIC_RELAXED);
+	}
+	spinlock_unlock_irq(&_lock, flags);
+	while (done != null){
+		head = done;
+		done = head->next;
+		head->func(head);
+	}
+}
+/**
+* Check whether callbacks of the calling CPU are ready
+*/
+static void rcu_check_callbacks(){
+	rcu_head_t *head = _cpu[cpu_id()].head;
+	if (head != null && head->seq <= _gp_done){
+		softirq_raise(SOFTIRQ_RCU);
+	}
+}
+/**
+* Wake synchronize_rcu() caller
+*/
+static void rcu_wake(rcu_head_t *head){
+	rcu_waiter_t *w = (rcu_waiter_t *)head;
+	w->done = true;
+	thread_wake(w->thread);
+}
+
+void rcu_init(){
+	mem_fill((uint8 *)_cpu, sizeof(_cpu), 0);
+	timer_setup(&_kick, rcu_kick, null);
+	_timers = (clock_source() != CLOCK_SOURCE_NONE);
+	softirq_register(SOFTIRQ_RCU, rcu_softirq, "rcu");
+}
+void rcu_qs(){
+	uint64 bit = (1ULL << cpu_id());
+	uint64 flags;
+	bool started;
+	// Common case - nothing to report, no shared writes
+	if ((__atomic_load_n(&_gp_mask, __ATOMIC_RELAXED) & bit) == 0){
+		return;
+	}
+	flags = spinlock_lock_irq(&_lock);
+	__atomic_and_fetch(&_gp_mask, ~bit, __ATOMIC_SEQ_CST);
+	started = rcu_advance();
+	spinlock_unlock_irq(&_lock, flags);
+	if (started){
+		rcu_arm();
+	}
+}
+void rcu_irq_exit(){
+	if (preemptible()){
+		rcu_qs();
+	}
+	rcu_check_callbacks();
+}
+void rcu_idle_enter(){
+	__atomic_or_fetch(&_idle_mask, (1ULL << cpu_id()), __ATOMIC_SEQ_CST);
+	rcu_qs();
+}
+void rcu_idle_exit(){
+	__atomic_and_fetch(&_idle_mask, ~(1ULL << cpu_id()), __ATOMIC_SEQ_CST);
+	rcu_check_callbacks();
+}
+void call_rcu(rcu_head_t *head, rcu_func_t func){
+	rcu_cpu_t *c;
+	uint64 flags;
+	uint64 cpu;
+	bool started;
+	head->func = func;
+	head->next = null;
+	flags = spinlock_lock_irq(&_lock);
+	cpu = cpu_id();
+	if (cpu_isolated_mask() & (1ULL << cpu)){
+		// Callbacks are deferred work - the housekeeping CPU runs them
+		cpu = cpu_housekeeping();
+	}
+	// Grace period in progress might have started before the caller's update
+	head->seq = _gp_seq + 1;
+	if (_gp_need < head->seq){
+		_gp_need = head->seq;
+	}
+	c = &_cpu[cpu];
+	if (c->tail != null){
+		c->tail->next = head;
+	} else {
+		c->head = head;
+	}
+	c->tail = head;
+	__atomic_or_fetch(&_cb_mask, (1ULL << cpu), __ATOMIC_RELAXED);
+	started = rcu_advance();
+	spinlock_unlock_irq(&_lock, flags);
+	if (started){
+		rcu_arm();
+	}
+}
+void synchronize_rcu(){
+	rcu_waiter_t w;
+	// Caller is in a quiescent state and no reader can run on this CPU meanwhile
+	if ((cpu_online_mask() & (cpu_online_mask() - 1)) == 0 || thread_current() == null){
+		__sync_synchronize();
+		return;
+	}
+	w.thread = thread_current();
+	w.done = false;
+	call_rcu(&w.head, rcu_wake);
+	while (true){
+		thread_block_prepare();
+		if (w.done){
+			thread_wake(w.thread);
+			break;
+		}
+		thread_block();
+	}
+}
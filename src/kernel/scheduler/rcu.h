@@ -0,0 +1,119 @@
+/*
+
+Read-copy-update
+================
+
+Readers of read-mostly tables take no locks and write no shared memory. A
+writer publishes a new version and frees the old one after a grace period -
+once every CPU has passed a quiescent state (context switch, interrupt exit
+outside of a preemption-disabled section, or idle). Interrupt handlers are
+readers by nature, so tables they use can be updated without masking them.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __rcu_h
+#define __rcu_h
+
+#include "common.h"
+#include "../config.h"
+#include "preempt.h"
+
+// Holdout CPUs are kicked with an IPI this long after a grace period has started (ns)
+#define RCU_KICK_NS		1000000
+
+/**
+* Publish a pointer to a fully initialized object
+*/
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+/**
+* Read an RCU protected pointer (inside rcu_read_lock() or an interrupt handler)
+*/
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/**
+* RCU callback entry (embed into the object that is freed)
+*/
+struct rcu_head_struct {
+	struct rcu_head_struct *next;
+	void (*func)(struct rcu_head_struct *head);
+	uint64 seq;					// Grace period that has to complete
+};
+typedef struct rcu_head_struct rcu_head_t;
+/**
+* RCU callback
+* @param head - entry passed to call_rcu()
+*/
+typedef void (*rcu_func_t)(rcu_head_t *head);
+
+/**
+* Start a read-side section (must not block until rcu_read_unlock())
+*/
+static void rcu_read_lock(){
+	preempt_disable();
+}
+/**
+* End a read-side section
+*/
+static void rcu_read_unlock(){
+	preempt_enable();
+}
+/**
+* Initialize RCU (after softirq_init() and timer_init())
+*/
+void rcu_init();
+/**
+* Report a quiescent state of the calling CPU (context switch)
+*/
+void rcu_qs();
+/**
+* Interrupt exit - quiescent state if the interrupted code was not in a read-side section
+*/
+void rcu_irq_exit();
+/**
+* Calling CPU goes idle (extended quiescent state, grace periods don't wait for it)
+*/
+void rcu_idle_enter();
+/**
+* Calling CPU leaves idle
+*/
+void rcu_idle_exit();
+/**
+* Call a function after all the current readers have finished
+* @param head - callback entry
+* @param func - function (runs in softirq context on the calling CPU)
+*/
+void call_rcu(rcu_head_t *head, rcu_func_t func);
+/**
+* Wait until all the current readers have finished (thread context only)
+*/
+void synchronize_rcu();
+
+#endif /* __rcu_h */
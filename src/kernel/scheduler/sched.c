@@ -0,0 +1,1381 @@
+/*
+
+Thread scheduler
+================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "sched.h"
+#include "preempt.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "clock.h"
+#include "timer.h"
+#include "apic.h"
+#include "interrupts.h"
+#include "gdt.h"
+#include "fpu.h"
+#include "idle.h"
+#include "rcu.h"
+#include "topology.h"
+#include "softirq.h"
+#include "pci.h"
+#include "msr.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+// Fair class weight of nice level 0
+#define SCHED_WEIGHT_NICE_0 1024
+
+/**
+* Thread list
+*/
+typedef struct {
+	thread_t *head;
+	thread_t *tail;
+} sched_queue_t;
+/**
+* Run queue of a single CPU
+*/
+struct sched_rq_struct {
+	spinlock_t lock;
+	thread_t *curr;								// Running thread
+	thread_t *prev;								// Thread switched away from (finished by the next one)
+	thread_t *idle;								// Idle thread
+	uint64 rt_bitmap;							// Non-empty real-time priority lists
+	sched_queue_t rt[SCHED_RT_PRIO_MAX];		// Real-time threads by priority
+	sched_queue_t fair;							// Fair threads ordered by virtual run time
+	sched_queue_t dl;							// Deadline threads ordered by absolute deadline
+	uint64 dl_bw;								// Bandwidth reserved by deadline threads
+	timer_t dl_timer;							// Budget of the running deadline thread
+	uint64 min_vruntime;						// Monotonic minimum virtual run time of fair threads
+	uint64 nr_running;							// Runnable threads (except idle)
+	timer_t slice;								// Fair class time slice
+	timer_t balance;							// Periodic load balancing
+	bool online;
+} __ALIGN(64);
+typedef struct sched_rq_struct sched_rq_t;
+
+static sched_rq_t _rq[CPU_MAX];
+static thread_t _threads[SCHED_THREAD_MAX];
+static uint8 _stacks[SCHED_THREAD_MAX][SCHED_STACK_SIZE] __ALIGN(16);
+static spinlock_t _threads_lock = SPINLOCK_INIT;
+static bool _timers = false;
+static bool _balance = true;
+static uint64 _migrations = 0;
+/**
+* Fair class weights of nice levels -20 to 19 (each level is ~10% of CPU time)
+*/
+static uint64 _weights[] = {
+	88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+	9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+	1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+	110, 87, 70, 56, 45, 36, 29, 23, 18, 15
+};
+
+/**
+* Insert thread in a list
+* @param q - list
+* @param after - thread to insert after (null - insert at the head)
+* @param t - thread
+*/
+static void sched_queue_insert(sched_queue_t *q, thread_t *after, thread_t *t){
+	t->prev = after;
+	if (after == null){
+		t->next = q->head;
+		q->head = t;
+	} else {
+		t->next = after->next;
+		after->next = t;
+	}
+	if (t->next != null){
+		t->next->prev = t;
+	} else {
+		q->tail = t;
+	}
+}
+/**
+* Remove thread from a list
+*/
+static void sched_queue_remove(sched_queue_t *q, thread_t *t){
+	if (t->prev != null){
+		t->prev->next = t->next;
+	} else {
+		q->head = t->next;
+	}
+	if (t->next != null){
+		t->next->prev = t->prev;
+	} else {
+		q->tail = t->prev;
+	}
+	t->next = null;
+	t->prev = null;
+}
+/**
+* Put thread in its class queue
+* @param rq - run queue (locked)
+* @param t - thread
+* @param head - real-time thread goes in front of its peers (it was preempted)
+*/
+static void sched_enqueue(sched_rq_t *rq, thread_t *t, bool head){
+	thread_t *pos;
+	if (t->policy == SCHED_DEADLINE){
+		pos = rq->dl.tail;
+		while (pos != null && pos->dl_abs_deadline > t->dl_abs_deadline){
+			pos = pos->prev;
+		}
+		sched_queue_insert(&rq->dl, pos, t);
+	} else if (t->policy == SCHED_RT){
+		sched_queue_insert(&rq->rt[t->prio], (head ? null : rq->rt[t->prio].tail), t);
+		rq->rt_bitmap |= (1ULL << t->prio);
+	} else {
+		pos = rq->fair.tail;
+		while (pos != null && pos->vruntime > t->vruntime){
+			pos = pos->prev;
+		}
+		sched_queue_insert(&rq->fair, pos, t);
+	}
+	t->on_rq = true;
+}
+/**
+* Take thread out of its class queue
+*/
+static void sched_dequeue(sched_rq_t *rq, thread_t *t){
+	if (t->policy == SCHED_DEADLINE){
+		sched_queue_remove(&rq->dl, t);
+	} else if (t->policy == SCHED_RT){
+		sched_queue_remove(&rq->rt[t->prio], t);
+		if (rq->rt[t->prio].head == null){
+			rq->rt_bitmap &= ~(1ULL << t->prio);
+		}
+	} else {
+		sched_queue_remove(&rq->fair, t);
+	}
+	t->on_rq = false;
+}
+/**
+* Dequeue the most important runnable thread
+* @return thread (idle thread if there's nothing else to run)
+*/
+static thread_t *sched_pick(sched_rq_t *rq){
+	thread_t *t;
+	if (rq->dl.head != null){
+		t = rq->dl.head;
+	} else if (rq->rt_bitmap != 0){
+		t = rq->rt[63 - __builtin_clzll(rq->rt_bitmap)].head;
+	} else if (rq->fair.head != null){
+		t = rq->fair.head;
+	} else {
+		return rq->idle;
+	}
+	sched_dequeue(rq, t);
+	return t;
+}
+/**
+* Lock the run queue a thread belongs to (load balancing might move it meanwhile)
+* @param t - thread
+* @param [out] flags - interrupt flag to restore with spinlock_unlock_irq()
+* @return locked run queue
+*/
+static sched_rq_t *sched_lock_thread(thread_t *t, uint64 *flags){
+	sched_rq_t *rq;
+	while (true){
+		rq = &_rq[__atomic_load_n(&t->cpu, __ATOMIC_ACQUIRE)];
+		*flags = spinlock_lock_irq(&rq->lock);
+		if (rq == &_rq[t->cpu]){
+			return rq;
+		}
+		spinlock_unlock_irq(&rq->lock, *flags);
+	}
+}
+/**
+* Lock two run queues (always in the same order)
+*/
+static void sched_double_lock(sched_rq_t *a, sched_rq_t *b){
+	if (a < b){
+		spinlock_lock(&a->lock);
+		spinlock_lock(&b->lock);
+	} else {
+		spinlock_lock(&b->lock);
+		spinlock_lock(&a->lock);
+	}
+}
+/**
+* Request rescheduling of a CPU
+*/
+static void sched_resched(uint64 cpu){
+	percpu_get(cpu)->need_resched = true;
+	// Pairs with the idle loop: flag set before the polling check, or the CPU misses the wake-up
+	__sync_synchronize();
+	// A CPU waiting in MWAIT on its flag has already been woken by the write
+	if (cpu != cpu_id() && !percpu_get(cpu)->idle_polling){
+		apic_send_ipi((uint8)percpu_get(cpu)->apic_id, INT_VECTOR_RESCHED);
+	}
+}
+/**
+* Account run time of the running thread
+* @param rq - run queue (locked)
+* @param now - current time (ns)
+*/
+static void sched_update_curr(sched_rq_t *rq, uint64 now){
+	thread_t *curr = rq->curr;
+	uint64 delta;
+	uint64 min;
+	bool valid = false;
+	if (now > curr->exec_start){
+		delta = now - curr->exec_start;
+		curr->runtime += delta;
+		if (curr->policy == SCHED_FAIR){
+			curr->vruntime += (delta * SCHED_WEIGHT_NICE_0) / curr->weight;
+		} else if (curr->policy == SCHED_DEADLINE){
+			if (delta < curr->dl_budget){
+				curr->dl_budget -= delta;
+			} else {
+				curr->dl_budget = 0;
+				if (!curr->dl_throttled){
+					// Out of budget - stop it until the next period
+					curr->dl_throttled = true;
+					curr->dl_overruns ++;
+					sched_resched((uint64)(rq - _rq));
+				}
+			}
+		}
+		curr->exec_start = now;
+	}
+	// Minimum virtual run time only moves forward
+	if (curr->policy == SCHED_FAIR && curr->state == THREAD_RUNNABLE){
+		min = curr->vruntime;
+		valid = true;
+	}
+	if (rq->fair.head != null && (!valid || rq->fair.head->vruntime < min)){
+		min = rq->fair.head->vruntime;
+		valid = true;
+	}
+	if (valid && min > rq->min_vruntime){
+		rq->min_vruntime = min;
+	}
+}
+/**
+* Check if a newly runnable thread should preempt the running one
+*/
+static bool sched_should_preempt(sched_rq_t *rq, thread_t *t){
+	thread_t *curr = rq->curr;
+	if (t->policy != curr->policy){
+		return (t->policy > curr->policy);
+	}
+	if (t->policy == SCHED_DEADLINE){
+		return (t->dl_abs_deadline < curr->dl_abs_deadline);
+	}
+	if (t->policy == SCHED_RT){
+		return (t->prio > curr->prio);
+	}
+	return (t->vruntime + SCHED_WAKE_GRAN_NS < curr->vruntime);
+}
+/**
+* Time slice expired - let the next fair thread run
+*/
+static void sched_slice_expired(void *arg){
+	percpu_this()->need_resched = true;
+}
+/**
+* Budget of the running deadline thread is used up
+*/
+static void sched_dl_budget_expired(void *arg){
+	percpu_this()->need_resched = true;
+}
+/**
+* Start the time slice if a fair thread has to share the CPU and the budget timer
+* if a deadline thread runs, stop them otherwise
+* @param rq - run queue of the calling CPU (locked)
+* @param now - current time (ns)
+*/
+static void sched_arm_timers(sched_rq_t *rq, uint64 now){
+	if (!_timers){
+		return;
+	}
+	if (rq->curr->policy == SCHED_FAIR && rq->fair.head != null){
+		timer_add(&rq->slice, now + SCHED_SLICE_NS);
+	} else if (rq->slice.cpu != TIMER_IDLE){
+		timer_cancel(&rq->slice);
+	}
+	if (rq->curr->policy == SCHED_DEADLINE){
+		timer_add(&rq->dl_timer, now + rq->curr->dl_budget);
+	} else if (rq->dl_timer.cpu != TIMER_IDLE){
+		timer_cancel(&rq->dl_timer);
+	}
+	// Queued fair threads might get to run sooner elsewhere
+	if (_balance && rq->fair.head != null && rq->balance.cpu == TIMER_IDLE && (cpu_online_mask() & (cpu_online_mask() - 1)) != 0){
+		timer_add(&rq->balance, now + SCHED_BALANCE_NS);
+	}
+}
+/**
+* Start a new period of a deadline thread
+* @param t - thread
+* @param release - start of the period (ns)
+*/
+static void sched_dl_new_period(thread_t *t, uint64 release){
+	t->dl_release = release;
+	t->dl_abs_deadline = release + t->dl_deadline;
+	t->dl_budget = t->dl_runtime;
+	t->dl_throttled = false;
+}
+/**
+* Replenishment timer of a throttled deadline thread
+*/
+static void sched_dl_replenish(void *arg){
+	thread_t *t = (thread_t *)arg;
+	sched_rq_t *rq = &_rq[t->cpu];
+	uint64 flags;
+	uint64 now;
+	flags = spinlock_lock_irq(&rq->lock);
+	if (t->dl_throttled){
+		now = clock_monotonic_ns();
+		// Overrun is counted already, it's only a miss once the unfinished job is past its deadline
+		if (now > t->dl_abs_deadline){
+			t->dl_misses ++;
+		}
+		if (t->dl_release + t->dl_period + t->dl_deadline > now){
+			sched_dl_new_period(t, t->dl_release + t->dl_period);
+		} else {
+			sched_dl_new_period(t, now);
+		}
+		sched_update_curr(rq, now);
+		sched_enqueue(rq, t, false);
+		if (sched_should_preempt(rq, t)){
+			sched_resched(t->cpu);
+		}
+	}
+	spinlock_unlock_irq(&rq->lock, flags);
+}
+/**
+* Check if load balancing may move a queued thread
+* @param src - run queue the thread is queued on (locked)
+* @param t - thread
+* @param dst - destination CPU
+*/
+static bool sched_can_migrate(sched_rq_t *src, thread_t *t, uint64 dst){
+	uint64 cpu = (uint64)(src - _rq);
+	// Deadline bandwidth and real-time priorities are per CPU, only fair threads move
+	if (t->policy != SCHED_FAIR || (t->affinity & (1ULL << dst)) == 0){
+		return false;
+	}
+	// Lazily switched FPU state can only be saved by the CPU whose registers hold it
+	return (cpu == cpu_id() || (thread_t *)percpu_get(cpu)->fpu_owner != t);
+}
+/**
+* Move a queued thread to another run queue
+* @param src - source run queue (locked)
+* @param dst - destination run queue (locked)
+* @param t - thread
+* @param now - current time (ns)
+*/
+static void sched_migrate(sched_rq_t *src, sched_rq_t *dst, thread_t *t, uint64 now){
+	uint64 cpu = (uint64)(dst - _rq);
+	if (src == &_rq[cpu_id()]){
+		fpu_thread_save(t);
+	}
+	sched_dequeue(src, t);
+	src->nr_running --;
+	// Keep its lag behind the other fair threads
+	if (t->vruntime > src->min_vruntime){
+		t->vruntime = t->vruntime - src->min_vruntime + dst->min_vruntime;
+	} else {
+		t->vruntime = dst->min_vruntime;
+	}
+	__atomic_store_n(&t->cpu, cpu, __ATOMIC_RELEASE);
+	t->migrations ++;
+	__atomic_add_fetch(&_migrations, 1, __ATOMIC_RELAXED);
+	sched_update_curr(dst, now);
+	sched_enqueue(dst, t, false);
+	dst->nr_running ++;
+	if (cpu == cpu_id()){
+		// Pulled by the scheduler of this CPU, it's picking the next thread right now
+		return;
+	}
+	if (sched_should_preempt(dst, t)){
+		sched_resched(cpu);
+	} else if (_timers && dst->curr->policy == SCHED_FAIR && dst->slice.cpu == TIMER_IDLE){
+		timer_add_on(&dst->slice, now + SCHED_SLICE_NS, cpu);
+	}
+}
+/**
+* Get CPUs of a balancing level
+* Shared L2 (hyper-threads included), shared L3 and the rest of the CPUs
+* @param cpu - CPU index
+* @param level - TOPO_L2, TOPO_L3 or TOPO_PACKAGE (any CPU)
+* @param [in,out] searched - CPUs of the closer levels (excluded, updated)
+* @return online CPUs of the level
+*/
+static uint64 sched_balance_mask(uint64 cpu, uint64 level, uint64 *searched){
+	// Isolated CPUs are neither balanced nor balanced to
+	uint64 mask = cpu_online_mask() & ~cpu_isolated_mask() & ~(*searched);
+	if (level < TOPO_PACKAGE){
+		mask &= topology_mask(cpu, level);
+	}
+	*searched |= mask;
+	return mask;
+}
+/**
+* Pull a queued fair thread from the busiest CPU of the closest cache domain
+* @param rq - run queue of the calling CPU (locked, nothing to run)
+* @param now - current time (ns)
+* @return true if a thread has been pulled
+*/
+static bool sched_idle_balance(sched_rq_t *rq, uint64 now){
+	uint64 cpu = cpu_id();
+	uint64 searched = (1ULL << cpu);
+	uint64 level;
+	uint64 mask;
+	uint64 src_cpu;
+	uint64 min;
+	uint64 i;
+	sched_rq_t *src;
+	thread_t *t;
+	if (!_balance || (cpu_online_mask() & ~searched) == 0 || (cpu_isolated_mask() & searched)){
+		return false;
+	}
+	for (level = TOPO_L2; level <= TOPO_PACKAGE; level ++){
+		mask = sched_balance_mask(cpu, level, &searched);
+		// Beyond shared caches a thread is only worth moving if the imbalance is large
+		min = (level < TOPO_PACKAGE ? 2 : SCHED_BALANCE_FAR);
+		src_cpu = CPU_MAX;
+		for (i = 0; i < CPU_MAX; i ++){
+			if ((mask & (1ULL << i)) && _rq[i].nr_running >= min && (src_cpu == CPU_MAX || _rq[i].nr_running > _rq[src_cpu].nr_running)){
+				src_cpu = i;
+			}
+		}
+		if (src_cpu == CPU_MAX){
+			continue;
+		}
+		src = &_rq[src_cpu];
+		// Never spin on another run queue lock while holding this one
+		if (!spinlock_try(&src->lock)){
+			continue;
+		}
+		// Tail has waited the least, so it's the least likely to have a warm cache there
+		for (t = src->fair.tail; t != null; t = t->prev){
+			if (sched_can_migrate(src, t, cpu)){
+				sched_migrate(src, rq, t, now);
+				spinlock_unlock(&src->lock);
+				return true;
+			}
+		}
+		spinlock_unlock(&src->lock);
+	}
+	return false;
+}
+/**
+* Balancing timer of a CPU with queued fair threads
+* Pushes threads to the least loaded CPU of the closest cache domain (runs on the busy CPU,
+* so it can save lazily switched FPU state of the threads it moves)
+*/
+static void sched_balance_expired(void *arg){
+	uint64 cpu = cpu_id();
+	sched_rq_t *rq = &_rq[cpu];
+	sched_rq_t *dst;
+	uint64 searched = (1ULL << cpu);
+	uint64 level;
+	uint64 mask;
+	uint64 dst_cpu;
+	uint64 moves;
+	uint64 flags;
+	uint64 i;
+	thread_t *t;
+	thread_t *prev;
+	for (level = TOPO_L2; level <= TOPO_PACKAGE && _balance; level ++){
+		mask = sched_balance_mask(cpu, level, &searched);
+		dst_cpu = CPU_MAX;
+		for (i = 0; i < CPU_MAX; i ++){
+			if ((mask & (1ULL << i)) && (dst_cpu == CPU_MAX || _rq[i].nr_running < _rq[dst_cpu].nr_running)){
+				dst_cpu = i;
+			}
+		}
+		if (dst_cpu == CPU_MAX || rq->nr_running < _rq[dst_cpu].nr_running + (level < TOPO_PACKAGE ? 2 : SCHED_BALANCE_FAR)){
+			continue;
+		}
+		dst = &_rq[dst_cpu];
+		asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+		if (flags & 0x200){
+			irqstat_off_begin();
+		}
+		sched_double_lock(rq, dst);
+		// Split the difference
+		moves = (rq->nr_running > dst->nr_running ? (rq->nr_running - dst->nr_running) / 2 : 0);
+		t = rq->fair.tail;
+		while (t != null && moves > 0){
+			prev = t->prev;
+			if (sched_can_migrate(rq, t, dst_cpu)){
+				sched_migrate(rq, dst, t, clock_monotonic_ns());
+				moves --;
+			}
+			t = prev;
+		}
+		spinlock_unlock(&dst->lock);
+		spinlock_unlock(&rq->lock);
+		if (flags & 0x200){
+			irqstat_off_end();
+			asm volatile("sti" : : : "memory");
+		}
+	}
+}
+/**
+* Clean up after the thread this CPU has switched away from
+* @param rq - run queue of the calling CPU (locked)
+*/
+static void sched_finish(sched_rq_t *rq){
+	thread_t *prev = rq->prev;
+	rq->prev = null;
+	if (prev != null && prev->state == THREAD_DEAD){
+		// Nothing runs on its stack anymore
+		prev->state = THREAD_FREE;
+	}
+}
+/**
+* Core of the scheduler
+* @param preempt - current thread is preempted (it stays runnable even if it's preparing to block)
+*/
+static void sched_schedule(bool preempt){
+	sched_rq_t *rq;
+	thread_t *prev;
+	thread_t *next;
+	uint64 flags;
+	uint64 now;
+	// Calling thread can't be inside a read-side section
+	rcu_qs();
+	preempt_disable();
+	do {
+		rq = &_rq[cpu_id()];
+		flags = spinlock_lock_irq(&rq->lock);
+		percpu_this()->need_resched = false;
+		now = clock_monotonic_ns();
+		sched_update_curr(rq, now);
+		prev = rq->curr;
+		if (prev != rq->idle){
+			if (prev->state == THREAD_RUNNABLE || (preempt && prev->state == THREAD_BLOCKED)){
+				if (prev->policy == SCHED_DEADLINE && prev->dl_throttled){
+					// Stays out of the run queue until the start of its next period
+					timer_add(&prev->dl_timer, prev->dl_release + prev->dl_period);
+				} else {
+					if (prev->yield && prev->policy == SCHED_FAIR && rq->fair.tail != null && rq->fair.tail->vruntime > prev->vruntime){
+						// Go behind all the other fair threads
+						prev->vruntime = rq->fair.tail->vruntime;
+					}
+					// Preempted real-time thread keeps its place in the queue
+					sched_enqueue(rq, prev, (prev->policy == SCHED_RT && !prev->yield));
+				}
+			} else {
+				if (prev->policy == SCHED_DEADLINE){
+					// Wake-up starts a new period if this one is used up
+					prev->dl_throttled = false;
+					if (prev->state == THREAD_DEAD){
+						rq->dl_bw -= prev->dl_bw;
+					}
+				}
+				rq->nr_running --;
+			}
+			prev->yield = false;
+		}
+		next = sched_pick(rq);
+		if (next == rq->idle && sched_idle_balance(rq, now)){
+			next = sched_pick(rq);
+		}
+		rq->curr = next;
+		sched_arm_timers(rq, now);
+		if (next != prev){
+			next->exec_start = now;
+			next->switches ++;
+			rq->prev = prev;
+			fpu_switch(next);
+			if (next->kernel_rsp != 0){
+				// Entries from user mode land on the part of its stack below syscall_user_run()
+				gdt_set_kernel_stack(next->kernel_rsp);
+			}
+			sched_switch(&prev->rsp, next->rsp);
+			// Back in this thread, possibly switched in by a later call
+			rq = &_rq[cpu_id()];
+			sched_finish(rq);
+		}
+		spinlock_unlock_irq(&rq->lock, flags);
+		preempt = true;
+	} while (percpu_this()->need_resched);
+	preempt_enable();
+}
+/**
+* First code every new thread runs (sched_switch() returns here)
+*/
+static void sched_thread_start(){
+	sched_rq_t *rq = &_rq[cpu_id()];
+	thread_t *t = rq->curr;
+	// Finish what sched_schedule() of the previous thread has started
+	sched_finish(rq);
+	spinlock_unlock_irq(&rq->lock, 0x200);
+	preempt_enable();
+	t->func(t->arg);
+	thread_exit();
+}
+/**
+* Idle thread
+*/
+static void sched_idle_loop(void *arg){
+	while (true){
+		asm volatile("cli");
+		if (percpu_this()->need_resched){
+			asm volatile("sti");
+			sched_schedule(true);
+		} else {
+			idle_enter();
+		}
+	}
+}
+/**
+* Sleep timer expired
+*/
+static void sched_sleep_expired(void *arg){
+	thread_wake((thread_t *)arg);
+}
+/**
+* Reschedule IPI handler (the work is done on interrupt exit)
+*/
+static uint64 sched_ipi_handler(int_stack_t *stack){
+	return 0;
+}
+/**
+* Set scheduling class fields of a thread
+*/
+static void sched_set_class(thread_t *t, uint8 policy, int64 prio){
+	t->policy = policy;
+	t->prio = prio;
+	if (policy == SCHED_FAIR){
+		t->weight = _weights[prio - SCHED_NICE_MIN];
+	} else {
+		t->weight = SCHED_WEIGHT_NICE_0;
+	}
+}
+/**
+* Check scheduling class arguments
+*/
+static bool sched_valid_class(uint8 policy, int64 prio){
+	if (policy == SCHED_RT){
+		return (prio >= 0 && prio < SCHED_RT_PRIO_MAX);
+	}
+	if (policy == SCHED_FAIR){
+		return (prio >= SCHED_NICE_MIN && prio <= SCHED_NICE_MAX);
+	}
+	return false;
+}
+/**
+* Move a thread to another scheduling class
+* @param rq - run queue of the thread (locked)
+* @param t - thread
+* @param policy - scheduling class
+* @param prio - real-time priority or nice level
+*/
+static void sched_change_class(sched_rq_t *rq, thread_t *t, uint8 policy, int64 prio){
+	bool queued = t->on_rq;
+	sched_update_curr(rq, clock_monotonic_ns());
+	if (queued){
+		sched_dequeue(rq, t);
+	}
+	if (t->policy == SCHED_DEADLINE){
+		// Release reserved bandwidth
+		rq->dl_bw -= t->dl_bw;
+		t->dl_bw = 0;
+		if (t->dl_throttled){
+			t->dl_throttled = false;
+			timer_cancel(&t->dl_timer);
+			queued = (t != rq->curr);
+		}
+	}
+	sched_set_class(t, policy, prio);
+	if (policy == SCHED_FAIR && t->vruntime < rq->min_vruntime){
+		t->vruntime = rq->min_vruntime;
+	}
+	if (queued){
+		sched_enqueue(rq, t, false);
+		if (sched_should_preempt(rq, t)){
+			sched_resched(t->cpu);
+		}
+	} else if (t == rq->curr){
+		// Let the scheduler decide if it's still the most important one
+		sched_resched(t->cpu);
+	}
+}
+/**
+* Reserve a thread structure
+* @param name - thread name
+* @param func - entry point (null - thread adopts the calling context)
+* @param arg - entry point argument
+* @return thread in THREAD_BLOCKED state or null
+*/
+static thread_t *sched_alloc(char *name, thread_func_t func, void *arg){
+	thread_t *t = null;
+	uint64 *sp;
+	uint64 flags;
+	uint64 i;
+	flags = spinlock_lock_irq(&_threads_lock);
+	for (i = 0; i < SCHED_THREAD_MAX; i ++){
+		if (_threads[i].state == THREAD_FREE){
+			t = &_threads[i];
+			mem_fill((uint8 *)t, sizeof(thread_t), 0);
+			t->state = THREAD_BLOCKED;
+			break;
+		}
+	}
+	spinlock_unlock_irq(&_threads_lock, flags);
+	if (t == null){
+		return null;
+	}
+	t->id = i;
+	t->name = name;
+	t->func = func;
+	t->arg = arg;
+	t->cpu = cpu_id();
+	timer_setup(&t->timer, sched_sleep_expired, t);
+	timer_setup(&t->dl_timer, sched_dl_replenish, t);
+	fpu_thread_init(t);
+	if (func != null){
+		t->stack = _stacks[i];
+		// Initial frame for sched_switch(): 6 callee-saved registers and a return address
+		sp = (uint64 *)(t->stack + SCHED_STACK_SIZE);
+		*(-- sp) = 0;									// Fake return address of sched_thread_start() (keeps ABI alignment)
+		*(-- sp) = (uint64)sched_thread_start;
+		for (i = 0; i < 6; i ++){
+			*(-- sp) = 0;
+		}
+		t->rsp = (uint64)sp;
+	}
+	return t;
+}
+/**
+* Pick the least loaded CPU for a new thread
+*/
+static uint64 sched_select_cpu(){
+	uint64 usable = cpu_online_mask() & ~cpu_isolated_mask();
+	uint64 best = cpu_id();
+	uint64 i;
+	if ((usable & (1ULL << best)) == 0){
+		best = cpu_housekeeping();
+	}
+	for (i = 0; i < CPU_MAX; i ++){
+		if ((usable & (1ULL << i)) && _rq[i].online && _rq[i].nr_running < _rq[best].nr_running){
+			best = i;
+		}
+	}
+	return best;
+}
+/**
+* Create a thread and queue it on a CPU
+* @return thread or null
+*/
+static thread_t *sched_create(char *name, thread_func_t func, void *arg, uint8 policy, int64 prio, uint64 cpu, uint64 affinity){
+	thread_t *t;
+	if (func == null || !sched_valid_class(policy, prio)){
+		return null;
+	}
+	t = sched_alloc(name, func, arg);
+	if (t == null){
+		return null;
+	}
+	sched_set_class(t, policy, prio);
+	t->cpu = cpu;
+	t->affinity = affinity;
+	t->vruntime = _rq[cpu].min_vruntime;
+	thread_wake(t);
+	return t;
+}
+/**
+* Set up run queue and idle thread of the calling CPU
+* @param idle - idle thread
+*/
+static void sched_init_rq(thread_t *idle){
+	sched_rq_t *rq = &_rq[cpu_id()];
+	mem_fill((uint8 *)rq, sizeof(sched_rq_t), 0);
+	timer_setup(&rq->slice, sched_slice_expired, null);
+	timer_setup(&rq->dl_timer, sched_dl_budget_expired, null);
+	timer_setup(&rq->balance, sched_balance_expired, null);
+	idle->policy = SCHED_IDLE;
+	idle->affinity = (1ULL << cpu_id());
+	idle->fpu = null;
+	idle->state = THREAD_RUNNABLE;
+	rq->idle = idle;
+	rq->curr = idle;
+}
+
+void sched_init(){
+	thread_t *t;
+	mem_fill((uint8 *)_threads, sizeof(_threads), 0);
+	mem_fill((uint8 *)_rq, sizeof(_rq), 0);
+	_timers = (clock_source() != CLOCK_SOURCE_NONE);
+	interrupt_reg_handler(INT_VECTOR_RESCHED, sched_ipi_handler);
+	idle_init();
+	// Boot context becomes the first thread
+	t = sched_alloc("kmain", null, null);
+	sched_set_class(t, SCHED_FAIR, 0);
+	t->state = THREAD_RUNNABLE;
+	t->affinity = ~((uint64)0);
+	sched_init_rq(sched_alloc("idle", sched_idle_loop, null));
+	_rq[cpu_id()].curr = t;
+	_rq[cpu_id()].nr_running = 1;
+	t->exec_start = clock_monotonic_ns();
+	_rq[cpu_id()].online = true;
+}
+void sched_init_cpu(){
+	thread_t *t = sched_alloc("idle", null, null);
+	sched_init_rq(t);
+	_rq[cpu_id()].online = true;
+	sched_idle_loop(null);
+}
+thread_t *thread_create(char *name, thread_func_t func, void *arg, uint8 policy, int64 prio){
+	return sched_create(name, func, arg, policy, prio, sched_select_cpu(), ~((uint64)0));
+}
+thread_t *thread_create_on(char *name, thread_func_t func, void *arg, uint8 policy, int64 prio, uint64 cpu){
+	if (cpu >= CPU_MAX || !_rq[cpu].online){
+		return null;
+	}
+	if (policy != SCHED_RT && (cpu_isolated_mask() & (1ULL << cpu))){
+		return null;
+	}
+	return sched_create(name, func, arg, policy, prio, cpu, (1ULL << cpu));
+}
+bool thread_set_policy(thread_t *thread, uint8 policy, int64 prio){
+	sched_rq_t *rq;
+	uint64 flags;
+	if (!sched_valid_class(policy, prio)){
+		return false;
+	}
+	rq = sched_lock_thread(thread, &flags);
+	if (policy == SCHED_FAIR && (cpu_isolated_mask() & (1ULL << thread->cpu))){
+		spinlock_unlock_irq(&rq->lock, flags);
+		return false;
+	}
+	sched_change_class(rq, thread, policy, prio);
+	spinlock_unlock_irq(&rq->lock, flags);
+	return true;
+}
+bool thread_set_deadline(thread_t *thread, uint64 runtime, uint64 deadline, uint64 period){
+	sched_rq_t *rq;
+	uint64 bw;
+	uint64 old = 0;
+	uint64 flags;
+	if (!_timers || runtime == 0 || runtime > deadline || deadline > period){
+		return false;
+	}
+	bw = (uint64)(((unsigned __int128)runtime << SCHED_DL_BW_SHIFT) / period);
+	rq = sched_lock_thread(thread, &flags);
+	if (thread->policy == SCHED_DEADLINE){
+		old = thread->dl_bw;
+	}
+	// Admission control - EDF meets all deadlines as long as the CPU is not overcommitted
+	if (rq->dl_bw - old + bw > SCHED_DL_BW_MAX){
+		spinlock_unlock_irq(&rq->lock, flags);
+		return false;
+	}
+	sched_change_class(rq, thread, SCHED_DEADLINE, 0);
+	rq->dl_bw += bw;
+	thread->dl_bw = bw;
+	thread->dl_runtime = runtime;
+	thread->dl_deadline = deadline;
+	thread->dl_period = period;
+	if (thread->on_rq){
+		// Re-sort by the new deadline
+		sched_dequeue(rq, thread);
+		sched_dl_new_period(thread, clock_monotonic_ns());
+		sched_enqueue(rq, thread, false);
+	} else {
+		sched_dl_new_period(thread, clock_monotonic_ns());
+	}
+	spinlock_unlock_irq(&rq->lock, flags);
+	return true;
+}
+void thread_dl_yield(){
+	thread_t *t = thread_current();
+	sched_rq_t *rq = &_rq[t->cpu];
+	uint64 flags;
+	uint64 now;
+	uint64 next;
+	if (t->policy != SCHED_DEADLINE){
+		thread_yield();
+		return;
+	}
+	flags = spinlock_lock_irq(&rq->lock);
+	now = clock_monotonic_ns();
+	sched_update_curr(rq, now);
+	if (now > t->dl_abs_deadline){
+		t->dl_misses ++;
+	}
+	next = t->dl_release + t->dl_period;
+	if (next <= now){
+		// Late - skip to the next period boundary
+		next += ((now - next) / t->dl_period + 1) * t->dl_period;
+	}
+	// Deadline of the next job applies from the wake-up on
+	sched_dl_new_period(t, next);
+	spinlock_unlock_irq(&rq->lock, flags);
+	thread_sleep_until(next);
+}
+thread_t *thread_current(){
+	return _rq[cpu_id()].curr;
+}
+void thread_exit(){
+	// Can't be preempted past this point, nothing would ever switch back
+	asm volatile("cli");
+	fpu_thread_exit(thread_current());
+	thread_current()->state = THREAD_DEAD;
+	sched_schedule(false);
+	HANG();
+}
+void thread_yield(){
+	thread_current()->yield = true;
+	sched_schedule(false);
+}
+void thread_block_prepare(){
+	thread_current()->state = THREAD_BLOCKED;
+	asm volatile("mfence" : : : "memory");
+}
+void thread_block(){
+	schedule();
+}
+bool thread_wake(thread_t *thread){
+	sched_rq_t *rq;
+	bool woken = false;
+	uint64 flags;
+	uint64 now;
+	rq = sched_lock_thread(thread, &flags);
+	if (thread->state == THREAD_BLOCKED){
+		thread->state = THREAD_RUNNABLE;
+		woken = true;
+		// Thread is still running if it has not reached thread_block() yet,
+		// throttled one is queued by its replenishment timer
+		if (!thread->on_rq && thread != rq->curr && !thread->dl_throttled){
+			now = clock_monotonic_ns();
+			sched_update_curr(rq, now);
+			if (thread->policy == SCHED_FAIR && thread->vruntime + SCHED_SLICE_NS < rq->min_vruntime){
+				// Sleeper gets at most one slice of credit
+				thread->vruntime = rq->min_vruntime - SCHED_SLICE_NS;
+			} else if (thread->policy == SCHED_DEADLINE && (thread->dl_abs_deadline <= now || thread->dl_budget == 0)){
+				// Can't use what's left of an expired period
+				sched_dl_new_period(thread, now);
+			}
+			sched_enqueue(rq, thread, false);
+			rq->nr_running ++;
+			if (sched_should_preempt(rq, thread)){
+				sched_resched(thread->cpu);
+			} else if (_timers && rq->curr->policy == SCHED_FAIR && rq->slice.cpu == TIMER_IDLE){
+				// Running thread has to share the CPU from now on
+				timer_add_on(&rq->slice, now + SCHED_SLICE_NS, thread->cpu);
+			}
+		}
+	}
+	spinlock_unlock_irq(&rq->lock, flags);
+	return woken;
+}
+void thread_sleep_until(uint64 ns){
+	thread_t *t = thread_current();
+	if (!_timers){
+		thread_yield();
+		return;
+	}
+	if (ns <= clock_monotonic_ns()){
+		return;
+	}
+	thread_block_prepare();
+	timer_add(&t->timer, ns);
+	thread_block();
+	// Woken up by thread_wake() before the timer expired
+	timer_cancel(&t->timer);
+}
+void thread_sleep(uint64 ns){
+	thread_sleep_until(clock_monotonic_ns() + ns);
+}
+void schedule(){
+#if DEBUG == 1
+	if (!preemptible()){
+		debug_print(DC_WRD, "Scheduling while atomic: %s", thread_current()->name);
+	}
+#endif
+	sched_schedule(false);
+}
+/**
+* Move a blocked fair thread off a newly isolated CPU
+* @param rq - run queue of the thread (locked)
+* @param t - fair thread
+* @param mask - isolated CPUs
+* @return false if it's running or queued there, pinned there or its FPU state is held there
+*/
+static bool sched_isolate_move(sched_rq_t *rq, thread_t *t, uint64 mask){
+	uint64 cpu = (uint64)(rq - _rq);
+	uint64 allowed = (t->affinity & cpu_online_mask() & ~mask);
+	uint64 dst;
+	if (t == softirq_thread_on(cpu)){
+		// Never woken while its CPU is isolated, softirqs raised there run on the housekeeping CPU
+		return true;
+	}
+	if (t->state != THREAD_BLOCKED || t->on_rq || t == rq->curr || allowed == 0 || (thread_t *)percpu_get(cpu)->fpu_owner == t){
+		return false;
+	}
+	dst = cpu_housekeeping();
+	if ((allowed & (1ULL << dst)) == 0){
+		dst = (uint64)__builtin_ctzll(allowed);
+	}
+	// Wakes up there with the lag it had behind the other fair threads
+	if (t->vruntime > rq->min_vruntime){
+		t->vruntime = t->vruntime - rq->min_vruntime + _rq[dst].min_vruntime;
+	} else {
+		t->vruntime = _rq[dst].min_vruntime;
+	}
+	__atomic_store_n(&t->cpu, dst, __ATOMIC_RELEASE);
+	t->migrations ++;
+	return true;
+}
+bool sched_isolate(uint64 mask){
+	uint64 online = cpu_online_mask();
+	uint64 old = cpu_isolated_mask();
+	uint64 added = (mask & online & ~old);
+	sched_rq_t *rq;
+	thread_t *t;
+	uint64 flags;
+	uint64 i;
+	bool busy = false;
+	if ((online & ~mask) == 0){
+		return false;
+	}
+	// From now on no fair thread is created on or moved to them
+	cpu_set_isolated(mask);
+	// Blocked threads count too - thread_wake() would queue them where they last ran
+	for (i = 0; i < SCHED_THREAD_MAX && !busy; i ++){
+		t = &_threads[i];
+		if (t->state == THREAD_FREE || t->policy != SCHED_FAIR || (added & (1ULL << t->cpu)) == 0){
+			continue;
+		}
+		rq = sched_lock_thread(t, &flags);
+		if (t->state != THREAD_FREE && t->state != THREAD_DEAD && t->policy == SCHED_FAIR && (added & (1ULL << t->cpu))){
+			busy = !sched_isolate_move(rq, t, mask);
+		}
+		spinlock_unlock_irq(&rq->lock, flags);
+	}
+	if (busy){
+		cpu_set_isolated(old);
+		return false;
+	}
+	// Vectors allocated earlier still target them
+	pci_irq_evacuate(added);
+	return true;
+}
+void sched_preempt(){
+	uint64 flags;
+	asm volatile("pushfq; popq %0" : "=r"(flags));
+	// Interrupt handlers run with interrupts disabled - sched_irq_exit() takes care of them
+	if ((flags & 0x200) && _rq[cpu_id()].curr != null){
+		sched_schedule(true);
+	}
+}
+void sched_irq_exit(){
+	percpu_t *cpu = percpu_this();
+	if (cpu->need_resched && cpu->preempt_count == 0 && _rq[cpu->id].curr != null){
+		sched_schedule(true);
+	}
+}
+
+#if DEBUG == 1
+void sched_list(){
+	char *states[] = {"free", "run", "block", "dead"};
+	char *classes[] = {"idle", "fair", "rt", "dl"};
+	thread_t *t;
+	uint64 i;
+	for (i = 0; i < SCHED_THREAD_MAX; i ++){
+		t = &_threads[i];
+		if (t->state != THREAD_FREE){
+			debug_print(DC_WB, "%d %s: %s %s cpu %d, run %dus, sw %d, mig %d", t->id, t->name, classes[t->policy], states[t->state], t->cpu, t->runtime / 1000, t->switches, t->migrations);
+			if (t->policy == SCHED_DEADLINE){
+				debug_print(DC_WB, "  %d/%d/%dus, misses %d, overruns %d", t->dl_runtime / 1000, t->dl_deadline / 1000, t->dl_period / 1000, t->dl_misses, t->dl_overruns);
+			}
+		}
+	}
+}
+
+// Number of latency histogram buckets
+#define SCHED_BENCH_BUCKETS 8
+/**
+* Upper bounds of latency histogram buckets (us), last bucket takes the rest
+*/
+static uint64 _bench_limits[SCHED_BENCH_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100};
+/**
+* Benchmark state
+*/
+static struct {
+	uint64 loops;
+	uint64 interval;
+	uint64 volatile done;
+	uint64 min;
+	uint64 max;
+	uint64 sum;
+	uint64 hist[SCHED_BENCH_BUCKETS];
+	spinlock_t lock;
+	uint64 counter;
+} _bench;
+
+/**
+* Measurement thread - sleeps until periodic deadlines and records how late it runs
+*/
+static void sched_bench_cyclic(void *arg){
+	uint64 next = clock_monotonic_ns() + _bench.interval;
+	uint64 now;
+	uint64 lat;
+	uint64 b;
+	uint64 i;
+	for (i = 0; i < _bench.loops; i ++){
+		thread_sleep_until(next);
+		now = clock_monotonic_ns();
+		lat = (now > next ? now - next : 0);
+		if (lat < _bench.min){
+			_bench.min = lat;
+		}
+		if (lat > _bench.max){
+			_bench.max = lat;
+		}
+		_bench.sum += lat;
+		for (b = 0; b < SCHED_BENCH_BUCKETS - 1 && lat >= _bench_limits[b] * 1000; b ++){}
+		_bench.hist[b] ++;
+		next += _bench.interval;
+		if (next <= now){
+			// Overrun - skip missed periods
+			next = now + _bench.interval;
+		}
+	}
+	_bench.done = true;
+}
+/**
+* Load thread - keeps the CPU busy with short non-preemptible sections
+*/
+static void sched_bench_load(void *arg){
+	uint64 i;
+	while (!_bench.done){
+		spinlock_lock(&_bench.lock);
+		for (i = 0; i < 100; i ++){
+			_bench.counter ++;
+		}
+		spinlock_unlock(&_bench.lock);
+	}
+}
+void sched_bench(uint64 loops, uint64 interval, uint64 load){
+	uint64 i;
+	if (!_timers || loops == 0){
+		debug_print(DC_WRD, "Sched bench: no timers");
+		return;
+	}
+	mem_fill((uint8 *)&_bench, sizeof(_bench), 0);
+	_bench.loops = loops;
+	_bench.interval = interval;
+	_bench.min = ~((uint64)0);
+	for (i = 0; i < load; i ++){
+		thread_create("load", sched_bench_load, null, SCHED_FAIR, 0);
+	}
+	if (thread_create("cyclic", sched_bench_cyclic, null, SCHED_RT, SCHED_RT_PRIO_MAX - 1) == null){
+		_bench.done = true;
+		return;
+	}
+	while (!_bench.done){
+		thread_sleep(10000000ULL);
+	}
+	debug_print(DC_WB, "Wake-up latency, %d loops of %dus, %d load threads", loops, interval / 1000, load);
+	debug_print(DC_WB, "min %dns, avg %dns, max %dns", _bench.min, _bench.sum / loops, _bench.max);
+	for (i = 0; i < SCHED_BENCH_BUCKETS - 1; i ++){
+		debug_print(DC_WB, "<%dus: %d", _bench_limits[i], _bench.hist[i]);
+	}
+	debug_print(DC_WB, ">=%dus: %d", _bench_limits[SCHED_BENCH_BUCKETS - 2], _bench.hist[SCHED_BENCH_BUCKETS - 1]);
+}
+/**
+* Finished threads of the balancing benchmark
+*/
+static uint64 volatile _balance_done;
+/**
+* Short-lived thread of the balancing benchmark
+* @param arg - busy loop iterations
+*/
+static void sched_balance_bench_thread(void *arg){
+	uint64 volatile i;
+	for (i = 0; i < (uint64)arg; i ++){
+	}
+	__atomic_add_fetch(&_balance_done, 1, __ATOMIC_RELAXED);
+}
+/**
+* Run one round of the balancing benchmark
+* @return elapsed time (ns)
+*/
+static uint64 sched_balance_bench_run(uint64 threads, uint64 work){
+	uint64 start = clock_monotonic_ns();
+	uint64 created = 0;
+	uint64 len;
+	_balance_done = 0;
+	while (_balance_done < threads){
+		if (created < threads && created - _balance_done < SCHED_THREAD_MAX / 2){
+			// Every 8th thread is long, so the initial placement goes out of balance
+			len = ((created % 8) == 0 ? work : work / 16);
+			if (thread_create("short", sched_balance_bench_thread, (void *)len, SCHED_FAIR, 0) != null){
+				created ++;
+				continue;
+			}
+		}
+		thread_yield();
+	}
+	return clock_monotonic_ns() - start;
+}
+void sched_balance_bench(uint64 threads, uint64 work){
+	bool balance = _balance;
+	uint64 migrations;
+	uint64 ns;
+	if (threads == 0){
+		return;
+	}
+	_balance = false;
+	ns = sched_balance_bench_run(threads, work);
+	debug_print(DC_WB, "No balancing: %d threads in %dus, %d/s", threads, ns / 1000, (threads * 1000000000ULL) / (ns + 1));
+	_balance = true;
+	migrations = _migrations;
+	ns = sched_balance_bench_run(threads, work);
+	debug_print(DC_WB, "Balancing: %d threads in %dus, %d/s, %d migrations", threads, ns / 1000, (threads * 1000000000ULL) / (ns + 1), _migrations - migrations);
+	_balance = balance;
+}
+/**
+* Isolation benchmark - one DSP thread per CPU
+*/
+typedef struct {
+	uint64 min;
+	uint64 max;
+	uint64 sum;
+	uint64 xruns;				// Buffers finished after the next deadline
+	uint64 volatile done;
+} sched_iso_stat_t;
+static struct {
+	uint64 periods;
+	uint64 volatile stop;
+	sched_iso_stat_t stat[2];
+	tasklet_t tasklet;
+} _iso_bench;
+
+/**
+* Deferred work of the benchmark (runs on a housekeeping CPU)
+*/
+static void sched_iso_bench_tasklet(uint64 data){
+}
+/**
+* Synthetic DSP thread - processes a 32 sample buffer at 48kHz every period
+* @param arg - sched_iso_stat_t
+*/
+static void sched_iso_bench_dsp(void *arg){
+	sched_iso_stat_t *st = (sched_iso_stat_t *)arg;
+	uint64 work = clock_ns_to_tsc(SCHED_ISO_PERIOD_NS / 4);
+	uint64 next = clock_monotonic_ns() + SCHED_ISO_PERIOD_NS;
+	uint64 start;
+	uint64 now;
+	uint64 lat;
+	uint64 i;
+	st->min = ~((uint64)0);
+	for (i = 0; i < _iso_bench.periods; i ++){
+		thread_sleep_until(next);
+		now = clock_monotonic_ns();
+		lat = (now > next ? now - next : 0);
+		if (lat < st->min){
+			st->min = lat;
+		}
+		if (lat > st->max){
+			st->max = lat;
+		}
+		st->sum += lat;
+		// Quarter of the period worth of processing
+		start = rdtsc();
+		while (rdtsc() - start < work){
+			asm volatile("pause");
+		}
+		// Completion work a driver would defer
+		tasklet_schedule(&_iso_bench.tasklet);
+		if (clock_monotonic_ns() > next + SCHED_ISO_PERIOD_NS){
+			st->xruns ++;
+		}
+		next += SCHED_ISO_PERIOD_NS;
+		if (next <= now){
+			next = now + SCHED_ISO_PERIOD_NS;
+		}
+	}
+	st->done = true;
+}
+/**
+* Housekeeping load - fair thread that keeps raising deferred work
+*/
+static void sched_iso_bench_load(void *arg){
+	uint64 volatile i;
+	while (!_iso_bench.stop){
+		for (i = 0; i < 10000; i ++){
+		}
+		tasklet_schedule(&_iso_bench.tasklet);
+	}
+}
+void sched_iso_bench(uint64 cpu, uint64 periods, uint64 load){
+	char *names[] = {"isolated", "normal"};
+	uint64 old = cpu_isolated_mask();
+	uint64 cpus[2];
+	uint64 i;
+	if (!_timers || periods == 0 || cpu >= CPU_MAX || !_rq[cpu].online){
+		debug_print(DC_WRD, "Isolation bench: no timers or CPU%d offline", cpu);
+		return;
+	}
+	if (!sched_isolate(old | (1ULL << cpu))){
+		debug_print(DC_WRD, "Isolation bench: can't isolate CPU%d", cpu);
+		return;
+	}
+	mem_fill((uint8 *)&_iso_bench, sizeof(_iso_bench), 0);
+	_iso_bench.periods = periods;
+	tasklet_init(&_iso_bench.tasklet, sched_iso_bench_tasklet, 0);
+	cpus[0] = cpu;
+	cpus[1] = cpu_housekeeping();
+	for (i = 0; i < load; i ++){
+		thread_create("load", sched_iso_bench_load, null, SCHED_FAIR, 0);
+	}
+	for (i = 0; i < 2; i ++){
+		if (thread_create_on("dsp", sched_iso_bench_dsp, &_iso_bench.stat[i], SCHED_RT, SCHED_RT_PRIO_MAX - 1, cpus[i]) == null){
+			_iso_bench.stat[i].done = true;
+		}
+	}
+	while (!_iso_bench.stat[0].done || !_iso_bench.stat[1].done){
+		thread_sleep(10000000ULL);
+	}
+	_iso_bench.stop = true;
+	debug_print(DC_WB, "Isolation, %d periods of 32 samples at 48kHz, %d load threads", periods, load);
+	for (i = 0; i < 2; i ++){
+		debug_print(DC_WB, "CPU%d %s: min %dns, avg %dns, max %dns, xruns %d", cpus[i], names[i], _iso_bench.stat[i].min, _iso_bench.stat[i].sum / periods, _iso_bench.stat[i].max, _iso_bench.stat[i].xruns);
+	}
+	// Only removes CPUs from the mask, can't fail
+	sched_isolate(old);
+}
+#endif
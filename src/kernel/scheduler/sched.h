@@ -0,0 +1,291 @@
+/*
+
+Thread scheduler
+================
+
+Preemptive scheduler of kernel threads with per-CPU run queues.
+Scheduling classes in order of precedence:
+* deadline - earliest deadline first with runtime/period reservations
+* real-time - fixed priority, first-in first-out within a priority
+* fair - time-sharing by weighted virtual run time
+* idle - per-CPU idle thread
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __sched_h
+#define __sched_h
+
+#include "common.h"
+#include "../config.h"
+#include "timer.h"
+
+// Maximum number of threads (thread structures and stacks are preallocated)
+#define SCHED_THREAD_MAX		64
+// Kernel stack size of a thread
+#define SCHED_STACK_SIZE		0x4000
+// Real-time priorities (0 - lowest, 63 - highest)
+#define SCHED_RT_PRIO_MAX		64
+// Fair class nice levels (-20 - highest weight, 19 - lowest weight)
+#define SCHED_NICE_MIN			-20
+#define SCHED_NICE_MAX			19
+// Fair class time slice (ns)
+#define SCHED_SLICE_NS			4000000ULL
+// Woken fair thread preempts another fair thread if it's behind by this much (ns)
+#define SCHED_WAKE_GRAN_NS		1000000ULL
+// Deadline class bandwidth fixed point shift (1 << SCHED_DL_BW_SHIFT is 100% of a CPU)
+#define SCHED_DL_BW_SHIFT		20
+// Deadline class bandwidth a CPU admits (95%, the rest is left for other classes)
+#define SCHED_DL_BW_MAX			((95ULL << SCHED_DL_BW_SHIFT) / 100)
+// Interval of load balancing on a CPU with queued fair threads (ns)
+#define SCHED_BALANCE_NS		4000000ULL
+// Difference in runnable threads needed to move threads to a CPU that shares no L2 or L3 cache
+#define SCHED_BALANCE_FAR		4
+// Period of the isolation benchmark - 32 samples at 48kHz (ns)
+#define SCHED_ISO_PERIOD_NS		((32ULL * 1000000000ULL) / 48000)
+
+// Scheduling classes (higher class always preempts lower one)
+#define SCHED_IDLE				0
+#define SCHED_FAIR				1
+#define SCHED_RT				2
+#define SCHED_DEADLINE			3
+
+// Thread states
+#define THREAD_FREE				0	// Unused thread structure
+#define THREAD_RUNNABLE			1	// Running or waiting in a run queue
+#define THREAD_BLOCKED			2	// Waiting for thread_wake()
+#define THREAD_DEAD				3	// Exited, stack is still in use until switched away
+
+/**
+* Thread entry point
+* @param arg - argument passed to thread_create()
+*/
+typedef void (*thread_func_t)(void *arg);
+/**
+* Kernel thread
+*/
+struct thread_struct {
+	uint64 rsp;					// Saved stack pointer (switch.asm depends on this being first)
+	struct thread_struct *next;	// Run queue link
+	struct thread_struct *prev;	// Run queue link
+	uint64 volatile state;		// THREAD_*
+	uint64 id;					// Thread index
+	char *name;					// Name (for debugging)
+	uint8 policy;				// Scheduling class (SCHED_*)
+	int64 prio;					// Real-time priority or nice level
+	bool yield;					// Yielded the CPU (requeue behind its peers)
+	bool on_rq;					// Queued in a run queue
+	uint64 cpu;					// CPU this thread runs on
+	uint64 affinity;			// CPUs this thread may run on (bit mask)
+	uint64 weight;				// Fair class weight
+	uint64 vruntime;			// Fair class virtual run time (ns)
+	uint64 exec_start;			// Time it was last switched in (ns)
+	uint64 runtime;				// Total run time (ns)
+	uint64 switches;			// Number of times it was switched in
+	uint64 migrations;			// Number of times load balancing has moved it to another CPU
+	thread_func_t func;			// Entry point
+	void *arg;					// Entry point argument
+	uint8 *stack;				// Bottom of the stack
+	uint64 kernel_rsp;			// Kernel stack while running in user mode (0 - kernel only)
+	uint8 *fpu;					// FPU/SIMD save area (null - never uses FPU registers)
+	timer_t timer;				// Sleep timer
+	uint64 dl_runtime;			// Deadline class: budget per period (ns)
+	uint64 dl_deadline;			// Deadline class: relative deadline (ns)
+	uint64 dl_period;			// Deadline class: period (ns)
+	uint64 dl_bw;				// Deadline class: reserved bandwidth (runtime / period)
+	uint64 dl_release;			// Deadline class: start of the current period (ns)
+	uint64 dl_abs_deadline;		// Deadline class: absolute deadline of the current job (ns)
+	uint64 dl_budget;			// Deadline class: budget left in the current period (ns)
+	bool dl_throttled;			// Deadline class: budget exhausted, waiting for replenishment
+	uint64 dl_misses;			// Deadline class: jobs finished after their deadline
+	uint64 dl_overruns;			// Deadline class: jobs that ran out of budget
+	timer_t dl_timer;			// Deadline class: budget replenishment timer
+};
+typedef struct thread_struct thread_t;
+
+/**
+* Initialize scheduler on the bootstrap processor
+* Calling context becomes a fair thread named "kmain"
+*/
+void sched_init();
+/**
+* Initialize scheduler on an application processor
+* Calling context becomes the idle thread of this CPU (never returns)
+*/
+void sched_init_cpu();
+/**
+* Create a thread and make it runnable
+* @param name - thread name
+* @param func - entry point
+* @param arg - entry point argument
+* @param policy - scheduling class (SCHED_FAIR or SCHED_RT, see thread_set_deadline() for SCHED_DEADLINE)
+* @param prio - real-time priority (0 - 63) or nice level (-20 - 19)
+* @return thread or null if there are no free thread structures
+*/
+thread_t *thread_create(char *name, thread_func_t func, void *arg, uint8 policy, int64 prio);
+/**
+* Create a thread pinned to a CPU and make it runnable
+* @param name - thread name
+* @param func - entry point
+* @param arg - entry point argument
+* @param policy - scheduling class (SCHED_FAIR or SCHED_RT)
+* @param prio - real-time priority (0 - 63) or nice level (-20 - 19)
+* @param cpu - CPU index (must be online, isolated CPUs only take SCHED_RT)
+* @return thread or null on invalid arguments or if there are no free thread structures
+*/
+thread_t *thread_create_on(char *name, thread_func_t func, void *arg, uint8 policy, int64 prio, uint64 cpu);
+/**
+* Change scheduling class of a thread
+* @param thread - thread
+* @param policy - scheduling class (SCHED_FAIR or SCHED_RT)
+* @param prio - real-time priority (0 - 63) or nice level (-20 - 19)
+* @return false on invalid arguments or SCHED_FAIR on an isolated CPU
+*/
+bool thread_set_policy(thread_t *thread, uint8 policy, int64 prio);
+/**
+* Move a thread to the deadline class
+* Thread gets runtime ns of CPU time within deadline ns from the start of every period.
+* Admission fails if the thread's CPU can't guarantee it (total runtime / period over SCHED_DL_BW_MAX).
+* @param thread - thread
+* @param runtime - budget per period (ns)
+* @param deadline - relative deadline (ns, runtime <= deadline <= period)
+* @param period - period (ns)
+* @return false on invalid arguments or if bandwidth is not available
+*/
+bool thread_set_deadline(thread_t *thread, uint64 runtime, uint64 deadline, uint64 period);
+/**
+* Finish the current job of a deadline thread and sleep until the next period
+* (for other classes it's the same as thread_yield())
+*/
+void thread_dl_yield();
+/**
+* Get the calling thread
+* @return thread
+*/
+thread_t *thread_current();
+/**
+* Terminate the calling thread
+*/
+void thread_exit() __NORETURN;
+/**
+* Give up the CPU to threads of the same or higher priority
+*/
+void thread_yield();
+/**
+* Mark the calling thread as blocked (call before checking the wait condition)
+*/
+void thread_block_prepare();
+/**
+* Switch away from the calling thread until thread_wake() is called
+* (returns immediately if thread_wake() has been called since thread_block_prepare())
+*/
+void thread_block();
+/**
+* Make a blocked thread runnable
+* @param thread - thread
+* @return true if thread was blocked
+*/
+bool thread_wake(thread_t *thread);
+/**
+* Sleep until an absolute time
+* @param ns - monotonic clock time (ns)
+*/
+void thread_sleep_until(uint64 ns);
+/**
+* Sleep for a period of time
+* @param ns - time to sleep (ns)
+*/
+void thread_sleep(uint64 ns);
+/**
+* Pick the next thread and switch to it
+* Must not be called with spinlocks held
+*/
+void schedule();
+/**
+* Dedicate CPUs to pinned real-time threads
+* Isolated CPUs are skipped by load balancing and thread_create(), softirqs, tasklets and
+* RCU callbacks raised there run on the housekeeping CPU, RCU does not kick them, TLB flushes
+* issued there are not batched and device interrupts are not routed to them.
+* There is no periodic tick to stop - timers only fire when a thread there asks for them.
+* Blocked fair threads that last ran on a newly isolated CPU are moved to a housekeeping CPU
+* and message signaled interrupts already targeting it are retargeted there.
+* @param mask - CPUs to isolate (replaces the previous mask, 0 - none)
+* @return false if no housekeeping CPU would be left, a newly isolated CPU runs fair threads
+* or has fair threads other than its softirq thread pinned to it
+*/
+bool sched_isolate(uint64 mask);
+/**
+* Run the scheduler on interrupt exit if a reschedule was requested
+* @see interrupts.c
+*/
+void sched_irq_exit();
+/**
+* Switch stacks between two threads
+* @see switch.asm
+* @param prev_rsp - where to store the stack pointer of the current thread
+* @param next_rsp - stack pointer of the next thread
+*/
+extern void sched_switch(uint64 *prev_rsp, uint64 next_rsp);
+
+#if DEBUG == 1
+/**
+* List all the threads
+*/
+void sched_list();
+/**
+* Wake-up latency benchmark (cyclictest-style)
+* Real-time thread sleeps until periodic deadlines while fair threads load the CPU
+* and measures how late it's been running after each deadline
+* @param loops - number of periods
+* @param interval - period (ns)
+* @param load - number of fair load threads
+*/
+void sched_bench(uint64 loops, uint64 interval, uint64 load);
+/**
+* Load balancing throughput benchmark
+* Creates short-lived fair threads of uneven length, first without and then with load balancing,
+* and prints threads per second and migrations
+* @param threads - number of threads to run
+* @param work - busy loop iterations of the longest thread
+*/
+void sched_balance_bench(uint64 threads, uint64 work);
+/**
+* Isolation jitter benchmark
+* Isolates a CPU, then real-time threads on it and on the housekeeping CPU process a 32 sample
+* buffer at 48kHz each while fair threads load the other CPUs with deferred work.
+* Wake-up jitter and buffers finished late are printed for both.
+* @param cpu - CPU to isolate (online, not the only one)
+* @param periods - number of periods
+* @param load - number of fair load threads
+*/
+void sched_iso_bench(uint64 cpu, uint64 periods, uint64 load);
+#endif
+
+#endif /* __sched_h */
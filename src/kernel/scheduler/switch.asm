@@ -0,0 +1,56 @@
+;
+; Thread context switch
+; =====================
+;
+; Saves callee-saved registers of the current thread on its stack and
+; restores them from the stack of the next thread.
+;
+; License (BSD-3)
+; ===============
+;
+; Copyright (c) 2013, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+; All rights reserved.
+;
+; Redistribution and use in source and binary forms, with or without
+; modification, are permitted provided that the following conditions are met:
+;    * Redistributions of source code must retain the above copyright
+;      notice, this list of conditions and the following disclaimer.
+;    * Redistributions in binary form must reproduce the above copyright
+;      notice, this list of conditions and the following disclaimer in the
+;      documentation and/or other materials provided with the distribution.
+;    * Neither the name of the <organization> nor the
+;      names of its contributors may be used to endorse or promote products
+;      derived from this software without specific prior written permission.
+;
+; THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+; ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+; WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+; DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+; DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+; (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+; ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+; SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+;
+
+[section .text]
+[bits 64]
+[global sched_switch]							; Export void sched_switch(uint64 *prev_rsp, uint64 next_rsp) to C
+
+sched_switch:									; prototype: void sched_switch(uint64 *prev_rsp, uint64 next_rsp)
+	push rbp									; push callee-saved registers of the current thread
+	push rbx
+	push r12
+	push r13
+	push r14
+	push r15
+	mov [rdi], rsp								; store current stack pointer (1st argument goes into RDI)
+	mov rsp, rsi								; load next thread's stack pointer (2nd argument goes into RSI)
+	pop r15										; pop callee-saved registers of the next thread
+	pop r14
+	pop r13
+	pop r12
+	pop rbx
+	pop rbp
+	ret											; return to where the next thread has called sched_switch()
@@ -0,0 +1,211 @@
+/*
+
+Blocking synchronization
+========================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "sync.h"
+#include "futex.h"
+#include "sched.h"
+#if DEBUG == 1
+	#include "spinlock.h"
+	#include "clock.h"
+	#include "msr.h"
+	#include "debug_print.h"
+#endif
+
+void mutex_lock_slow(mutex_t *mutex){
+	uint32 state;
+	uint64 i;
+	// Holder on another CPU is likely to release it soon
+	for (i = 0; i < MUTEX_SPIN; i ++){
+		state = __atomic_load_n(&mutex->state, __ATOMIC_RELAXED);
+		if (state == MUTEX_UNLOCKED && mutex_trylock(mutex)){
+			return;
+		}
+		if (state == MUTEX_CONTENDED){
+			break;
+		}
+		asm volatile("pause");
+	}
+	// Lock it as contended - we can't know whether others are still waiting
+	while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) != MUTEX_UNLOCKED){
+		futex_wait(&mutex->state, MUTEX_CONTENDED, 0);
+	}
+}
+void mutex_unlock_slow(mutex_t *mutex){
+	futex_wake(&mutex->state, 1);
+}
+bool cond_wait_until(cond_t *cond, mutex_t *mutex, uint64 deadline){
+	uint32 seq = __atomic_load_n(&cond->seq, __ATOMIC_RELAXED);
+	uint64 ret;
+	mutex_unlock(mutex);
+	// Signal between unlock and wait changes seq, so it's not lost
+	ret = futex_wait(&cond->seq, seq, deadline);
+	// Other waiters may still be queued on the mutex
+	while (__atomic_exchange_n(&mutex->state, MUTEX_CONTENDED, __ATOMIC_ACQUIRE) != MUTEX_UNLOCKED){
+		futex_wait(&mutex->state, MUTEX_CONTENDED, 0);
+	}
+	return (ret != FUTEX_TIMEOUT);
+}
+void cond_signal(cond_t *cond){
+	__atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&cond->seq, 1);
+}
+void cond_broadcast(cond_t *cond){
+	__atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&cond->seq, FUTEX_WAKE_ALL);
+}
+void sem_wait_slow(sem_t *sem){
+	__atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+	while (!sem_trywait(sem)){
+		futex_wait(&sem->count, 0, 0);
+	}
+	__atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_RELAXED);
+}
+void sem_post(sem_t *sem){
+	__atomic_add_fetch(&sem->count, 1, __ATOMIC_SEQ_CST);
+	// Waiter increments waiters before it checks the count, so one of us sees the other
+	if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0){
+		futex_wake(&sem->count, 1);
+	}
+}
+
+#if DEBUG == 1
+/**
+* Benchmark state
+*/
+static struct {
+	mutex_t lock;
+	cond_t cond;
+	sem_t done;
+	uint64 loops;
+	uint64 counter;
+	uint64 turn;
+} _bench;
+
+/**
+* Contending thread - yields while holding the mutex, so every other thread finds it locked
+*/
+static void sync_bench_contend(void *arg){
+	uint64 i;
+	for (i = 0; i < _bench.loops; i ++){
+		mutex_lock(&_bench.lock);
+		_bench.counter ++;
+		thread_yield();
+		mutex_unlock(&_bench.lock);
+	}
+	sem_post(&_bench.done);
+}
+/**
+* Condition variable ping-pong partner
+*/
+static void sync_bench_pong(void *arg){
+	uint64 i;
+	mutex_lock(&_bench.lock);
+	for (i = 0; i < _bench.loops; i ++){
+		while (_bench.turn != 1){
+			cond_wait(&_bench.cond, &_bench.lock);
+		}
+		_bench.turn = 0;
+		cond_signal(&_bench.cond);
+	}
+	mutex_unlock(&_bench.lock);
+	sem_post(&_bench.done);
+}
+void sync_bench(uint64 loops, uint64 threads){
+	spinlock_t spin = SPINLOCK_INIT;
+	sem_t sem;
+	uint64 start;
+	uint64 t;
+	uint64 i;
+	if (loops == 0 || threads == 0){
+		return;
+	}
+	mutex_init(&_bench.lock);
+	cond_init(&_bench.cond);
+	sem_init(&_bench.done, 0);
+	_bench.loops = loops;
+	_bench.counter = 0;
+	_bench.turn = 0;
+	// Uncontended
+	start = rdtsc();
+	for (i = 0; i < loops; i ++){
+		spinlock_lock(&spin);
+		spinlock_unlock(&spin);
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "Spinlock lock/unlock: %dns", clock_tsc_to_ns(t) / loops);
+	start = rdtsc();
+	for (i = 0; i < loops; i ++){
+		mutex_lock(&_bench.lock);
+		mutex_unlock(&_bench.lock);
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "Mutex lock/unlock: %dns", clock_tsc_to_ns(t) / loops);
+	sem_init(&sem, 0);
+	start = rdtsc();
+	for (i = 0; i < loops; i ++){
+		sem_post(&sem);
+		sem_wait(&sem);
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "Semaphore post/wait: %dns", clock_tsc_to_ns(t) / loops);
+	// Contended - every acquisition blocks and every release wakes
+	start = rdtsc();
+	for (i = 0; i < threads; i ++){
+		thread_create("sync", sync_bench_contend, null, SCHED_FAIR, 0);
+	}
+	for (i = 0; i < threads; i ++){
+		sem_wait(&_bench.done);
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "Contended mutex, %d threads: %dns per lock/unlock, counter %s",
+		threads, clock_tsc_to_ns(t) / (loops * threads), (_bench.counter == loops * threads ? "OK" : "BAD"));
+	// Condition variable round trip
+	thread_create("sync", sync_bench_pong, null, SCHED_FAIR, 0);
+	start = rdtsc();
+	mutex_lock(&_bench.lock);
+	for (i = 0; i < loops; i ++){
+		_bench.turn = 1;
+		cond_signal(&_bench.cond);
+		while (_bench.turn != 0){
+			cond_wait(&_bench.cond, &_bench.lock);
+		}
+	}
+	mutex_unlock(&_bench.lock);
+	sem_wait(&_bench.done);
+	t = rdtsc() - start;
+	debug_print(DC_WB, "Condition variable round trip: %dns", clock_tsc_to_ns(t) / loops);
+}
+#endif
@@ -0,0 +1,210 @@
+/*
+
+Blocking synchronization
+========================
+
+Mutex, condition variable and semaphore built on futex wait queues. Fast paths
+are a single atomic instruction and never enter the wait queues or take a lock.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __sync_h
+#define __sync_h
+
+#include "common.h"
+#include "../config.h"
+
+// Mutex states
+#define MUTEX_UNLOCKED		0
+#define MUTEX_LOCKED		1	// Locked, nobody waits
+#define MUTEX_CONTENDED		2	// Locked, there might be waiters
+// Spins before a contended lock blocks (holder might be running on another CPU)
+#define MUTEX_SPIN			100
+
+/**
+* Mutex
+*/
+struct mutex_struct {
+	uint32 state;
+};
+typedef struct mutex_struct mutex_t;
+/**
+* Condition variable
+*/
+struct cond_struct {
+	uint32 seq;							// Incremented by every signal
+};
+typedef struct cond_struct cond_t;
+/**
+* Counting semaphore
+*/
+struct sem_struct {
+	uint32 count;
+	uint32 waiters;
+};
+typedef struct sem_struct sem_t;
+
+#define MUTEX_INIT {MUTEX_UNLOCKED}
+#define COND_INIT {0}
+#define SEM_INIT(count) {(count), 0}
+
+/**
+* Lock a mutex that was found locked
+* @param mutex - mutex
+*/
+void mutex_lock_slow(mutex_t *mutex);
+/**
+* Wake up a thread waiting on a contended mutex
+* @param mutex - mutex
+*/
+void mutex_unlock_slow(mutex_t *mutex);
+/**
+* Block until the semaphore count can be decremented
+* @param sem - semaphore
+*/
+void sem_wait_slow(sem_t *sem);
+/**
+* Wait for a condition variable to be signalled
+* Mutex is released while waiting and locked again before return
+* @param cond - condition variable
+* @param mutex - locked mutex
+* @param deadline - absolute monotonic clock time (ns) or 0 to wait forever
+* @return false if the deadline passed
+*/
+bool cond_wait_until(cond_t *cond, mutex_t *mutex, uint64 deadline);
+/**
+* Wake up one thread waiting on a condition variable
+* @param cond - condition variable
+*/
+void cond_signal(cond_t *cond);
+/**
+* Wake up all threads waiting on a condition variable
+* @param cond - condition variable
+*/
+void cond_broadcast(cond_t *cond);
+/**
+* Increment the semaphore count and wake a waiter (can be called from interrupt handlers)
+* @param sem - semaphore
+*/
+void sem_post(sem_t *sem);
+
+/**
+* Initialize a mutex
+* @param mutex - mutex
+*/
+static void mutex_init(mutex_t *mutex){
+	mutex->state = MUTEX_UNLOCKED;
+}
+/**
+* Try to lock a mutex without blocking
+* @param mutex - mutex
+* @return true if locked
+*/
+static bool mutex_trylock(mutex_t *mutex){
+	uint32 expected = MUTEX_UNLOCKED;
+	return __atomic_compare_exchange_n(&mutex->state, &expected, MUTEX_LOCKED, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+/**
+* Lock a mutex (blocks the calling thread while it's locked)
+* @param mutex - mutex
+*/
+static void mutex_lock(mutex_t *mutex){
+	if (!mutex_trylock(mutex)){
+		mutex_lock_slow(mutex);
+	}
+}
+/**
+* Unlock a mutex
+* @param mutex - mutex
+*/
+static void mutex_unlock(mutex_t *mutex){
+	if (__atomic_exchange_n(&mutex->state, MUTEX_UNLOCKED, __ATOMIC_RELEASE) == MUTEX_CONTENDED){
+		mutex_unlock_slow(mutex);
+	}
+}
+/**
+* Initialize a condition variable
+* @param cond - condition variable
+*/
+static void cond_init(cond_t *cond){
+	cond->seq = 0;
+}
+/**
+* Wait for a condition variable to be signalled
+* @param cond - condition variable
+* @param mutex - locked mutex
+*/
+static void cond_wait(cond_t *cond, mutex_t *mutex){
+	cond_wait_until(cond, mutex, 0);
+}
+/**
+* Initialize a semaphore
+* @param sem - semaphore
+* @param count - initial count
+*/
+static void sem_init(sem_t *sem, uint32 count){
+	sem->count = count;
+	sem->waiters = 0;
+}
+/**
+* Try to decrement the semaphore count without blocking
+* @param sem - semaphore
+* @return true if decremented
+*/
+static bool sem_trywait(sem_t *sem){
+	uint32 count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+	while (count > 0){
+		if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+			return true;
+		}
+	}
+	return false;
+}
+/**
+* Decrement the semaphore count (blocks the calling thread while it's 0)
+* @param sem - semaphore
+*/
+static void sem_wait(sem_t *sem){
+	if (!sem_trywait(sem)){
+		sem_wait_slow(sem);
+	}
+}
+
+#if DEBUG == 1
+/**
+* Measure uncontended and contended lock/unlock cost
+* @param loops - lock/unlock pairs per thread
+* @param threads - number of contending threads
+*/
+void sync_bench(uint64 loops, uint64 threads);
+#endif
+
+#endif /* __sync_h */
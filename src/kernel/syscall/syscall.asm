@@ -0,0 +1,213 @@
+;
+; System call entry
+; =================
+;
+; SYSCALL/SYSRET entry with SWAPGS and a per-CPU kernel stack, the same
+; dispatch through an int 0x80 gate and user mode enter/leave helpers.
+;
+; License (BSD-3)
+; ===============
+;
+; Copyright (c) 2013, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+; All rights reserved.
+;
+; Redistribution and use in source and binary forms, with or without
+; modification, are permitted provided that the following conditions are met:
+;    * Redistributions of source code must retain the above copyright
+;      notice, this list of conditions and the following disclaimer.
+;    * Redistributions in binary form must reproduce the above copyright
+;      notice, this list of conditions and the following disclaimer in the
+;      documentation and/or other materials provided with the distribution.
+;    * Neither the name of the <organization> nor the
+;      names of its contributors may be used to endorse or promote products
+;      derived from this software without specific prior written permission.
+;
+; THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+; ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+; WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+; DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+; DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+; (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+; ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+; (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+; SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+;
+
+[section .text]
+[bits 64]
+[extern syscall_table]							; Import syscall_func_t syscall_table[] from C
+[extern gdt_set_kernel_stack]					; Import void gdt_set_kernel_stack(uint64 rsp) from C
+[global syscall_entry]							; Export SYSCALL entry point (LSTAR)
+[global syscall_int_entry]						; Export int 0x80 gate entry point
+[global syscall_user_enter]						; Export uint64 syscall_user_enter(uint64 entry, uint64 stack, uint64 arg, uint64 *kernel_rsp) to C
+[global syscall_user_leave]						; Export void syscall_user_leave(uint64 code, uint64 kernel_rsp) to C
+[global syscall_bench_user]						; Export user mode benchmark loop
+
+%define SYSCALL_COUNT 6							; Keep in sync with syscall.h
+%define SYSCALL_NOP 0
+%define SYSCALL_EXIT 1
+%define SYSCALL_ENOSYS -1
+%define GDT_USER_DATA 0x1B
+%define GDT_USER_CODE 0x23
+%define PERCPU_KERNEL_RSP 16					; percpu_t.kernel_rsp
+%define PERCPU_USER_RSP 24						; percpu_t.user_rsp
+
+; Macro to save argument registers that C code is allowed to clobber (only RAX, RCX and R11 are returned clobbered)
+%macro PUSH_ARGS 0
+	push rdi
+	push rsi
+	push rdx
+	push r8
+	push r9
+	push r10
+%endmacro
+
+; Macro to restore argument registers
+%macro POP_ARGS 0
+	pop r10
+	pop r9
+	pop r8
+	pop rdx
+	pop rsi
+	pop rdi
+%endmacro
+
+; Macro to call a system call by number in RAX, arguments in RDI, RSI, RDX, R10, R8, R9
+%macro DISPATCH 0
+	cmp rax, SYSCALL_COUNT						; unsigned compare - rejects negative numbers too
+	jae %%bad
+	mov rcx, r10								; 4th argument goes into RCX in C calling convention
+	call [syscall_table + rax * 8]				; calls uint64 syscall_func_t(a0, a1, a2, a3, a4, a5)
+	jmp %%done
+%%bad:
+	mov rax, SYSCALL_ENOSYS
+%%done:
+%endmacro
+
+syscall_entry:									; SYSCALL: RCX - user RIP, R11 - user RFLAGS, IF cleared by FMASK
+	swapgs										; GS base - this CPU's percpu_t
+	mov [gs:PERCPU_USER_RSP], rsp				; stash user stack
+	mov rsp, [gs:PERCPU_KERNEL_RSP]				; switch to kernel stack
+	push qword [gs:PERCPU_USER_RSP]				; save user stack
+	push r11									; save user RFLAGS
+	push rcx									; save user RIP
+	PUSH_ARGS
+	sub rsp, 8									; keep the stack 16 byte aligned for C
+	sti											; system calls are preemptible
+	DISPATCH
+	cli											; nothing may touch GS or the stack scratch from here on
+	add rsp, 8
+	POP_ARGS
+	pop rcx										; user RIP
+	pop r11										; user RFLAGS
+	pop rsp										; user stack
+	swapgs										; GS base - user value
+	o64 sysret									; back to user mode
+
+syscall_int_entry:								; int 0x80 gate (DPL 3), same register convention as SYSCALL
+	test qword [rsp + 8], 3						; called from user mode? (CS on the interrupt frame)
+	jz .kernel
+	swapgs
+.kernel:
+	push rcx									; int preserves RCX and R11 as well
+	push r11
+	PUSH_ARGS
+	sub rsp, 8									; CPU aligned the frame to 16 bytes, keep it that way for C
+	sti
+	DISPATCH
+	cli
+	add rsp, 8
+	POP_ARGS
+	pop r11
+	pop rcx
+	test qword [rsp + 8], 3
+	jz .kernel_ret
+	swapgs
+.kernel_ret:
+	iretq
+
+syscall_user_enter:								; prototype: uint64 syscall_user_enter(uint64 entry, uint64 stack, uint64 arg, uint64 *kernel_rsp)
+	pushfq										; saved frame is restored by syscall_user_leave()
+	push rbp
+	push rbx
+	push r12
+	push r13
+	push r14
+	push r15
+	mov rbx, rdi								; entry
+	mov r12, rsi								; user stack
+	mov r13, rdx								; argument
+	mov [rcx], rsp								; let syscall_user_leave() find this frame
+	mov rdi, rsp								; kernel stack for user mode starts below the frame (16 byte aligned)
+	call gdt_set_kernel_stack
+	cli
+	push qword GDT_USER_DATA					; SS
+	push r12									; RSP
+	push qword 0x202							; RFLAGS - interrupts enabled
+	push qword GDT_USER_CODE					; CS
+	push rbx									; RIP
+	mov rdi, r13								; argument of the user function
+	xor eax, eax								; don't leak kernel values to user mode
+	xor ebx, ebx
+	xor ecx, ecx
+	xor edx, edx
+	xor esi, esi
+	xor ebp, ebp
+	xor r8d, r8d
+	xor r9d, r9d
+	xor r10d, r10d
+	xor r11d, r11d
+	xor r12d, r12d
+	xor r13d, r13d
+	xor r14d, r14d
+	xor r15d, r15d
+	swapgs										; GS base - user value
+	iretq
+
+syscall_user_leave:								; prototype: void syscall_user_leave(uint64 code, uint64 kernel_rsp)
+	cli
+	mov rsp, rsi								; drop the system call frame, back to syscall_user_enter()
+	mov rax, rdi								; return value of syscall_user_enter()
+	pop r15
+	pop r14
+	pop r13
+	pop r12
+	pop rbx
+	pop rbp
+	popfq
+	ret
+
+; User mode benchmark code - on its own page, so only this page has to be made user accessible
+align 4096
+syscall_bench_user:								; RDI - loop count, bit 63 set - use int 0x80, exits with TSC cycles spent
+	mov r12, rdi
+	btr r12, 63
+	setc r14b
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov r13, rax								; start time
+	test r14b, r14b
+	jnz .int_loop
+.syscall_loop:
+	mov eax, SYSCALL_NOP
+	syscall
+	dec r12
+	jnz .syscall_loop
+	jmp .done
+.int_loop:
+	mov eax, SYSCALL_NOP
+	int 0x80
+	dec r12
+	jnz .int_loop
+.done:
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	sub rax, r13
+	mov rdi, rax								; exit code - cycles spent
+	mov eax, SYSCALL_EXIT
+	syscall
+	ud2											; not reached
+align 4096
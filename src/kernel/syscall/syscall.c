@@ -0,0 +1,136 @@
+/*
+
+System calls
+============
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "syscall.h"
+#include "interrupts.h"
+#include "gdt.h"
+#include "msr.h"
+#include "sched.h"
+#include "clock.h"
+#include "vdso.h"
+#if DEBUG == 1
+	#include "paging.h"
+	#include "debug_print.h"
+#endif
+
+// EFER system call extensions enable bit
+#define EFER_SCE			0x1
+// RFLAGS cleared on SYSCALL: TF, IF, DF, AC
+#define SYSCALL_FMASK		0x40700
+
+static uint64 syscall_nop(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5){
+	return 0;
+}
+static uint64 syscall_exit(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5){
+	thread_t *t = thread_current();
+	if (t->kernel_rsp == 0){
+		// Not entered through syscall_user_run()
+		return SYSCALL_ENOSYS;
+	}
+	syscall_user_leave(a0, t->kernel_rsp);
+}
+static uint64 syscall_yield(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5){
+	thread_yield();
+	return 0;
+}
+static uint64 syscall_sleep(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5){
+	thread_sleep(a0);
+	return 0;
+}
+static uint64 syscall_clock(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5){
+	return clock_monotonic_ns();
+}
+static uint64 syscall_time_page(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5){
+	return (uint64)vdso_time_page();
+}
+
+/**
+* System call table (indexed from syscall.asm)
+*/
+syscall_func_t syscall_table[SYSCALL_COUNT] = {
+	syscall_nop,
+	syscall_exit,
+	syscall_yield,
+	syscall_sleep,
+	syscall_clock,
+	syscall_time_page
+};
+
+void syscall_init(){
+	interrupt_set_gate(SYSCALL_VECTOR, (uint64)syscall_int_entry, 3);
+	syscall_init_cpu();
+}
+void syscall_init_cpu(){
+	uint64 efer;
+	msr_read(MSR_IA32_EFER, &efer);
+	msr_write(MSR_IA32_EFER, efer | EFER_SCE);
+	// SYSCALL loads CS = STAR[47:32], SS = CS + 8 (kernel code and data),
+	// SYSRET loads SS = STAR[63:48] + 8, CS = STAR[63:48] + 16 (user data and code)
+	msr_write(MSR_IA32_STAR, ((uint64)GDT_KERNEL_DATA << 48) | ((uint64)GDT_KERNEL_CODE << 32));
+	msr_write(MSR_IA32_LSTAR, (uint64)syscall_entry);
+	msr_write(MSR_IA32_FMASK, SYSCALL_FMASK);
+	// User GS base is swapped in on the way to user mode
+	msr_write(MSR_IA32_KERNEL_GS_BASE, 0);
+}
+uint64 syscall_user_run(uint64 entry, uint64 stack, uint64 arg){
+	thread_t *t = thread_current();
+	uint64 code;
+	code = syscall_user_enter(entry, stack, arg, &t->kernel_rsp);
+	t->kernel_rsp = 0;
+	return code;
+}
+
+#if DEBUG == 1
+// User mode stack of the benchmark
+static uint8 _bench_stack[PAGE_SIZE] __ALIGN(PAGE_SIZE);
+// User mode benchmark loop (syscall.asm)
+extern void syscall_bench_user();
+
+void syscall_bench(uint64 loops){
+	uint64 t;
+	if (loops == 0){
+		return;
+	}
+	page_set_user((uint64)syscall_bench_user, true);
+	page_set_user((uint64)_bench_stack, true);
+	t = syscall_user_run((uint64)syscall_bench_user, (uint64)_bench_stack + PAGE_SIZE, loops);
+	debug_print(DC_WB, "SYSCALL/SYSRET round trip: %dns", clock_tsc_to_ns(t) / loops);
+	t = syscall_user_run((uint64)syscall_bench_user, (uint64)_bench_stack + PAGE_SIZE, loops | (1ULL << 63));
+	debug_print(DC_WB, "int 0x80/iretq round trip: %dns", clock_tsc_to_ns(t) / loops);
+	page_set_user((uint64)syscall_bench_user, false);
+	page_set_user((uint64)_bench_stack, false);
+}
+#endif
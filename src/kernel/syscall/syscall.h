@@ -0,0 +1,119 @@
+/*
+
+System calls
+============
+
+Fast system call entry through SYSCALL/SYSRET and a compact call table.
+Arguments are passed in registers only: number in RAX, arguments in RDI, RSI,
+RDX, R10, R8 and R9, result in RAX. The same table is reachable through an
+int 0x80 gate.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __syscall_h
+#define __syscall_h
+
+#include "common.h"
+#include "../config.h"
+
+// System call numbers (keep SYSCALL_COUNT in sync with syscall.asm)
+#define SYSCALL_NOP			0	// Do nothing (entry cost)
+#define SYSCALL_EXIT		1	// Leave user mode, a0 - value returned by syscall_user_run()
+#define SYSCALL_YIELD		2	// Give up the CPU
+#define SYSCALL_SLEEP		3	// Sleep, a0 - time (ns)
+#define SYSCALL_CLOCK		4	// Get monotonic clock time (ns)
+#define SYSCALL_TIME_PAGE	5	// Get the address of the shared time page (lib/timepage.h)
+#define SYSCALL_COUNT		6
+// Result of an unknown system call
+#define SYSCALL_ENOSYS		((uint64)-1)
+// Interrupt gate vector
+#define SYSCALL_VECTOR		0x80
+
+/**
+* System call handler
+* @return value passed back in RAX
+*/
+typedef uint64 (*syscall_func_t)(uint64 a0, uint64 a1, uint64 a2, uint64 a3, uint64 a4, uint64 a5);
+
+/**
+* Install the int 0x80 gate and enable SYSCALL on the bootstrap processor
+*/
+void syscall_init();
+/**
+* Enable SYSCALL on the calling CPU (STAR, LSTAR and FMASK MSRs)
+*/
+void syscall_init_cpu();
+/**
+* Run code in user mode on the calling thread until it calls SYSCALL_EXIT
+* Code and stack pages must be user accessible (see page_set_user())
+* @param entry - user mode entry point
+* @param stack - top of the user mode stack
+* @param arg - argument passed in RDI
+* @return SYSCALL_EXIT argument
+*/
+uint64 syscall_user_run(uint64 entry, uint64 stack, uint64 arg);
+/**
+* SYSCALL entry point
+* @see syscall.asm
+*/
+extern void syscall_entry();
+/**
+* int 0x80 entry point
+* @see syscall.asm
+*/
+extern void syscall_int_entry();
+/**
+* Switch to user mode (returns when syscall_user_leave() is called)
+* @see syscall.asm
+* @param entry - user mode entry point
+* @param stack - top of the user mode stack
+* @param arg - argument passed in RDI
+* @param [out] kernel_rsp - kernel stack frame to return to
+* @return code passed to syscall_user_leave()
+*/
+extern uint64 syscall_user_enter(uint64 entry, uint64 stack, uint64 arg, uint64 *kernel_rsp);
+/**
+* Return from syscall_user_enter() (drops the current system call frame)
+* @see syscall.asm
+* @param code - return value of syscall_user_enter()
+* @param kernel_rsp - frame saved by syscall_user_enter()
+*/
+extern void syscall_user_leave(uint64 code, uint64 kernel_rsp) __NORETURN;
+
+#if DEBUG == 1
+/**
+* Measure SYSCALL/SYSRET and int 0x80 round trip from user mode
+* @param loops - number of calls
+*/
+void syscall_bench(uint64 loops);
+#endif
+
+#endif /* __syscall_h */
@@ -0,0 +1,353 @@
+/*
+
+Clock sources
+=============
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "clock.h"
+#include "acpi.h"
+#include "paging.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "cpuid.h"
+#include "cpufeature.h"
+#include "msr.h"
+#include "io.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+// HPET registers
+#define HPET_REG_CAP		0x000	// General capabilities and ID
+#define HPET_REG_CONF		0x010	// General configuration
+#define HPET_REG_COUNTER	0x0F0	// Main counter value
+#define HPET_CAP_64BIT		0x2000	// Main counter is 64 bits wide
+#define HPET_CONF_ENABLE	0x1		// Main counter runs
+// HPET period must not exceed 100ns (in femtoseconds)
+#define HPET_PERIOD_MAX		100000000
+
+// PIT ports
+#define PIT_CH2				0x42	// Channel 2 data port
+#define PIT_CMD				0x43	// Mode/Command register
+#define PIT_GATE			0x61	// Channel 2 gate (bit 0) and output (bit 5)
+
+static uint8 volatile _source = CLOCK_SOURCE_NONE;
+
+static uint64 _tsc_hz = 0;
+static uint64 _tsc_base = 0;
+static uint64 _tsc_mult = 0;		// ns = (cycles * _tsc_mult) >> 32
+static uint64 _tsc_div = 0;			// cycles = (ns * _tsc_div) >> 32
+
+static uint64 _hpet_addr = 0;
+static uint64 _hpet_period = 0;		// Femtoseconds per HPET tick
+static bool _hpet_64bit = false;
+
+static spinlock_t _acc_lock = SPINLOCK_INIT;
+static uint64 _acc_last = 0;		// Last raw counter value of 32/16-bit counters
+static uint64 _acc_ticks = 0;		// Accumulated ticks of 32/16-bit counters
+
+static uint64 volatile _sync_state = 0;
+static uint64 volatile _sync_tsc = 0;
+
+/**
+* Read HPET register
+*/
+static uint64 hpet_read(uint64 reg){
+	return *((uint64 volatile *)(_hpet_addr + reg));
+}
+/**
+* Write HPET register
+*/
+static void hpet_write(uint64 reg, uint64 value){
+	*((uint64 volatile *)(_hpet_addr + reg)) = value;
+}
+/**
+* Locate and enable HPET
+* @return true if HPET is usable
+*/
+static bool hpet_init(){
+	char sig[4] = {'H', 'P', 'E', 'T'};
+	HPET_t *hpet = (HPET_t *)acpi_table(sig);
+	uint64 cap;
+	if (hpet == null || hpet->address.address == 0){
+		return false;
+	}
+	_hpet_addr = hpet->address.address;
+	page_map_mmio(_hpet_addr);
+	cap = hpet_read(HPET_REG_CAP);
+	_hpet_period = (cap >> 32);
+	if (_hpet_period == 0 || _hpet_period > HPET_PERIOD_MAX){
+		_hpet_addr = 0;
+		return false;
+	}
+	_hpet_64bit = ((cap & HPET_CAP_64BIT) != 0);
+	hpet_write(HPET_REG_CONF, hpet_read(HPET_REG_CONF) | HPET_CONF_ENABLE);
+	return true;
+}
+/**
+* Read HPET main counter, extending 32-bit counters to 64 bits
+*/
+static uint64 hpet_ticks(){
+	uint64 now;
+	uint64 flags;
+	if (_hpet_64bit){
+		return hpet_read(HPET_REG_COUNTER);
+	}
+	flags = spinlock_lock_irq(&_acc_lock);
+	now = (uint32)hpet_read(HPET_REG_COUNTER);
+	_acc_ticks += (uint32)(now - _acc_last);
+	_acc_last = now;
+	now = _acc_ticks;
+	spinlock_unlock_irq(&_acc_lock, flags);
+	return now;
+}
+/**
+* Start PIT channel 2 counting down from the given value (mode 0, speaker disconnected)
+*/
+static void pit_start(uint16 count, uint8 mode){
+	outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+	outb(PIT_CMD, 0xB0 | (mode << 1));
+	outb(PIT_CH2, (uint8)count);
+	outb(PIT_CH2, (uint8)(count >> 8));
+}
+/**
+* Read PIT channel 2 counter
+*/
+static uint16 pit_count(){
+	uint16 count;
+	outb(PIT_CMD, 0x80);	// Latch channel 2
+	count = inb(PIT_CH2);
+	count |= ((uint16)inb(PIT_CH2)) << 8;
+	return count;
+}
+/**
+* Read accumulated PIT ticks (channel 2 counts down and wraps every 65536 ticks)
+*/
+static uint64 pit_ticks(){
+	uint64 now;
+	uint64 flags = spinlock_lock_irq(&_acc_lock);
+	now = pit_count();
+	_acc_ticks += (uint16)(_acc_last - now);
+	_acc_last = now;
+	now = _acc_ticks;
+	spinlock_unlock_irq(&_acc_lock, flags);
+	return now;
+}
+/**
+* Measure TSC frequency against HPET
+* @return TSC frequency in Hz
+*/
+static uint64 tsc_calibrate_hpet(){
+	uint64 wait = ((uint64)CLOCK_CALIBRATE_MS * 1000000000000ULL) / _hpet_period;
+	uint64 h0, h1, t0, t1;
+	h0 = hpet_ticks();
+	t0 = rdtsc();
+	do {
+		h1 = hpet_ticks();
+	} while (h1 - h0 < wait);
+	t1 = rdtsc();
+	return (uint64)(((unsigned __int128)(t1 - t0) * 1000000000000000ULL) / ((h1 - h0) * _hpet_period));
+}
+/**
+* Measure TSC frequency against PIT channel 2
+* @return TSC frequency in Hz
+*/
+static uint64 tsc_calibrate_pit(){
+	uint64 latch = (CLOCK_PIT_FREQ * CLOCK_CALIBRATE_MS) / 1000;
+	uint64 t0, t1;
+	pit_start((uint16)latch, 0);
+	t0 = rdtsc();
+	// Output goes high once the counter reaches zero
+	while ((inb(PIT_GATE) & 0x20) == 0){
+		asm volatile("pause");
+	}
+	t1 = rdtsc();
+	return ((t1 - t0) * CLOCK_PIT_FREQ) / latch;
+}
+/**
+* Check whether TSC runs at a constant rate in all power states
+*/
+static bool tsc_invariant(){
+	return cpu_has(CPU_FEATURE_TSC_INVARIANT);
+}
+/**
+* Get TSC frequency from CPUID leaf 0x15 (TSC / crystal clock ratio)
+* @return TSC frequency in Hz or 0 if it's not enumerated
+*/
+static uint64 tsc_cpuid_hz(){
+	uint32 eax, ebx, ecx, edx;
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x15){
+		return 0;
+	}
+	cpuid(0x15, &eax, &ebx, &ecx, &edx);
+	if (eax == 0 || ebx == 0 || ecx == 0){
+		return 0;
+	}
+	return ((uint64)ecx * ebx) / eax;
+}
+/**
+* Calibrate TSC
+* @return TSC frequency in Hz or 0 if calibration runs disagree
+*/
+static uint64 tsc_calibrate(){
+	uint64 hz;
+	uint64 min = ~((uint64)0);
+	uint64 max = 0;
+	uint64 i;
+	for (i = 0; i < CLOCK_CALIBRATE_RUNS; i ++){
+		if (_hpet_addr != 0){
+			hz = tsc_calibrate_hpet();
+		} else {
+			hz = tsc_calibrate_pit();
+		}
+		if (hz < min){
+			min = hz;
+		}
+		if (hz > max){
+			max = hz;
+		}
+	}
+	if (min == 0 || ((max - min) * 1000000) / min > CLOCK_CALIBRATE_PPM){
+		return 0;
+	}
+	// Shortest run had the least interference (SMIs, emulator exits)
+	return min;
+}
+
+bool clock_init(){
+	uint64 flags;
+	hpet_init();
+	// Disable interrupts for the calibration
+	asm volatile("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+	_tsc_hz = tsc_cpuid_hz();
+	if (_tsc_hz == 0){
+		_tsc_hz = tsc_calibrate();
+	}
+	if (_tsc_hz != 0){
+		_tsc_mult = (1000000000ULL << 32) / _tsc_hz;
+		_tsc_div = (uint64)(((unsigned __int128)_tsc_hz << 32) / 1000000000ULL);
+	}
+	_acc_ticks = 0;
+	if (_tsc_hz != 0 && tsc_invariant()){
+		_tsc_base = rdtsc();
+		_source = CLOCK_SOURCE_TSC;
+	} else if (_hpet_addr != 0){
+		_acc_last = (uint32)hpet_read(HPET_REG_COUNTER);
+		_source = CLOCK_SOURCE_HPET;
+	} else {
+		// Free running channel 2 (rate generator, full 65536 period)
+		pit_start(0, 2);
+		_acc_last = pit_count();
+		_source = CLOCK_SOURCE_PIT;
+	}
+	if (flags & 0x200){
+		asm volatile("sti" : : : "memory");
+	}
+	return (_source != CLOCK_SOURCE_NONE);
+}
+uint64 clock_monotonic_ns(){
+	uint64 ticks;
+	switch (_source){
+		case CLOCK_SOURCE_TSC:
+			return clock_tsc_to_ns(rdtsc() + percpu_this()->tsc_offset - _tsc_base);
+		case CLOCK_SOURCE_HPET:
+			ticks = hpet_ticks();
+			return (uint64)(((unsigned __int128)ticks * _hpet_period) / 1000000);
+		case CLOCK_SOURCE_PIT:
+			ticks = pit_ticks();
+			return (uint64)(((unsigned __int128)ticks * 1000000000ULL) / CLOCK_PIT_FREQ);
+	}
+	return 0;
+}
+uint8 clock_source(){
+	return _source;
+}
+uint64 clock_tsc_khz(){
+	return _tsc_hz / 1000;
+}
+uint64 clock_tsc_to_ns(uint64 cycles){
+	return (uint64)(((unsigned __int128)cycles * _tsc_mult) >> 32);
+}
+uint64 clock_ns_to_tsc(uint64 ns){
+	return (uint64)(((unsigned __int128)ns * _tsc_div) >> 32);
+}
+bool clock_tsc_params(uint64 *base, uint64 *mult){
+	*base = _tsc_base;
+	*mult = _tsc_mult;
+	return (_source == CLOCK_SOURCE_TSC);
+}
+uint64 clock_tsc_deadline(uint64 ns){
+	return _tsc_base + clock_ns_to_tsc(ns) - percpu_this()->tsc_offset;
+}
+void clock_sync_master(){
+	uint64 i;
+	for (i = 0; i < CLOCK_SYNC_ROUNDS; i ++){
+		while (_sync_state != 1){
+			asm volatile("pause");
+		}
+		_sync_tsc = rdtsc();
+		_sync_state = 2;
+	}
+}
+void clock_sync_cpu(){
+	uint64 best = ~((uint64)0);
+	int64 offset = 0;
+	uint64 t0, t1, ref;
+	uint64 i;
+	for (i = 0; i < CLOCK_SYNC_ROUNDS; i ++){
+		t0 = rdtsc();
+		_sync_state = 1;
+		while (_sync_state != 2){
+			asm volatile("pause");
+		}
+		t1 = rdtsc();
+		ref = _sync_tsc;
+		_sync_state = 0;
+		// Assume the master read its TSC half way through the round trip; trust the fastest round
+		if (t1 - t0 < best){
+			best = t1 - t0;
+			offset = (int64)(ref - (t0 + ((t1 - t0) / 2)));
+		}
+	}
+	percpu_this()->tsc_offset = offset;
+}
+#if DEBUG == 1
+void clock_list(){
+	char *names[] = {"none", "TSC", "HPET", "PIT"};
+	debug_print(DC_WB, "Clock: %s, TSC: %dkHz", names[_source], clock_tsc_khz());
+	if (_hpet_addr != 0){
+		debug_print(DC_WB, "HPET @%x, period: %dfs", _hpet_addr, _hpet_period);
+	}
+}
+#endif
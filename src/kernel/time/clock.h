@@ -0,0 +1,123 @@
+/*
+
+Clock sources
+=============
+
+Monotonic time in nanoseconds backed by invariant TSC, HPET or PIT
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __clock_h
+#define __clock_h
+
+#include "common.h"
+#include "../config.h"
+
+// Clock sources in order of preference
+#define CLOCK_SOURCE_NONE	0		// Not initialized
+#define CLOCK_SOURCE_TSC	1		// Invariant Time Stamp Counter
+#define CLOCK_SOURCE_HPET	2		// High Precision Event Timer main counter
+#define CLOCK_SOURCE_PIT	3		// PIT channel 2 (must be read at least every 54ms)
+
+// PIT input clock frequency (Hz)
+#define CLOCK_PIT_FREQ		1193182
+// Length of a single TSC calibration run (ms, no more than 54 for PIT)
+#define CLOCK_CALIBRATE_MS	10
+// Number of TSC calibration runs
+#define CLOCK_CALIBRATE_RUNS 3
+// Maximum disagreement between calibration runs (parts per million)
+#define CLOCK_CALIBRATE_PPM	1000
+// Number of round trips used to measure TSC offset of another CPU
+#define CLOCK_SYNC_ROUNDS	16
+
+/**
+* Initialize clock sources and calibrate TSC (call after ACPI has been initialized)
+* @return true if any clock source is available
+*/
+bool clock_init();
+/**
+* Get monotonic time
+* @return nanoseconds since clock_init()
+*/
+uint64 clock_monotonic_ns();
+/**
+* Get active clock source
+* @return CLOCK_SOURCE_*
+*/
+uint8 clock_source();
+/**
+* Get calibrated TSC frequency
+* @return frequency in kHz (0 if TSC could not be calibrated)
+*/
+uint64 clock_tsc_khz();
+/**
+* Convert TSC cycles to nanoseconds
+* @param cycles - TSC cycle count
+* @return nanoseconds
+*/
+uint64 clock_tsc_to_ns(uint64 cycles);
+/**
+* Convert nanoseconds to TSC cycles
+* @param ns - nanoseconds
+* @return TSC cycle count
+*/
+uint64 clock_ns_to_tsc(uint64 ns);
+/**
+* Get TSC to monotonic time conversion parameters (TSC clock source only)
+* ns = ((tsc + tsc_offset - base) * mult) >> 32
+* @param [out] base - TSC value at monotonic time 0
+* @param [out] mult - 32.32 fixed point nanoseconds per cycle
+* @return false if the clock source is not TSC
+*/
+bool clock_tsc_params(uint64 *base, uint64 *mult);
+/**
+* Get the local TSC value at which monotonic clock reaches given time (TSC clock source only)
+* @param ns - monotonic time in nanoseconds
+* @return TSC value of the calling CPU
+*/
+uint64 clock_tsc_deadline(uint64 ns);
+/**
+* Serve TSC offset measurement of another CPU (run on bootstrap processor with interrupts disabled)
+* Must be running at the same time as clock_sync_cpu() on the other CPU
+*/
+void clock_sync_master();
+/**
+* Measure and store TSC offset of the calling CPU against bootstrap processor
+*/
+void clock_sync_cpu();
+#if DEBUG == 1
+/**
+* List clock source information on screen
+*/
+void clock_list();
+#endif
+
+#endif /* __clock_h */
@@ -0,0 +1,428 @@
+/*
+
+Kernel timers
+=============
+
+Timers are kept on a hierarchical wheel: level 0 slots are 2^TIMER_SHIFT ns wide, every
+next level is 64 times coarser. Adding and cancelling is O(1), timers on higher levels
+are cascaded down when the wheel passes their slot. Hardware is programmed in one-shot
+mode for the earliest expiry only, so an idle wheel does not tick.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "timer.h"
+#include "clock.h"
+#include "apic.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "interrupts.h"
+#include "cpufeature.h"
+#include "msr.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+// Maximum number of callbacks collected under the wheel lock at once
+#define TIMER_BATCH 32
+
+/**
+* Timer wheel of a single CPU
+*/
+struct timer_wheel_struct {
+	spinlock_t lock;
+	uint64 now;									// Current level 0 slot time (ns >> TIMER_SHIFT)
+	uint64 pending[TIMER_LEVELS];				// Slot occupancy bitmaps
+	timer_t *slots[TIMER_LEVELS][TIMER_SLOTS];	// Timer lists
+	uint64 count;								// Number of queued timers
+	uint64 deadline;							// Programmed hardware expiry (ns, 0 - disarmed)
+} __ALIGN(64);
+typedef struct timer_wheel_struct timer_wheel_t;
+
+static timer_wheel_t _wheels[CPU_MAX];
+static bool _tsc_deadline = false;
+static uint64 _lapic_hz = 0;
+
+/**
+* Put timer in the slot matching its expiry time
+*/
+static void timer_link(timer_wheel_t *w, timer_t *t){
+	uint64 expires = (t->expires >> TIMER_SHIFT);
+	uint64 delta;
+	uint8 level = 0;
+	if (expires < w->now){
+		expires = w->now;
+	}
+	delta = expires - w->now;
+	if (delta >= (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS))){
+		// Too far away - park in the furthest slot, it will be re-sorted when cascaded
+		delta = (1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+		expires = w->now + delta;
+	}
+	while (delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1)))){
+		level ++;
+	}
+	t->level = level;
+	t->slot = (uint8)((expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+	t->next = w->slots[level][t->slot];
+	if (t->next != null){
+		t->next->pprev = &t->next;
+	}
+	t->pprev = &w->slots[level][t->slot];
+	w->slots[level][t->slot] = t;
+	w->pending[level] |= (1ULL << t->slot);
+}
+/**
+* Remove timer from its slot
+*/
+static void timer_unlink(timer_wheel_t *w, timer_t *t){
+	*t->pprev = t->next;
+	if (t->next != null){
+		t->next->pprev = t->pprev;
+	}
+	if (w->slots[t->level][t->slot] == null){
+		w->pending[t->level] &= ~(1ULL << t->slot);
+	}
+	t->next = null;
+	t->pprev = null;
+}
+/**
+* Move timers of the current slot on a level down to lower levels
+* @return slot index on that level
+*/
+static uint64 timer_cascade(timer_wheel_t *w, uint8 level){
+	uint64 slot = (w->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+	timer_t *t = w->slots[level][slot];
+	timer_t *next;
+	w->slots[level][slot] = null;
+	w->pending[level] &= ~(1ULL << slot);
+	while (t != null){
+		next = t->next;
+		timer_link(w, t);
+		t = next;
+	}
+	return slot;
+}
+/**
+* Find the distance to the next occupied slot in rotation order
+* @param bits - occupancy bitmap
+* @param from - first slot to check
+* @return distance from the first slot (0 - 63)
+*/
+static uint64 timer_next_slot(uint64 bits, uint64 from){
+	if (from != 0){
+		bits = (bits >> from) | (bits << (TIMER_SLOTS - from));
+	}
+	return __builtin_ctzll(bits);
+}
+/**
+* Advance wheel up to the given time and collect expired timers
+* @param w - wheel (locked)
+* @param now - current time (ns)
+* @param [out] expired - expired timers
+* @return number of expired timers (TIMER_BATCH means there might be more)
+*/
+static uint64 timer_collect(timer_wheel_t *w, uint64 now, timer_t **expired){
+	uint64 target = (now >> TIMER_SHIFT);
+	uint64 count = 0;
+	uint64 idx;
+	uint64 step;
+	uint64 mask;
+	uint8 level;
+	bool left;
+	timer_t *t;
+	timer_t *next;
+	while (w->now <= target){
+		idx = w->now & (TIMER_SLOTS - 1);
+		if (idx == 0){
+			level = 1;
+			while (level < TIMER_LEVELS && timer_cascade(w, level) == 0){
+				level ++;
+			}
+		}
+		left = false;
+		t = w->slots[0][idx];
+		while (t != null){
+			next = t->next;
+			if (t->expires > now){
+				// Same slot, but later within it (only in the slot of current time)
+				left = true;
+			} else if (count < TIMER_BATCH){
+				timer_unlink(w, t);
+				t->cpu = TIMER_IDLE;
+				w->count --;
+				expired[count ++] = t;
+			} else {
+				left = true;
+			}
+			t = next;
+		}
+		if (left){
+			break;
+		}
+		// Skip empty slots up to the next occupied one or the end of rotation
+		mask = w->pending[0] & ~((2ULL << idx) - 1);
+		if (mask != 0){
+			step = __builtin_ctzll(mask) - idx;
+		} else {
+			step = TIMER_SLOTS - idx;
+		}
+		if (w->now + step > target + 1){
+			step = target + 1 - w->now;
+		}
+		w->now += step;
+	}
+	return count;
+}
+/**
+* Find the earliest time the wheel needs attention
+* @return time in ns or 0 if wheel is empty
+*/
+static uint64 timer_next(timer_wheel_t *w){
+	uint64 next = ~((uint64)0);
+	uint64 cur;
+	uint64 dist;
+	uint64 when;
+	uint8 level;
+	timer_t *t;
+	if (w->count == 0){
+		return 0;
+	}
+	// Level 0 slot holds timers of a single slot time - take the exact earliest one
+	if (w->pending[0] != 0){
+		cur = w->now & (TIMER_SLOTS - 1);
+		t = w->slots[0][(cur + timer_next_slot(w->pending[0], cur)) & (TIMER_SLOTS - 1)];
+		while (t != null){
+			if (t->expires < next){
+				next = t->expires;
+			}
+			t = t->next;
+		}
+	}
+	// Higher levels need attention when their slot is cascaded
+	for (level = 1; level < TIMER_LEVELS; level ++){
+		if (w->pending[level] != 0){
+			cur = (w->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+			if ((w->now & ((1ULL << (TIMER_SLOT_BITS * level)) - 1)) == 0){
+				// Wheel stopped right at the boundary - current slot is not cascaded yet
+				dist = timer_next_slot(w->pending[level], cur);
+			} else {
+				dist = timer_next_slot(w->pending[level], (cur + 1) & (TIMER_SLOTS - 1)) + 1;
+			}
+			when = (((w->now >> (TIMER_SLOT_BITS * level)) + dist) << (TIMER_SLOT_BITS * level)) << TIMER_SHIFT;
+			if (when < next){
+				next = when;
+			}
+		}
+	}
+	return next;
+}
+/**
+* Program the calling CPU's timer hardware for the earliest expiry of its wheel
+* @param w - wheel of the calling CPU (locked)
+*/
+static void timer_program(timer_wheel_t *w){
+	uint64 deadline = timer_next(w);
+	uint64 now;
+	uint64 count;
+	w->deadline = deadline;
+	if (_tsc_deadline){
+		// Zero disarms the timer
+		msr_write(MSR_IA32_TSC_DEADLINE, (deadline != 0 ? clock_tsc_deadline(deadline) : 0));
+	} else if (deadline == 0){
+		apic_write_reg(APIC_INIT_COUNT, 0);
+	} else {
+		now = clock_monotonic_ns();
+		count = 1;
+		if (deadline > now){
+			count = ((deadline - now) * _lapic_hz) / 1000000000ULL;
+		}
+		if (count == 0){
+			count = 1;
+		} else if (count > 0xFFFFFFFF){
+			// Wake up early and reprogram
+			count = 0xFFFFFFFF;
+		}
+		apic_write_reg(APIC_INIT_COUNT, (uint32)count);
+	}
+}
+/**
+* Run expired timers of the calling CPU and reprogram its hardware
+*/
+static void timer_expire(){
+	timer_wheel_t *w = &_wheels[cpu_id()];
+	timer_t *expired[TIMER_BATCH];
+	uint64 count;
+	uint64 i;
+	uint64 flags;
+	do {
+		flags = spinlock_lock_irq(&w->lock);
+		count = timer_collect(w, clock_monotonic_ns(), expired);
+		spinlock_unlock_irq(&w->lock, flags);
+		for (i = 0; i < count; i ++){
+			expired[i]->func(expired[i]->arg);
+		}
+	} while (count == TIMER_BATCH);
+	flags = spinlock_lock_irq(&w->lock);
+	timer_program(w);
+	spinlock_unlock_irq(&w->lock, flags);
+}
+/**
+* Local APIC timer interrupt handler
+*/
+static uint64 timer_handler(int_stack_t *stack){
+	timer_expire();
+	return 0;
+}
+/**
+* Measure Local APIC timer frequency against the monotonic clock
+*/
+static void timer_calibrate(){
+	uint64 start;
+	uint64 end;
+	uint32 count;
+	apic_write_reg(APIC_DIV_CONF, APIC_TIMER_DIV_16);
+	apic_write_reg(APIC_LVT_TIMER, APIC_LVT_MASKED | INT_VECTOR_TIMER);
+	start = clock_monotonic_ns();
+	apic_write_reg(APIC_INIT_COUNT, 0xFFFFFFFF);
+	do {
+		end = clock_monotonic_ns();
+	} while (end - start < TIMER_CALIBRATE_MS * 1000000ULL);
+	count = 0xFFFFFFFF - apic_read_reg(APIC_CURR_COUNT);
+	apic_write_reg(APIC_INIT_COUNT, 0);
+	_lapic_hz = ((uint64)count * 1000000000ULL) / (end - start);
+}
+
+bool timer_init(){
+	uint64 now;
+	uint64 i;
+	if (clock_source() == CLOCK_SOURCE_NONE){
+		return false;
+	}
+	mem_fill((uint8 *)_wheels, sizeof(_wheels), 0);
+	now = (clock_monotonic_ns() >> TIMER_SHIFT);
+	for (i = 0; i < CPU_MAX; i ++){
+		_wheels[i].now = now;
+	}
+	// TSC deadline mode needs TSC as the clock source to convert deadlines
+	_tsc_deadline = (cpu_has(CPU_FEATURE_TSC_DEADLINE) && clock_source() == CLOCK_SOURCE_TSC);
+	if (!_tsc_deadline){
+		timer_calibrate();
+	}
+#if DEBUG == 1
+	if (_tsc_deadline){
+		debug_print(DC_WB, "Timer: TSC deadline");
+	} else {
+		debug_print(DC_WB, "Timer: Local APIC %dkHz", _lapic_hz / 1000);
+	}
+#endif
+	interrupt_reg_handler(INT_VECTOR_TIMER, timer_handler);
+	timer_init_cpu();
+	return true;
+}
+void timer_init_cpu(){
+	timer_wheel_t *w = &_wheels[cpu_id()];
+	uint64 flags;
+	apic_write_reg(APIC_DIV_CONF, APIC_TIMER_DIV_16);
+	if (_tsc_deadline){
+		apic_write_reg(APIC_LVT_TIMER, APIC_LVT_TSC_DEADLINE | INT_VECTOR_TIMER);
+		// LVT write has to be visible before the deadline MSR is written
+		asm volatile("mfence" : : : "memory");
+	} else {
+		apic_write_reg(APIC_LVT_TIMER, INT_VECTOR_TIMER);
+	}
+	flags = spinlock_lock_irq(&w->lock);
+	timer_program(w);
+	spinlock_unlock_irq(&w->lock, flags);
+}
+void timer_setup(timer_t *timer, timer_func_t func, void *arg){
+	timer->next = null;
+	timer->pprev = null;
+	timer->expires = 0;
+	timer->func = func;
+	timer->arg = arg;
+	timer->cpu = TIMER_IDLE;
+	timer->level = 0;
+	timer->slot = 0;
+}
+void timer_add(timer_t *timer, uint64 expires){
+	timer_add_on(timer, expires, cpu_id());
+}
+void timer_add_on(timer_t *timer, uint64 expires, uint64 cpu){
+	timer_wheel_t *w = &_wheels[cpu];
+	bool kick = false;
+	uint64 flags;
+	timer_cancel(timer);
+	flags = spinlock_lock_irq(&w->lock);
+	timer->expires = expires;
+	timer->cpu = cpu;
+	timer_link(w, timer);
+	w->count ++;
+	if (w->deadline == 0 || expires < w->deadline){
+		if (cpu == cpu_id()){
+			timer_program(w);
+		} else {
+			// Let the other CPU reprogram its own hardware
+			kick = true;
+		}
+	}
+	spinlock_unlock_irq(&w->lock, flags);
+	if (kick){
+		apic_send_ipi((uint8)percpu_get(cpu)->apic_id, INT_VECTOR_TIMER);
+	}
+}
+bool timer_cancel(timer_t *timer){
+	timer_wheel_t *w;
+	uint64 cpu;
+	uint64 flags;
+	while ((cpu = timer->cpu) != TIMER_IDLE){
+		w = &_wheels[cpu];
+		flags = spinlock_lock_irq(&w->lock);
+		// Timer might have fired or moved while we were taking the lock
+		if (timer->cpu == cpu){
+			timer_unlink(w, timer);
+			timer->cpu = TIMER_IDLE;
+			w->count --;
+			spinlock_unlock_irq(&w->lock, flags);
+			// Hardware stays armed - an early wake-up just finds nothing to do
+			return true;
+		}
+		spinlock_unlock_irq(&w->lock, flags);
+	}
+	return false;
+}
+uint64 timer_pending(uint64 cpu){
+	return _wheels[cpu].count;
+}
+uint64 timer_deadline(uint64 cpu){
+	return _wheels[cpu].deadline;
+}
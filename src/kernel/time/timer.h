@@ -0,0 +1,124 @@
+/*
+
+Kernel timers
+=============
+
+Hierarchical timer wheel per CPU with one-shot Local APIC (or TSC deadline) expiry
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __timer_h
+#define __timer_h
+
+#include "common.h"
+
+// Level 0 slot width (2^16 ns = 65.5us)
+#define TIMER_SHIFT			16
+// Number of levels (each level covers 64 times more time than the previous one)
+#define TIMER_LEVELS		6
+// Slots per level (must be 64 - occupancy is kept in a single bitmap)
+#define TIMER_SLOTS			64
+#define TIMER_SLOT_BITS		6
+// Timer is not queued on any wheel
+#define TIMER_IDLE			((uint64)-1)
+// Local APIC timer calibration time (ms)
+#define TIMER_CALIBRATE_MS	10
+
+/**
+* Timer callback (runs in interrupt context of the CPU the timer was queued on)
+* @param arg - argument passed to timer_set()
+*/
+typedef void (*timer_func_t)(void *arg);
+/**
+* Timer (embed it in the structure that owns the timeout)
+*/
+struct timer_struct {
+	struct timer_struct *next;	// Next timer in the slot
+	struct timer_struct **pprev;// Pointer to the link that points to this timer
+	uint64 expires;				// Expiry time (monotonic clock, ns)
+	timer_func_t func;			// Callback
+	void *arg;					// Callback argument
+	uint64 volatile cpu;		// Wheel this timer is queued on, or TIMER_IDLE
+	uint8 level;				// Wheel level
+	uint8 slot;					// Slot in the level
+};
+typedef struct timer_struct timer_t;
+
+/**
+* Initialize timer wheels and the Local APIC timer of the bootstrap processor
+* (call after APIC and clock sources have been initialized)
+* @return true on success
+*/
+bool timer_init();
+/**
+* Start Local APIC timer on the calling CPU (for application processors)
+*/
+void timer_init_cpu();
+/**
+* Prepare a timer
+* @param timer - timer
+* @param func - callback
+* @param arg - callback argument
+*/
+void timer_setup(timer_t *timer, timer_func_t func, void *arg);
+/**
+* Queue timer on the calling CPU's wheel (re-queue if it's already pending)
+* @param timer - timer
+* @param expires - expiry time (monotonic clock, ns)
+*/
+void timer_add(timer_t *timer, uint64 expires);
+/**
+* Queue timer on a specific CPU's wheel
+* @param timer - timer
+* @param expires - expiry time (monotonic clock, ns)
+* @param cpu - CPU index
+*/
+void timer_add_on(timer_t *timer, uint64 expires, uint64 cpu);
+/**
+* Cancel a pending timer
+* @param timer - timer
+* @return true if timer was pending, false if it has already fired (or was never added)
+*/
+bool timer_cancel(timer_t *timer);
+/**
+* Get the number of timers pending on a CPU
+* @param cpu - CPU index
+* @return timer count
+*/
+uint64 timer_pending(uint64 cpu);
+/**
+* Get the expiry time programmed for the next timer interrupt of a CPU
+* @param cpu - CPU index
+* @return expiry time (monotonic clock, ns) or 0 if no timer is pending
+*/
+uint64 timer_deadline(uint64 cpu);
+
+#endif /* __timer_h */
@@ -0,0 +1,150 @@
+/*
+
+Shared time page
+================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "../config.h"
+#include "vdso.h"
+#include "clock.h"
+#include "percpu.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "cpufeature.h"
+#include "msr.h"
+#include "lib.h"
+#if DEBUG == 1
+	#include "debug_print.h"
+#endif
+
+// Kernel writes the page through the same mapping (CR0.WP is clear)
+static time_page_t _page __ALIGN(PAGE_SIZE);
+static spinlock_t _lock = SPINLOCK_INIT;
+static bool _rdtscp = false;
+
+/**
+* Start a page update (readers retry until vdso_write_end())
+* @return saved RFLAGS
+*/
+static uint64 vdso_write_begin(){
+	uint64 flags = spinlock_lock_irq(&_lock);
+	__atomic_store_n(&_page.seq, _page.seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return flags;
+}
+/**
+* Finish a page update
+* @param flags - value returned by vdso_write_begin()
+*/
+static void vdso_write_end(uint64 flags){
+	__atomic_store_n(&_page.seq, _page.seq + 1, __ATOMIC_RELEASE);
+	spinlock_unlock_irq(&_lock, flags);
+}
+
+void vdso_init(){
+	uint64 base;
+	uint64 mult;
+	pm_t pe;
+	uint64 flags;
+	mem_fill((uint8 *)&_page, sizeof(_page), 0);
+	_rdtscp = cpu_has(CPU_FEATURE_RDTSCP);
+	flags = vdso_write_begin();
+	if (clock_tsc_params(&base, &mult)){
+		_page.tsc_khz = clock_tsc_khz();
+		_page.tsc_base = base;
+		_page.tsc_mult = mult;
+		_page.ns_base = 0;
+		_page.flags = TIME_PAGE_TSC | (_rdtscp ? TIME_PAGE_RDTSCP : 0);
+	}
+	vdso_write_end(flags);
+	vdso_init_cpu();
+	// Readable, but not writable from user mode
+	page_set_user((uint64)&_page, true);
+	pe = page_get_pml_entry((uint64)&_page, 0);
+	pe.s.writable = 0;
+	page_set_pml_entry((uint64)&_page, 0, pe);
+}
+void vdso_init_cpu(){
+	percpu_t *cpu = percpu_this();
+	uint64 flags;
+	if (_rdtscp){
+		msr_write(MSR_IA32_TSC_AUX, cpu->id);
+	}
+	if (cpu->id < TIME_PAGE_CPUS){
+		flags = vdso_write_begin();
+		_page.tsc_offset[cpu->id] = cpu->tsc_offset;
+		vdso_write_end(flags);
+	}
+}
+void vdso_set_realtime(uint64 ns){
+	uint64 flags = vdso_write_begin();
+	_page.realtime_offset = ns - clock_monotonic_ns();
+	vdso_write_end(flags);
+}
+const time_page_t *vdso_time_page(){
+	return &_page;
+}
+
+#if DEBUG == 1
+void vdso_bench(uint64 loops){
+	uint64 start;
+	uint64 t;
+	uint64 ns = 0;
+	uint64 last = 0;
+	uint64 back = 0;
+	uint64 i;
+	int64 diff;
+	if (loops == 0 || !time_page_monotonic(&_page, &ns)){
+		debug_print(DC_WB, "Time page: TSC is not the clock source");
+		return;
+	}
+	start = rdtsc();
+	for (i = 0; i < loops; i ++){
+		time_page_monotonic(&_page, &ns);
+		if (ns < last){
+			back ++;
+		}
+		last = ns;
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "Time page read: %dns, went backwards %d times", clock_tsc_to_ns(t) / loops, back);
+	start = rdtsc();
+	for (i = 0; i < loops; i ++){
+		ns = clock_monotonic_ns();
+	}
+	t = rdtsc() - start;
+	debug_print(DC_WB, "clock_monotonic_ns(): %dns", clock_tsc_to_ns(t) / loops);
+	time_page_monotonic(&_page, &last);
+	diff = (int64)(clock_monotonic_ns() - last);
+	debug_print(DC_WB, "Difference: %dns", (diff < 0 ? -diff : diff));
+}
+#endif
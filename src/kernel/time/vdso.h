@@ -0,0 +1,73 @@
+/*
+
+Shared time page
+================
+
+A page readable from user mode with TSC calibration and per-CPU TSC offsets,
+updated under a sequence counter. User code reads the clock with
+lib/timepage.h without a system call.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __vdso_h
+#define __vdso_h
+
+#include "common.h"
+#include "../config.h"
+#include "timepage.h"
+
+/**
+* Fill the time page and make it readable from user mode (call after clock_init())
+*/
+void vdso_init();
+/**
+* Publish TSC offset of the calling CPU and store its index in TSC_AUX (call after clock_sync_cpu())
+*/
+void vdso_init_cpu();
+/**
+* Set wall clock time
+* @param ns - current time since Unix epoch (ns)
+*/
+void vdso_set_realtime(uint64 ns);
+/**
+* Get the time page
+* @return time page address
+*/
+const time_page_t *vdso_time_page();
+#if DEBUG == 1
+/**
+* Compare time page reads with clock_monotonic_ns()
+* @param loops - number of reads
+*/
+void vdso_bench(uint64 loops);
+#endif
+
+#endif /* __vdso_h */
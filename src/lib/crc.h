@@ -0,0 +1,66 @@
+/*
+
+CRC-32C checksums
+=================
+
+Castagnoli CRC (iSCSI, ext4 and btrfs metadata, SCTP). Table driven version for
+any CPU and one using the SSE4.2 CRC32 instruction, the kernel binds crc32 to
+the best of them at boot.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __crc_h
+#define __crc_h
+
+#include "common.h"
+
+/**
+* CRC-32C implementation
+* @param crc - CRC of the preceding data (0 for the first block)
+* @param [in] buf - data
+* @param len - data length
+* @return CRC of all the data so far
+*/
+typedef uint32 (*crc32c_t)(uint32 crc, const uint8 *buf, uint64 len);
+/**
+* Calculate CRC-32C (bound to the best implementation at boot, see cpufeature.c)
+*/
+extern crc32c_t crc32c;
+/**
+* Table driven CRC-32C (any CPU)
+*/
+uint32 crc32c_table(uint32 crc, const uint8 *buf, uint64 len);
+/**
+* CRC-32C with SSE4.2 CRC32 instruction (8 bytes per instruction)
+*/
+uint32 crc32c_sse42(uint32 crc, const uint8 *buf, uint64 len);
+
+#endif /* __crc_h */
@@ -44,13 +44,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Memory manipulation functions
 //
 
-void mem_copy(uint8 *dest, uint64 len, const uint8 *src){
+mem_copy_t mem_copy = mem_copy_movsb;
+
+void mem_copy_movsb(uint8 *dest, uint64 len, const uint8 *src){
 	// Fast copy
-	asm volatile ("rep\n\tmovsb" : : "c"(len), "S"(src), "D"(dest));
+	asm volatile ("rep\n\tmovsb" : "+c"(len), "+S"(src), "+D"(dest) : : "memory");
+}
+void mem_copy_movsq(uint8 *dest, uint64 len, const uint8 *src){
+	uint64 tail = (len & 7);
+	len >>= 3;
+	asm volatile ("rep\n\tmovsq" : "+c"(len), "+S"(src), "+D"(dest) : : "memory");
+	asm volatile ("rep\n\tmovsb" : "+c"(tail), "+S"(src), "+D"(dest) : : "memory");
 }
 void mem_fill(uint8 *dest, uint64 len, uint8 val){
 	// Fast fill
-	asm volatile ("rep\n\tstosb" : : "c"(len), "a"(val), "D"(dest));
+	asm volatile ("rep\n\tstosb" : "+c"(len), "+D"(dest) : "a"(val) : "memory");
 }
 bool mem_compare(const uint8 *buff1, const uint8 *buff2, uint64 len){
 	while (len--){
@@ -56,14 +56,30 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Memory manipulation functions
 //
 
+/**
+* Memory copy implementation
+* @param [out] dest - destination memory
+* @param len - number of bytes to copy
+* @param [in] src - source memory
+*/
+typedef void (*mem_copy_t)(uint8 *dest, uint64 len, const uint8 *src);
 /**
 * Copy data from one memory location to another
+* Bound to the best implementation for the CPU at boot (see cpufeature.c)
 * @param [out] dest - destination memory
 * @param [in] src - source memory
 * @param len - number of bytes to copy
 * @return void
 */
-void mem_copy(uint8 *dest, uint64 len, const uint8 *src);
+extern mem_copy_t mem_copy;
+/**
+* Copy memory byte by byte with REP MOVSB (fastest with ERMS/FSRM)
+*/
+void mem_copy_movsb(uint8 *dest, uint64 len, const uint8 *src);
+/**
+* Copy memory in 8 byte words with REP MOVSQ (CPUs without ERMS)
+*/
+void mem_copy_movsq(uint8 *dest, uint64 len, const uint8 *src);
 /**
 * Fill a memory buffer with a single byte value
 * @param [out] dest - destination memory
@@ -0,0 +1,172 @@
+/*
+
+Lock-free ring buffers
+======================
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ring.h"
+#include "lib.h"
+
+/**
+* Copy elements between a ring buffer and a flat array, wrapping around the end of the ring
+* @param data - ring buffer
+* @param mask - element count - 1
+* @param elem_size - element size
+* @param pos - ring position of the first element
+* @param items - flat array
+* @param n - number of elements
+* @param to_ring - copy direction
+*/
+static void ring_copy(uint8 *data, uint64 mask, uint64 elem_size, uint64 pos, uint8 *items, uint64 n, bool to_ring){
+	uint64 idx = pos & mask;
+	uint64 first = mask + 1 - idx;
+	if (first > n){
+		first = n;
+	}
+	if (to_ring){
+		mem_copy(data + idx * elem_size, first * elem_size, items);
+		mem_copy(data, (n - first) * elem_size, items + first * elem_size);
+	} else {
+		mem_copy(items, first * elem_size, data + idx * elem_size);
+		mem_copy(items + first * elem_size, (n - first) * elem_size, data);
+	}
+}
+
+bool ring_spsc_init(ring_spsc_t *ring, void *data, uint64 count, uint64 elem_size){
+	if (count == 0 || (count & (count - 1)) != 0){
+		return false;
+	}
+	ring->head = 0;
+	ring->tail_cache = 0;
+	ring->tail = 0;
+	ring->head_cache = 0;
+	ring->data = (uint8 *)data;
+	ring->mask = count - 1;
+	ring->elem_size = elem_size;
+	return true;
+}
+uint64 ring_spsc_enqueue(ring_spsc_t *ring, const void *items, uint64 n){
+	uint64 head = ring->head;
+	uint64 free = ring->mask + 1 - (head - ring->tail_cache);
+	if (free < n){
+		// Only touch consumer's cache line when the cached view is not enough
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		free = ring->mask + 1 - (head - ring->tail_cache);
+		if (free < n){
+			n = free;
+		}
+	}
+	if (n > 0){
+		ring_copy(ring->data, ring->mask, ring->elem_size, head, (uint8 *)items, n, true);
+		__atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+uint64 ring_spsc_dequeue(ring_spsc_t *ring, void *items, uint64 n){
+	uint64 tail = ring->tail;
+	uint64 avail = ring->head_cache - tail;
+	if (avail < n){
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		avail = ring->head_cache - tail;
+		if (avail < n){
+			n = avail;
+		}
+	}
+	if (n > 0){
+		ring_copy(ring->data, ring->mask, ring->elem_size, tail, (uint8 *)items, n, false);
+		// Slots can be reused once the data has been read
+		__atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+uint64 ring_spsc_count(ring_spsc_t *ring){
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+bool ring_mpsc_init(ring_mpsc_t *ring, void *buffer, uint64 count, uint64 elem_size){
+	uint64 i;
+	if (count == 0 || (count & (count - 1)) != 0){
+		return false;
+	}
+	ring->head = 0;
+	ring->tail = 0;
+	ring->data = (uint8 *)buffer;
+	ring->mask = count - 1;
+	ring->elem_size = elem_size;
+	ring->stride = RING_MPSC_STRIDE(elem_size);
+	// Slot is free for position p when its sequence equals p
+	for (i = 0; i < count; i ++){
+		*(uint64 *)(ring->data + i * ring->stride) = i;
+	}
+	return true;
+}
+uint64 ring_mpsc_enqueue(ring_mpsc_t *ring, const void *items, uint64 n){
+	uint64 head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint64 free;
+	uint64 i;
+	uint8 *slot;
+	// Reserve slots
+	do {
+		free = ring->mask + 1 - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+		if (free < n){
+			n = free;
+		}
+		if (n == 0){
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&ring->head, &head, head + n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	// Fill and publish each slot
+	for (i = 0; i < n; i ++){
+		slot = ring->data + ((head + i) & ring->mask) * ring->stride;
+		mem_copy(slot + 8, ring->elem_size, (const uint8 *)items + i * ring->elem_size);
+		__atomic_store_n((uint64 *)slot, head + i + 1, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+uint64 ring_mpsc_dequeue(ring_mpsc_t *ring, void *items, uint64 n){
+	uint64 tail = ring->tail;
+	uint64 i;
+	uint8 *slot;
+	for (i = 0; i < n; i ++){
+		slot = ring->data + ((tail + i) & ring->mask) * ring->stride;
+		if (__atomic_load_n((uint64 *)slot, __ATOMIC_ACQUIRE) != tail + i + 1){
+			// Empty or still being written
+			break;
+		}
+		mem_copy((uint8 *)items + i * ring->elem_size, ring->elem_size, slot + 8);
+		// Free the slot for the producer one lap ahead
+		__atomic_store_n((uint64 *)slot, tail + i + ring->mask + 1, __ATOMIC_RELEASE);
+	}
+	if (i > 0){
+		__atomic_store_n(&ring->tail, tail + i, __ATOMIC_RELEASE);
+	}
+	return i;
+}
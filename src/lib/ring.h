@@ -0,0 +1,138 @@
+/*
+
+Lock-free ring buffers
+======================
+
+Single-producer/single-consumer and multi-producer/single-consumer rings of
+fixed size elements. Element count is a power of 2, producer and consumer
+indices live on separate cache lines and are published with release stores.
+MPSC producers never wait for each other, so they are safe to use from
+interrupt handlers.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __ring_h
+#define __ring_h
+
+#include "common.h"
+
+// Cache line size used for padding
+#define RING_CACHE_LINE 64
+// MPSC slot size - sequence number followed by the element (8 byte aligned)
+#define RING_MPSC_STRIDE(elem_size) (8 + (((elem_size) + 7) & ~7ULL))
+// MPSC buffer size needed for count elements
+#define RING_MPSC_BUFFER_SIZE(count, elem_size) ((count) * RING_MPSC_STRIDE(elem_size))
+
+/**
+* Single-producer/single-consumer ring
+*/
+struct ring_spsc_struct {
+	uint64 head __ALIGN(RING_CACHE_LINE);	// Producer: next slot to write
+	uint64 tail_cache;						// Producer: last seen consumer position
+	uint64 tail __ALIGN(RING_CACHE_LINE);	// Consumer: next slot to read
+	uint64 head_cache;						// Consumer: last seen producer position
+	uint8 *data __ALIGN(RING_CACHE_LINE);	// Element buffer (count * elem_size bytes)
+	uint64 mask;							// Element count - 1
+	uint64 elem_size;						// Element size in bytes
+} __ALIGN(RING_CACHE_LINE);
+typedef struct ring_spsc_struct ring_spsc_t;
+/**
+* Multi-producer/single-consumer ring
+*/
+struct ring_mpsc_struct {
+	uint64 head __ALIGN(RING_CACHE_LINE);	// Producers: next slot to reserve
+	uint64 tail __ALIGN(RING_CACHE_LINE);	// Consumer: next slot to read
+	uint8 *data __ALIGN(RING_CACHE_LINE);	// Slot buffer (RING_MPSC_BUFFER_SIZE bytes)
+	uint64 mask;							// Element count - 1
+	uint64 elem_size;						// Element size in bytes
+	uint64 stride;							// Slot size in bytes
+} __ALIGN(RING_CACHE_LINE);
+typedef struct ring_mpsc_struct ring_mpsc_t;
+
+/**
+* Initialize SPSC ring
+* @param ring - ring
+* @param data - element buffer (count * elem_size bytes)
+* @param count - number of elements (power of 2)
+* @param elem_size - element size in bytes
+* @return false if count is not a power of 2
+*/
+bool ring_spsc_init(ring_spsc_t *ring, void *data, uint64 count, uint64 elem_size);
+/**
+* Add elements (producer only)
+* @param ring - ring
+* @param items - elements
+* @param n - number of elements
+* @return number of elements added (less than n if the ring is full)
+*/
+uint64 ring_spsc_enqueue(ring_spsc_t *ring, const void *items, uint64 n);
+/**
+* Take elements (consumer only)
+* @param ring - ring
+* @param [out] items - elements
+* @param n - maximum number of elements
+* @return number of elements taken
+*/
+uint64 ring_spsc_dequeue(ring_spsc_t *ring, void *items, uint64 n);
+/**
+* Get the number of queued elements (exact only for producer or consumer)
+* @param ring - ring
+* @return element count
+*/
+uint64 ring_spsc_count(ring_spsc_t *ring);
+/**
+* Initialize MPSC ring
+* @param ring - ring
+* @param buffer - slot buffer (RING_MPSC_BUFFER_SIZE(count, elem_size) bytes)
+* @param count - number of elements (power of 2)
+* @param elem_size - element size in bytes
+* @return false if count is not a power of 2
+*/
+bool ring_mpsc_init(ring_mpsc_t *ring, void *buffer, uint64 count, uint64 elem_size);
+/**
+* Add elements (any producer, including interrupt handlers)
+* @param ring - ring
+* @param items - elements
+* @param n - number of elements
+* @return number of elements added (less than n if the ring is full)
+*/
+uint64 ring_mpsc_enqueue(ring_mpsc_t *ring, const void *items, uint64 n);
+/**
+* Take elements (consumer only)
+* Stops at the first slot a producer is still writing
+* @param ring - ring
+* @param [out] items - elements
+* @param n - maximum number of elements
+* @return number of elements taken
+*/
+uint64 ring_mpsc_dequeue(ring_mpsc_t *ring, void *items, uint64 n);
+
+#endif /* __ring_h */
@@ -0,0 +1,133 @@
+/*
+
+Shared time page reader
+=======================
+
+Layout of the read-only time page exported by the kernel (see kernel/time/vdso.c)
+and a lock-free clock_gettime() equivalent that reads it without entering the
+kernel. Header only, so it can be compiled into user mode code.
+
+License (BSD-3)
+===============
+
+Copyright (c) 2012, Gusts 'gusC' Kaksis <gusts.kaksis@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef __timepage_h
+#define __timepage_h
+
+#include "common.h"
+
+// Number of per-CPU TSC offsets in the page
+#define TIME_PAGE_CPUS			64
+// Clock IDs
+#define TIME_CLOCK_MONOTONIC	0	// Time since boot
+#define TIME_CLOCK_REALTIME		1	// Wall clock time (Unix epoch)
+// Time page flags
+#define TIME_PAGE_TSC			0x1	// Clock can be read from TSC (otherwise use a system call)
+#define TIME_PAGE_RDTSCP		0x2	// TSC_AUX holds CPU index (otherwise CPU 0 offset is used)
+
+/**
+* Time page (written by the kernel only)
+* Readers retry while seq is odd or changes during the read
+*/
+struct time_page_struct {
+	uint32 seq;						// Sequence counter (odd while the kernel updates the page)
+	uint32 flags;					// TIME_PAGE_*
+	uint64 tsc_khz;					// Calibrated TSC frequency
+	uint64 tsc_base;				// TSC value at monotonic time ns_base
+	uint64 tsc_mult;				// ns = ((tsc - tsc_base) * tsc_mult) >> 32
+	uint64 ns_base;					// Monotonic time at tsc_base (ns)
+	uint64 realtime_offset;			// Wall clock time at monotonic 0 (ns)
+	int64 tsc_offset[TIME_PAGE_CPUS];	// Per-CPU correction added to local TSC
+};
+typedef struct time_page_struct time_page_t;
+/**
+* Time value
+*/
+struct time_spec_struct {
+	int64 sec;
+	int64 nsec;
+};
+typedef struct time_spec_struct time_spec_t;
+
+/**
+* Read monotonic time from the time page
+* @param page - time page
+* @param [out] ns - nanoseconds since boot
+* @return false if TSC can't be used (fall back to SYSCALL_CLOCK)
+*/
+static bool time_page_monotonic(const time_page_t *page, uint64 *ns){
+	uint32 seq;
+	uint32 lo, hi, aux;
+	uint64 tsc;
+	do {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1){
+			asm volatile("pause");
+			continue;
+		}
+		if (!(page->flags & TIME_PAGE_TSC)){
+			return false;
+		}
+		if (page->flags & TIME_PAGE_RDTSCP){
+			// CPU index comes with the same reading, so a migration can't mix them up
+			asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+		} else {
+			asm volatile("lfence; rdtsc" : "=a"(lo), "=d"(hi));
+			aux = 0;
+		}
+		tsc = (((uint64)hi) << 32) | lo;
+		tsc += page->tsc_offset[aux % TIME_PAGE_CPUS];
+		*ns = page->ns_base + (uint64)(((unsigned __int128)(tsc - page->tsc_base) * page->tsc_mult) >> 32);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+	return true;
+}
+/**
+* Get time of a clock without a system call
+* @param page - time page
+* @param clock - TIME_CLOCK_*
+* @param [out] ts - time
+* @return false if the clock can't be read from the page
+*/
+static bool time_page_clock_gettime(const time_page_t *page, uint64 clock, time_spec_t *ts){
+	uint64 ns;
+	if (!time_page_monotonic(page, &ns)){
+		return false;
+	}
+	if (clock == TIME_CLOCK_REALTIME){
+		ns += __atomic_load_n(&page->realtime_offset, __ATOMIC_RELAXED);
+	} else if (clock != TIME_CLOCK_MONOTONIC){
+		return false;
+	}
+	ts->sec = (int64)(ns / 1000000000ULL);
+	ts->nsec = (int64)(ns % 1000000000ULL);
+	return true;
+}
+
+#endif /* __timepage_h */